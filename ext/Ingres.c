@@ -75,50 +75,330 @@
  */
 
 #include "ruby.h"
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+#include "ruby/thread.h"
+#endif
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+#include "ruby/fiber/scheduler.h"
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <time.h>
+#include <math.h>
+#include <limits.h>
 #include <iiapi.h>
 #include "Ingres.h"
 #include "Unicode.h"
 
 
 static VALUE cIngres;
+static VALUE cIngresCursor;
+static VALUE cIngresResult;
+static VALUE cIngresLob;
+static VALUE cIngresTimeoutError;
+static VALUE cIngresAsyncResult;
+static VALUE cIngresStatement;
 
 II_GLOBALS ii_globals;
-II_LONG global_rows_affected = 0;
 
 extern u_i2 *CM_AttrTab;
 extern char *CM_CaseTab;
 
-/* static int ii_sync(IIAPI_GENPARM *genParm)
+/* Milliseconds since an arbitrary fixed point, used for statement deadlines */
+static double
+ii_clock_ms ()
+{
+#if defined(NT_GENERIC)
+  return (double) GetTickCount ();
+#else
+  struct timespec now;
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (now.tv_sec * 1000.0) + (now.tv_nsec / 1000000.0);
+#endif
+}
+
+/* The deadline for a statement with a timeout of param_timeout milliseconds */
+static double
+ii_deadline (long param_timeout)
+{
+  return (param_timeout > 0) ? ii_clock_ms () + param_timeout : 0;
+}
+
+/* Cancel the statement being waited on, if there is one.  No Ruby API calls
+ * may be made here */
+static void
+ii_sync_cancel (II_SYNC *sync)
+{
+  if (sync->stmtHandle == NULL || sync->cancelling)
+    return;
+
+  sync->cancelParm.cn_genParm.gp_callback = NULL;
+  sync->cancelParm.cn_genParm.gp_closure = NULL;
+  sync->cancelParm.cn_stmtHandle = sync->stmtHandle;
+  sync->cancelling = TRUE;
+  IIapi_cancel (&sync->cancelParm);
+}
+
+/* Wait for an OpenAPI call, and any cancel issued for it, to complete.  No
+ * Ruby API calls may be made here as it runs without the GVL where that is
+ * supported.  IIapi_wait() is given a timeout so that an interrupt from Ruby,
+ * or the statement's deadline passing, is noticed between waits.  Returns
+ * early on an interrupt, for ii_sync_run() to find out what Ruby wants */
+static void *
+ii_sync_wait (void *param_sync)
+{
+  II_SYNC *sync = (II_SYNC *) param_sync;
+  double remaining;
+
+  while (sync->genParm->gp_completed == FALSE ||
+         (sync->cancelling && sync->cancelParm.cn_genParm.gp_completed == FALSE))
+  {
+    if (sync->interrupted && !sync->cancelling && !sync->raised)
+      break;
+
+    sync->waitParm.wt_timeout = INGRES_SYNC_WAIT_SLICE;
+    if (sync->deadline > 0 && !sync->cancelling)
+    {
+      remaining = sync->deadline - ii_clock_ms ();
+      if (remaining <= 0)
+      {
+        sync->timedOut = TRUE;
+        ii_sync_cancel (sync);
+        continue;
+      }
+      if (remaining < INGRES_SYNC_WAIT_SLICE)
+        sync->waitParm.wt_timeout = (II_LONG) remaining + 1;
+    }
+
+    IIapi_wait (&sync->waitParm);
+
+    /* IIAPI_ST_FAILURE is a wait that ran out of time, keep waiting.
+     * Anything else that is not a success is a real error */
+    if (sync->waitParm.wt_status == IIAPI_ST_FAILURE)
+      sync->waitParm.wt_status = IIAPI_ST_SUCCESS;
+    else if (sync->waitParm.wt_status != IIAPI_ST_SUCCESS)
+      break;
+  }
+  return NULL;
+}
+
+/* Unblocking function for ii_sync_wait(), called when Ruby wants the waiting
+ * thread back, for Thread#raise, Thread#kill, Thread#wakeup or a signal.  It
+ * only flags the interrupt, ii_sync_run() decides whether the statement has
+ * to be cancelled once it holds the GVL again */
+static void
+ii_sync_unblock (void *param_sync)
+{
+  II_SYNC *sync = (II_SYNC *) param_sync;
+
+  sync->interrupted = TRUE;
+}
+
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+static VALUE
+ii_sync_check_ints (VALUE unused)
+{
+  rb_thread_check_ints ();
+  return Qnil;
+}
+#endif
+
+/*
+**      ii_sync_run() - Wait for an OpenAPI call with the GVL released
+**
+**      Description -
+**              Each time the wait is interrupted the thread's pending
+**              interrupts are run.  When one of them raises, for
+**              Thread#raise, Thread#kill or a signal handler that raises,
+**              the statement being waited on is cancelled and the state is
+**              kept in sync->raised for the caller to re-raise once the
+**              statement has been cleaned up.  Anything else, a timer tick
+**              or Thread#wakeup, goes back to waiting.  Calls that are not
+**              on a statement cannot be cancelled and are waited on until
+**              they complete.
+*/
+static void
+ii_sync_run (II_SYNC *sync)
+{
+  sync->waitParm.wt_status = IIAPI_ST_SUCCESS;
+  sync->interrupted = FALSE;
+  sync->timedOut = FALSE;
+  sync->cancelling = FALSE;
+  sync->raised = 0;
+  sync->cancelParm.cn_genParm.gp_completed = FALSE;
+
+  if (sync->genParm->gp_completed == FALSE)
+  {
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+    /* finalizers, such as free_ii_conn(), must keep the GVL */
+    if (!rb_during_gc ())
+    {
+      /* other threads may run now, keep them off the connection */
+      *sync->busy = TRUE;
+      while ((sync->genParm->gp_completed == FALSE ||
+              (sync->cancelling && sync->cancelParm.cn_genParm.gp_completed == FALSE)) &&
+             sync->waitParm.wt_status == IIAPI_ST_SUCCESS)
+      {
+        rb_thread_call_without_gvl2 (ii_sync_wait, sync, ii_sync_unblock, sync);
+
+        /* the wait is skipped altogether when an interrupt was pending */
+        if (!sync->raised)
+        {
+          sync->interrupted = FALSE;
+          rb_protect (ii_sync_check_ints, Qnil, &sync->raised);
+          if (sync->raised)
+            ii_sync_cancel (sync);
+        }
+      }
+      *sync->busy = FALSE;
+    }
+#endif
+    /* finish off the wait, or the cancel, with the GVL held */
+    if (sync->waitParm.wt_status == IIAPI_ST_SUCCESS)
+      ii_sync_wait (sync);
+  }
+
+  if (sync->waitParm.wt_status != IIAPI_ST_SUCCESS)
+    rb_raise (rb_eRuntimeError, "IIapi_wait() failed.");
+
+  /* nothing was cancelled, raise now that the call has completed */
+  if (sync->raised && !sync->cancelling)
+    rb_jump_tag (sync->raised);
+}
+
+/* static int ii_sync(II_CONN *ii_conn, IIAPI_GENPARM *genParm)
  * Waits for completion of the last Ingres api call used because of the asynchronous design of this api
+ * Other Ruby threads carry on running while the wait is in progress.
 */
 static int
-ii_sync (IIAPI_GENPARM * genParm)
+ii_sync (II_CONN *ii_conn, IIAPI_GENPARM * genParm)
 {
-  static IIAPI_WAITPARM waitParm =
-  {
-    -1,				/* no timeout, we don't want asynchronous queries */
-    0				/* wt_status (output) */
-  };
+  II_SYNC sync;
   static char function_name[] = "ii_sync";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  while (genParm->gp_completed == FALSE)
+  sync.genParm = genParm;
+  sync.stmtHandle = NULL;
+  sync.deadline = 0;
+  sync.busy = ii_conn->busy;
+  ii_sync_run (&sync);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return 0;
+}
+
+/*
+**      ii_sync_query() - Wait for a call on a statement that can be cancelled
+**
+**      Description -
+**              Used while the server is running or returning the results
+**              of a statement, which may take an unbounded time.  When an
+**              interrupt raises in the waiting thread, or the statement's
+**              deadline passes, the statement is cancelled on the server
+**              and closed.  In auto-commit mode the transaction is rolled
+**              back, otherwise it is left open for the application to end.
+**              The interrupt's exception is then raised again, or
+**              Ingres::TimeoutError for a timeout.
+*/
+static int
+ii_sync_query (II_CONN *ii_conn, IIAPI_GENPARM * genParm)
+{
+  II_SYNC sync;
+  static char function_name[] = "ii_sync_query";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  sync.genParm = genParm;
+  sync.stmtHandle = ii_conn->stmtHandle;
+  sync.deadline = ii_conn->deadline;
+  sync.busy = ii_conn->busy;
+  ii_sync_run (&sync);
+
+  if (sync.cancelling)
   {
-    IIapi_wait (&waitParm);
-  }
+    if (ii_globals.debug)
+      printf ("%s: statement cancelled, status %d\n", function_name, genParm->gp_status);
 
-  if (waitParm.wt_status != IIAPI_ST_SUCCESS)
-    rb_raise (rb_eRuntimeError, "IIapi_wait() failed.");
+    ii_api_query_close (ii_conn);
+    if (ii_conn->autocommit && ii_conn->cursorCount == 0 && ii_conn->tranHandle)
+      ii_api_rollback (ii_conn, NULL);
+    if (sync.raised)
+      rb_jump_tag (sync.raised);
+    rb_raise (cIngresTimeoutError, "The statement was cancelled as it ran for longer than its timeout");
+  }
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
   return 0;
 }
 
+/* OpenAPI calls on a connection cannot overlap.  While one thread waits on
+ * the connection without the GVL, others must not start anything on it */
+static void
+ii_check_busy (II_CONN *ii_conn)
+{
+  if (*ii_conn->busy)
+    rb_raise (rb_eRuntimeError, "The connection is in use by another thread");
+}
+
+/* Statements cannot be run while one started by execute_async() is running */
+static void
+ii_async_check_idle (II_CONN *ii_conn)
+{
+  ii_check_busy (ii_conn);
+  if (ii_conn->async != NULL)
+    rb_raise (rb_eRuntimeError, "A statement started by execute_async is still running, call value on its result first");
+}
+
+/*
+**      ii_async_abandon() - End a statement started by execute_async()
+**
+**      Description -
+**              Used when the result will never be asked for, because it
+**              was cancelled, the connection is being closed, or a wait
+**              for it was interrupted.  The statement is cancelled and
+**              closed in the same way as by ii_sync_query().  Called from
+**              the connection's finalizer so no Ruby objects may be created.
+*/
+static void
+ii_async_abandon (II_ASYNC *async)
+{
+  II_CONN *ii_conn = async->ii_conn;
+  II_SYNC sync;
+  char function_name[] = "ii_async_abandon";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  sync.genParm = &async->descrParm.gd_genParm;
+  sync.stmtHandle = ii_conn->stmtHandle;
+  sync.deadline = 0;
+  sync.waitParm.wt_status = IIAPI_ST_SUCCESS;
+  sync.interrupted = FALSE;
+  sync.timedOut = FALSE;
+  sync.cancelling = FALSE;
+  sync.raised = 0;
+  sync.cancelParm.cn_genParm.gp_completed = FALSE;
+
+  if (sync.genParm->gp_completed == FALSE)
+    ii_sync_cancel (&sync);
+  ii_sync_wait (&sync);
+
+  ii_api_query_close (ii_conn);
+  if (ii_conn->autocommit && ii_conn->cursorCount == 0 && ii_conn->tranHandle)
+    ii_api_rollback (ii_conn, NULL);
+
+  ii_conn->async = NULL;
+  ii_conn->keep_me = Qfalse;
+  async->ii_conn = NULL;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
 
 void *
 ii_allocate (size_t nitems, size_t size)
@@ -178,8 +458,102 @@ ii_free (void **ptr)
   return;
 }
 
+/*
+**      ii_arena_init() - Allocate the fetch buffers for a statement
+**
+**      Description -
+**              Lays out one IIAPI_DATAVALUE and a buffer of ds_length + 1
+**              bytes for every cell of a block of param_rowCount rows.
+**              The arena is reused for every row fetched and released by
+**              ii_arena_free() when the statement is closed.
+*/
+void
+ii_arena_init (II_CONN *ii_conn, IIAPI_GETDESCRPARM * param_descrParm, II_INT2 param_rowCount)
+{
+  II_ROW_ARENA *arena = &ii_conn->arena;
+  long rowLength = 0;
+  long offset = 0;
+  int row, column;
+  char function_name[] = "ii_arena_init";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  /* a previous statement may have been abandoned by an exception */
+  ii_arena_free (ii_conn);
+
+  for (column = 0; column < param_descrParm->gd_descriptorCount; column++)
+    rowLength += param_descrParm->gd_descriptor[column].ds_length + 1;
+
+  arena->rowCount = param_rowCount;
+  arena->columnCount = param_descrParm->gd_descriptorCount;
+  arena->columnData = (IIAPI_DATAVALUE *) ii_allocate (arena->rowCount * arena->columnCount, sizeof (IIAPI_DATAVALUE));
+  arena->buffer = (char *) ii_allocate (arena->rowCount * rowLength + 1, sizeof (char));
+
+  for (row = 0; row < arena->rowCount; row++)
+  {
+    for (column = 0; column < arena->columnCount; column++)
+    {
+      arena->columnData[row * arena->columnCount + column].dv_value = arena->buffer + offset;
+      offset += param_descrParm->gd_descriptor[column].ds_length + 1;
+    }
+  }
+
+  if (ii_globals.debug)
+    printf ("Exiting %s, %d row(s) of %li bytes.\n", function_name, arena->rowCount, rowLength);
+}
+
+/* Return a work area of at least param_size bytes, valid until the next call */
+char *
+ii_arena_scratch (II_CONN *ii_conn, long param_size)
+{
+  II_ROW_ARENA *arena = &ii_conn->arena;
+
+  if (param_size > arena->scratchLen)
+  {
+    arena->scratch = (char *) ii_reallocate (arena->scratch, param_size, sizeof (char));
+    arena->scratchLen = param_size;
+  }
+  return arena->scratch;
+}
+
+void
+ii_arena_free (II_CONN *ii_conn)
+{
+  II_ROW_ARENA *arena = &ii_conn->arena;
+  char function_name[] = "ii_arena_free";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  ii_free ((void **) &arena->columnData);
+  ii_free ((void **) &arena->buffer);
+  ii_free ((void **) &arena->scratch);
+  ii_free ((void **) &arena->parmData);
+  ii_free ((void **) &arena->parmOffset);
+  ii_free ((void **) &arena->parmBuffer);
+  arena->rowCount = 0;
+  arena->columnCount = 0;
+  arena->scratchLen = 0;
+  arena->parmCount = 0;
+  arena->parmMax = 0;
+  arena->parmUsed = 0;
+  arena->parmLen = 0;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+/*
+**      ii_api_init() - Initialise OpenAPI for a connection
+**
+**      Description -
+**              Every Ingres object gets its own environment handle, so
+**              set_environment and the connection parameters of one
+**              connection do not change those of another, and one being
+**              disconnected leaves the others running.  Released again by
+**              ii_api_term() when the object is freed.
+*/
 void
-ii_api_init ()
+ii_api_init (II_CONN *ii_conn)
 {
   IIAPI_INITPARM initParm;
   char function_name[] = "ii_api_init";
@@ -189,7 +563,46 @@ ii_api_init ()
   initParm.in_version = IIAPI_VERSION;
   initParm.in_timeout = -1;
   IIapi_initialize (&initParm);
-  ii_globals.envHandle = initParm.in_envHandle;
+  if (initParm.in_status != IIAPI_ST_SUCCESS)
+    rb_raise (rb_eRuntimeError, "An error occurred when calling IIapi_initialize, status returned was %d", initParm.in_status);
+  ii_conn->initialized = TRUE;
+  ii_conn->envHandle = initParm.in_envHandle;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+/* Release what ii_api_init() set up, the connection must already be closed */
+void
+ii_api_term (II_CONN *ii_conn)
+{
+  IIAPI_TERMPARM termParm;
+#if defined(IIAPI_VERSION_2)
+  IIAPI_RELENVPARM relEnvParm;
+#endif
+  char function_name[] = "ii_api_term";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  /* initialize was never run on the object, or did not succeed */
+  if (!ii_conn->initialized)
+    return;
+
+#if defined(IIAPI_VERSION_2)
+  if (ii_conn->envHandle != NULL)
+  {
+    relEnvParm.re_envHandle = ii_conn->envHandle;
+    IIapi_releaseEnv (&relEnvParm);
+    if (ii_globals.debug || ii_globals.debug_termination)
+      printf ("%s: IIapi_releaseEnv status is >>%d<<\n", function_name, relEnvParm.re_status);
+  }
+#endif
+  ii_conn->envHandle = NULL;
+  ii_conn->initialized = FALSE;
+
+  IIapi_terminate (&termParm);
+  if (ii_globals.debug || ii_globals.debug_termination)
+    printf ("%s: IIapi_terminate status is >>%d<<\n", function_name, termParm.tm_status);
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -211,19 +624,17 @@ ii_api_init ()
 VALUE
 ii_init (VALUE param_self) 
 {
+  II_CONN *ii_conn = NULL;
   char function_name[] = "ii_init";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  ii_globals.debug = FALSE;
-  ii_globals.debug_connection = FALSE;
-  ii_globals.debug_sql = FALSE;
-  ii_globals.debug_termination = FALSE;
-  ii_globals.debug_transactions = FALSE;
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
 
   if (ii_globals.debug)
     printf ("%s: About to execute ii_api_init ()\n", function_name);
-  ii_api_init ();
+  if (!ii_conn->initialized)
+    ii_api_init (ii_conn);
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -249,8 +660,9 @@ init_rb_array (VALUE * param_rb_array)
     printf ("Exiting %s.\n", function_name);
 }
 
+/* MONEY is reported as the type the connection's :money option returns */
 char *
-getIngresDataTypeAsString (IIAPI_DT_ID param_dt_id)
+getIngresDataTypeAsString (II_CONN * ii_conn, IIAPI_DT_ID param_dt_id)
 {
   char *dataType = NULL;
   char function_name[] = "getIngresDataTypeAsString";
@@ -262,6 +674,11 @@ getIngresDataTypeAsString (IIAPI_DT_ID param_dt_id)
     case IIAPI_LNVCH_TYPE:
     case IIAPI_LBYTE_TYPE:
     case IIAPI_LVCH_TYPE:
+#if defined(IIAPI_QF_LOCATORS)
+    case IIAPI_LNLOC_TYPE:
+    case IIAPI_LBLOC_TYPE:
+    case IIAPI_LCLOC_TYPE:
+#endif
       dataType = RUBY_LOB;
       break;
 
@@ -277,10 +694,18 @@ getIngresDataTypeAsString (IIAPI_DT_ID param_dt_id)
       break;
 
     case IIAPI_FLT_TYPE:
-    case IIAPI_MNY_TYPE:
       dataType = RUBY_DOUBLE;
       break;
 
+    case IIAPI_MNY_TYPE:
+      if (ii_conn->moneyMode == INGRES_MONEY_DECIMAL)
+        dataType = RUBY_DECIMAL;
+      else if (ii_conn->moneyMode == INGRES_MONEY_CENTS)
+        dataType = RUBY_INTEGER;
+      else
+        dataType = RUBY_DOUBLE;
+      break;
+
     case IIAPI_BYTE_TYPE:
       dataType = RUBY_BYTE;
       break;
@@ -450,7 +875,7 @@ ii_api_set_connect_param (II_CONN *ii_conn, II_LONG paramID, VALUE paramValue)
 
   setConPrmParm.sc_genParm.gp_callback = NULL;
 #if defined(IIAPI_VERSION_2)
-  setConPrmParm.sc_connHandle = ii_globals.envHandle;
+  setConPrmParm.sc_connHandle = (ii_conn->connHandle != NULL) ? ii_conn->connHandle : ii_conn->envHandle;
 #else
   setConPrmParm.sc_connHandle = NULL;
 #endif
@@ -470,7 +895,7 @@ ii_api_set_connect_param (II_CONN *ii_conn, II_LONG paramID, VALUE paramValue)
   }
 
   IIapi_setConnectParam(&setConPrmParm);
-  ii_sync (&(setConPrmParm.sc_genParm));
+  ii_sync (ii_conn, &(setConPrmParm.sc_genParm));
   ii_checkError (&setConPrmParm.sc_genParm);
 
   ii_conn->connHandle = setConPrmParm.sc_connHandle;
@@ -482,7 +907,7 @@ ii_api_set_connect_param (II_CONN *ii_conn, II_LONG paramID, VALUE paramValue)
 
   
 void
-ii_api_set_env_param (II_LONG paramID, VALUE paramValue)
+ii_api_set_env_param (II_CONN *ii_conn, II_LONG paramID, VALUE paramValue)
 {
   IIAPI_SETENVPRMPARM    setEnvPrmParm;
   II_LONG tmp_long = 0;
@@ -491,7 +916,7 @@ ii_api_set_env_param (II_LONG paramID, VALUE paramValue)
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  setEnvPrmParm.se_envHandle = ii_globals.envHandle;
+  setEnvPrmParm.se_envHandle = ii_conn->envHandle;
   setEnvPrmParm.se_paramID = paramID;
 
   switch (TYPE(paramValue))
@@ -534,7 +959,7 @@ ii_api_connect (II_CONN *ii_conn, char *param_targetDB, char *param_username, ch
   connParm.co_genParm.gp_callback = NULL;
   connParm.co_genParm.gp_closure = NULL;
   connParm.co_target = param_targetDB;
-  connParm.co_connHandle = (ii_conn->connHandle != NULL) ? ii_conn->connHandle : ii_globals.envHandle;
+  connParm.co_connHandle = (ii_conn->connHandle != NULL) ? ii_conn->connHandle : ii_conn->envHandle;
   connParm.co_tranHandle = NULL;
   connParm.co_type = IIAPI_CT_SQL;
   connParm.co_username = param_username;
@@ -545,7 +970,7 @@ ii_api_connect (II_CONN *ii_conn, char *param_targetDB, char *param_username, ch
     printf ("%s: About to execute IIapi_connect (&connParm)\n", function_name);
 
   IIapi_connect (&connParm);
-  ii_sync (&(connParm.co_genParm));
+  ii_sync (ii_conn, &(connParm.co_genParm));
 
   if (ii_globals.debug || ii_globals.debug_connection)
     printf ("%s: Executed IIapi_connect, status is %i\n", function_name, connParm.co_genParm.gp_status);
@@ -566,13 +991,63 @@ ii_api_connect (II_CONN *ii_conn, char *param_targetDB, char *param_username, ch
     printf ("Exiting %s.\n", function_name);
 }
 
+/* Map a Ruby :money option value to one of the INGRES_MONEY_* modes */
+int
+ii_money_mode_value (VALUE param_value)
+{
+  if (param_value == ID2SYM (rb_intern ("float")))
+    return INGRES_MONEY_FLOAT;
+  if (param_value == ID2SYM (rb_intern ("decimal")))
+    return INGRES_MONEY_DECIMAL;
+  if (param_value == ID2SYM (rb_intern ("cents")))
+    return INGRES_MONEY_CENTS;
+  rb_raise (rb_eArgError, "money must be one of :float, :decimal or :cents");
+  return INGRES_MONEY_FLOAT;
+}
+
+/* Validate a Ruby fetch_rows value, 0 means size the fetch from the descriptors */
+II_INT2
+ii_fetch_rows_value (VALUE param_value)
+{
+  long fetchRows = 0;
+
+  fetchRows = NUM2LONG (param_value);
+  if (fetchRows < 0 || fetchRows > MAX_FETCH_ROWS)
+  {
+    rb_raise (rb_eArgError, "fetch_rows must be between 0 and %d", MAX_FETCH_ROWS);
+  }
+  return (II_INT2) fetchRows;
+}
+
+/* Validate a Ruby timeout in seconds, returning it in milliseconds.  nil or
+ * 0 means no timeout, one too large for a long is cut down to LONG_MAX */
+long
+ii_timeout_value (VALUE param_value)
+{
+  double timeout = 0;
+
+  if (NIL_P(param_value))
+    return 0;
+  timeout = NUM2DBL (param_value);
+  if (!isfinite (timeout))
+    rb_raise (rb_eArgError, "timeout must be a finite number of seconds");
+  if (timeout < 0)
+    rb_raise (rb_eArgError, "timeout must not be negative");
+  /* round up so that a small timeout is not taken as no timeout */
+  timeout = timeout * 1000 + 0.999;
+  if (timeout >= (double) LONG_MAX)
+    return LONG_MAX;
+  return (long) timeout;
+}
+
 /* 
  * Document-method: set_environment
  *
  * call-seq:
  *    Ingres.set_environment(environment_hash) -> nil
  *
- * Configures the environment settings for a Ruby application.
+ * Configures the environment settings for the connection. Each Ingres
+ * object has its own environment, so other connections are not affected.
  *
  * Valid hash keys are:
  *
@@ -591,11 +1066,14 @@ ii_set_environment (int param_argc, VALUE *param_argv, VALUE param_self)
   char function_name[] = "ii_set_environment";
   VALUE param_value = Qnil;
   VALUE args,arg;
+  II_CONN *ii_conn = NULL;
   int param_no = 0;
 
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+
   rb_scan_args (param_argc, param_argv, "0*", &args);
 
   if (RARRAY_LEN(args) == 1)
@@ -608,7 +1086,7 @@ ii_set_environment (int param_argc, VALUE *param_argv, VALUE param_self)
         param_value = rb_hash_aref(arg, ID2SYM(rb_intern(ENV_PARAMS[param_no].paramName)));
         if (TYPE(param_value) != T_NIL)
         {
-          ii_api_set_env_param (ENV_PARAMS[param_no].paramID, param_value);
+          ii_api_set_env_param (ii_conn, ENV_PARAMS[param_no].paramID, param_value);
         }
       }
     }
@@ -642,6 +1120,19 @@ ii_set_environment (int param_argc, VALUE *param_argv, VALUE param_self)
  * * +password+ - password for the supplied username
  * * +date_format+ - the string format to be used for Ingres date values. See the
  *   DATE_FORMAT_* constants for valid values.
+ * * +fetch_rows+ - number of rows fetched from the server per call, see fetch_rows=
+ * * +null_as_nil+ - return nil for NULL values rather than the string
+ *   "NULL", which is returned by default for compatibility
+ * * +native_dates+ - return date and time values as Time and Date objects,
+ *   decoded without a round trip through a formatted string. ANSI
+ *   intervals are returned as a number of months (year to month) or
+ *   seconds (day to second)
+ * * +native_decimals+ - return DECIMAL values as Integer (scale 0) or
+ *   BigDecimal objects, decoded directly rather than as a String
+ * * +money+ - how MONEY values are returned: <tt>:float</tt> (the default),
+ *   <tt>:decimal</tt> for an exact BigDecimal or <tt>:cents</tt> for an
+ *   Integer number of cents
+ * * +timeout+ - default statement timeout in seconds, see timeout=
  *
  * Usage examples:
  * * Setting the date format to "YYYY-MM-DD HH:MM:SS"
@@ -707,6 +1198,30 @@ ii_connect (int param_argc, VALUE *param_argv, VALUE param_self)
           ii_api_set_connect_param (ii_conn, CONN_PARAMS[param_no].paramID, param_value);
         }
       }
+      param_value = rb_hash_aref(arg, ID2SYM(rb_intern("fetch_rows")));
+      if (TYPE(param_value) != T_NIL)
+      {
+        ii_conn->fetchRows = ii_fetch_rows_value (param_value);
+      }
+      param_value = rb_hash_aref(arg, ID2SYM(rb_intern("timeout")));
+      if (TYPE(param_value) != T_NIL)
+      {
+        ii_conn->timeout = ii_timeout_value (param_value);
+      }
+      param_value = rb_hash_aref(arg, ID2SYM(rb_intern("null_as_nil")));
+      if (TYPE(param_value) != T_NIL)
+      {
+        ii_conn->nullAsNil = RTEST (param_value);
+      }
+      param_value = rb_hash_aref(arg, ID2SYM(rb_intern("native_dates")));
+      ii_conn->nativeDates = RTEST (param_value);
+      param_value = rb_hash_aref(arg, ID2SYM(rb_intern("native_decimals")));
+      ii_conn->nativeDecimals = RTEST (param_value);
+      param_value = rb_hash_aref(arg, ID2SYM(rb_intern("money")));
+      if (TYPE(param_value) != T_NIL)
+      {
+        ii_conn->moneyMode = ii_money_mode_value (param_value);
+      }
     }
   }
   else if (RARRAY_LEN(args) == 3)
@@ -745,7 +1260,7 @@ ii_connect (int param_argc, VALUE *param_argv, VALUE param_self)
         param_value = rb_hash_aref(arg, ID2SYM(rb_intern(ENV_PARAMS[param_no].paramName)));
         if (TYPE(param_value) != T_NIL)
         {
-          ii_api_set_env_param (ENV_PARAMS[param_no].paramID, param_value);
+          ii_api_set_env_param (ii_conn, ENV_PARAMS[param_no].paramID, param_value);
         }
       }
     }
@@ -756,7 +1271,7 @@ ii_connect (int param_argc, VALUE *param_argv, VALUE param_self)
   memcpy (ii_conn->currentDatabase, StringValuePtr(param_targetDB), db_length);
   ii_conn->currentDatabase[db_length] = '\0';
 
-  ii_api_set_env_param (IIAPI_EP_MAX_SEGMENT_LEN, maxSegmentSize);
+  ii_api_set_env_param (ii_conn, IIAPI_EP_MAX_SEGMENT_LEN, maxSegmentSize);
 
   if (ii_globals.debug || ii_globals.debug_connection)
     printf ("%s: Set ii_conn->currentDatabase to %s\n", function_name, ii_conn->currentDatabase);
@@ -789,8 +1304,10 @@ ii_disconnect (VALUE param_self)
   if (ii_globals.debug || ii_globals.debug_termination)
     printf ("%s: Preparing to disconnect\n", function_name);
 
-  if (ii_conn->keep_me)
-    rb_ary_clear (ii_conn->keep_me);
+  ii_check_busy (ii_conn);
+
+  if (ii_conn->async)
+    ii_async_abandon (ii_conn->async);
 
   /* If there is an active transaction it must be closed before disconnection */
   if (ii_conn->tranHandle)
@@ -815,7 +1332,6 @@ ii_disconnect (VALUE param_self)
 void ii_api_disconnect( II_CONN *ii_conn)
 {
   IIAPI_DISCONNPARM disconnParm;
-  IIAPI_TERMPARM termParm;
 
   char function_name[] = "ii_disconnect";
 
@@ -832,7 +1348,7 @@ void ii_api_disconnect( II_CONN *ii_conn)
       printf ("%s: Next, IIapi_disconnect\n", function_name);
 
     IIapi_disconnect (&disconnParm);
-    ii_sync (&(disconnParm.dc_genParm));
+    ii_sync (ii_conn, &(disconnParm.dc_genParm));
 
     if (ii_globals.debug || ii_globals.debug_termination)
       printf ("%s: Disconnect status is >>%d<<\n", function_name, disconnParm.dc_genParm.gp_status);
@@ -842,14 +1358,13 @@ void ii_api_disconnect( II_CONN *ii_conn)
     if (ii_globals.debug || ii_globals.debug_termination)
       printf ("%s: Completed IIapi_disconnect and related error checks\n", function_name);
 
-    if (ii_globals.debug || ii_globals.debug_termination)
-      printf ("ii_disconnect: Next, IIapi_terminate( &termParm )\n");
-
-    IIapi_terminate (&termParm);
     ii_conn->connHandle = NULL;
-
-    if (ii_globals.debug || ii_globals.debug_termination)
-      printf ("%s: Completed IIapi_terminate( &termParm )\n", function_name);
+    ii_conn->tranCount++;
+    ii_conn->sessionCount++;
+    ii_conn->cursorCount = 0;
+    ii_conn->cursorGeneration++;
+    /* the statement handles went with the connection */
+    ii_conn->orphanCount = 0;
   }
 
   if (ii_globals.debug)
@@ -877,6 +1392,7 @@ ii_commit (VALUE param_self)
     printf ("Entering %s.\n", function_name);
 
   Data_Get_Struct(param_self, II_CONN, ii_conn);
+  ii_async_check_idle (ii_conn);
 
   /* We cannot commit a transaction if there is not one is already in place */
   if (ii_conn->tranHandle == NULL)
@@ -937,6 +1453,7 @@ ii_rollback (int param_argc, VALUE * param_argv, VALUE param_self)
   }
 
   Data_Get_Struct(param_self, II_CONN, ii_conn);
+  ii_async_check_idle (ii_conn);
 
   /* We cannot rollback a transaction if there is not one is already in place */
   if (ii_conn->tranHandle == NULL)
@@ -1055,6 +1572,7 @@ ii_savepoint (VALUE param_self, VALUE param_savepointName)
 
   Check_Type (param_savepointName, T_STRING);
   Data_Get_Struct(param_self, II_CONN, ii_conn);
+  ii_check_busy (ii_conn);
 
   /* We cannot generate a save point if there is no transaction or if auto commit is in effect */
   if (ii_conn->tranHandle == NULL)
@@ -1105,6 +1623,42 @@ startTransaction (VALUE param_self)
     printf ("Exiting %s.\n", function_name);
 }
 
+/*
+**      ii_close_orphans() - Close the statements of freed cursors
+**
+**      Description -
+**              A cursor garbage collected while still open cannot make
+**              OpenAPI calls from its finalizer, its statement handle is
+**              left on the connection by ii_cursor_free() instead.  They are
+**              closed here before the transaction they belong to is ended.
+*/
+static void
+ii_close_orphans (II_CONN *ii_conn)
+{
+  IIAPI_CLOSEPARM closeParm;
+  char function_name[] = "ii_close_orphans";
+
+  if (ii_conn->orphanCount == 0)
+    return;
+
+  if (ii_globals.debug)
+    printf ("Entering %s, %ld statement(s) to close.\n", function_name, ii_conn->orphanCount);
+
+  while (ii_conn->orphanCount > 0)
+  {
+    closeParm.cl_genParm.gp_callback = NULL;
+    closeParm.cl_genParm.gp_closure = NULL;
+    closeParm.cl_stmtHandle = ii_conn->orphanHandles[--ii_conn->orphanCount];
+
+    IIapi_close (&closeParm);
+    ii_sync (ii_conn, &(closeParm.cl_genParm));
+    ii_checkError (&closeParm.cl_genParm);
+  }
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
 
 void
 ii_api_commit (II_CONN *ii_conn)
@@ -1121,9 +1675,10 @@ ii_api_commit (II_CONN *ii_conn)
   commitParm.cm_genParm.gp_closure = NULL;
   commitParm.cm_tranHandle = ii_conn->tranHandle;
 
+  ii_close_orphans (ii_conn);
   IIapi_commit (&commitParm);
 
-  ii_sync (&(commitParm.cm_genParm));
+  ii_sync (ii_conn, &(commitParm.cm_genParm));
 
   if (ii_globals.debug)
     printf ("\nTransaction ii_api_commit status is ++%d++\n",
@@ -1140,6 +1695,9 @@ ii_api_commit (II_CONN *ii_conn)
   /* now turn automatic transaction handling back on */
   ii_conn->tranHandle = NULL;
   ii_conn->autocommit = TRUE;
+  ii_conn->cursorCount = 0;
+  ii_conn->cursorGeneration++;
+  ii_conn->tranCount++;
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -1163,11 +1721,16 @@ ii_api_rollback (II_CONN *ii_conn, II_SAVEPOINT_ENTRY *savePtEntry)
     rollbackParm.rb_genParm.gp_closure = NULL;
     rollbackParm.rb_savePointHandle = savePtEntry ? savePtEntry->savePtHandle : NULL;
 
+    if (savePtEntry == NULL)
+      ii_close_orphans (ii_conn);
     IIapi_rollback (&rollbackParm);
 
-    ii_sync (&(rollbackParm.rb_genParm));
+    ii_sync (ii_conn, &(rollbackParm.rb_genParm));
     ii_checkError (&rollbackParm.rb_genParm);
 
+    /* statements PREPAREd since a savepoint may be gone as well */
+    ii_conn->tranCount++;
+
     /*
      * Remove successive savePtEntry records as they are no longer valid 
      * If savePtEntry is NULL then we need to remove all savepoint entries
@@ -1201,6 +1764,8 @@ ii_api_rollback (II_CONN *ii_conn, II_SAVEPOINT_ENTRY *savePtEntry)
       /* now turn automatic transaction handling back on */
       ii_conn->tranHandle = NULL;
       ii_conn->autocommit = TRUE;
+      ii_conn->cursorCount = 0;
+      ii_conn->cursorGeneration++;
     }
   }
 
@@ -1225,7 +1790,7 @@ ii_api_savepoint (II_CONN *ii_conn, VALUE savePtName)
   if (ii_globals.debug || ii_globals.debug_transactions)
     printf ("Creating savepoint %s\n", RSTRING_PTR(savePtName));
   IIapi_savePoint( &savePtParm );
-  ii_sync (&(savePtParm.sp_genParm));
+  ii_sync (ii_conn, &(savePtParm.sp_genParm));
 
   if (ii_globals.debug)
     printf ("\nTransaction ii_api_savepoint status is ++%d++\n", savePtParm.sp_genParm.gp_status);
@@ -1280,7 +1845,7 @@ executeQuery (II_CONN *ii_conn, char *param_sqlText)
 
 
   IIapi_query (&queryParm);
-  ii_sync (&(queryParm.qy_genParm));
+  ii_sync (ii_conn, &(queryParm.qy_genParm));
 
   ii_conn->stmtHandle = queryParm.qy_stmtHandle;
 
@@ -1503,6 +2068,15 @@ setDescriptor (IIAPI_DESCRIPTOR * sd_descriptor, RUBY_PARAMETER * parameter,
 }
 
 
+/* LOB parameters can be given as a String or as an IO to read them from */
+void
+checkLOBParameterValue (RUBY_PARAMETER * parameter)
+{
+  if (TYPE (parameter->vvalue) != T_STRING && !rb_respond_to (parameter->vvalue, rb_intern ("read")))
+    rb_raise (rb_eTypeError, "Expected a String or an IO for a %c parameter", (char) *(RSTRING_PTR (parameter->vtype)));
+}
+
+
 int
 setLongByteDescriptor (IIAPI_DESCRIPTOR * sd_descriptor, RUBY_PARAMETER * parameter, int isProcedureCall, II_LONG lobSegmentSize)
 {
@@ -1511,7 +2085,7 @@ setLongByteDescriptor (IIAPI_DESCRIPTOR * sd_descriptor, RUBY_PARAMETER * parame
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  Check_Type (parameter->vvalue, T_STRING);
+  checkLOBParameterValue (parameter);
   setDescriptor (sd_descriptor, parameter, isProcedureCall, IIAPI_LBYTE_TYPE, (II_UINT2) lobSegmentSize, 0, 0);
 
   if (ii_globals.debug)
@@ -1604,8 +2178,8 @@ setLongVarcharDescriptor (IIAPI_DESCRIPTOR * sd_descriptor, RUBY_PARAMETER * par
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  Check_Type (parameter->vvalue, T_STRING);
-  setDescriptor (sd_descriptor, parameter, isProcedureCall, IIAPI_VCH_TYPE, (II_UINT2) lobSegmentSize, 0, 0);
+  checkLOBParameterValue (parameter);
+  setDescriptor (sd_descriptor, parameter, isProcedureCall, IIAPI_LVCH_TYPE, (II_UINT2) lobSegmentSize, 0, 0);
 
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
@@ -1637,21 +2211,17 @@ setNCharDescriptor (IIAPI_DESCRIPTOR * sd_descriptor,
                     RUBY_PARAMETER * parameter, int isProcedureCall)
 {
   int returnValue = 0;
-  long valueLen = RSTRING_LEN (parameter->vvalue);
-  char *valuePtr = RSTRING_PTR (parameter->vvalue);
-  long ncharLen = valueLen * sizeof (UCS2);
-  char *nchar = ALLOC_N (char, ncharLen + sizeof (UCS2));
+  long ncharLen = 0;
   char function_name[] = "setNCharDescriptor";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
   Check_Type (parameter->vvalue, T_STRING);
 
-  if (utf8_to_utf16
-      (valuePtr, valuePtr + valueLen, (UCS2 *) nchar,
-       (UCS2 *) (nchar + ncharLen), &ncharLen))
+  /* only the length is needed here, putNCharParameter() transcodes it */
+  if (utf8_utf16_length (RSTRING_PTR (parameter->vvalue), RSTRING_END (parameter->vvalue), &ncharLen))
     rb_raise (rb_eRuntimeError,
-              "Error! Failed to transcode %s (n) to utf16.\n", valuePtr);
+              "Error! Failed to transcode %s (n) to utf16.\n", RSTRING_PTR (parameter->vvalue));
 
   /* Allow a null at the end */
   setDescriptor (sd_descriptor, parameter, isProcedureCall, IIAPI_NCHA_TYPE,
@@ -1668,22 +2238,17 @@ setNVarcharDescriptor (IIAPI_DESCRIPTOR * sd_descriptor,
                        RUBY_PARAMETER * parameter, int isProcedureCall)
 {
   int returnValue = 0;
-  long valueLen = RSTRING_LEN (parameter->vvalue);
-  char *valuePtr = RSTRING_PTR (parameter->vvalue);
-  long nvarcharlen = valueLen * sizeof (UCS2);
-  char *nvarchar =
-    ALLOC_N (char, 2 + nvarcharlen + sizeof (UCS2));
+  long nvarcharlen = 0;
   char function_name[] = "setNVarcharDescriptor";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
   Check_Type (parameter->vvalue, T_STRING);
-  nvarcharlen = valueLen * sizeof (UCS2);
-  nvarchar = ALLOC_N (char, 2 + nvarcharlen + sizeof (UCS2));
-  if (utf8_to_utf16 (valuePtr, valuePtr + valueLen, (UCS2 *) nvarchar,
-                     (UCS2 *) (nvarchar + nvarcharlen), &nvarcharlen))
+
+  /* only the length is needed here, putNVarcharParameter() transcodes it */
+  if (utf8_utf16_length (RSTRING_PTR (parameter->vvalue), RSTRING_END (parameter->vvalue), &nvarcharlen))
     rb_raise (rb_eRuntimeError,
-              "Error! Failed to transcode %s (N) to utf16.\n", valuePtr);
+              "Error! Failed to transcode %s (N) to utf16.\n", RSTRING_PTR (parameter->vvalue));
 
   /* The first two bytes will contain the length */
   setDescriptor (sd_descriptor, parameter, isProcedureCall, IIAPI_NVCH_TYPE,
@@ -1769,26 +2334,68 @@ setParameterDescriptor (IIAPI_DESCRIPTOR * sd_descriptor, RUBY_PARAMETER * param
 }
 
 
+/*
+**      updateParameterDescriptor() - Reuse a descriptor for a new value
+**
+**      Description -
+**              The descriptor was filled in by setParameterDescriptor()
+**              for an earlier value of the same parameter.  Only the
+**              CHAR, VARCHAR, NCHAR and NVARCHAR lengths follow the value
+**              and are set again, the other types just have the value
+**              checked.
+*/
 int
-setProcedureNameDescriptor (IIAPI_DESCRIPTOR * sd_descriptor,
-                            char *procedureName)
+updateParameterDescriptor (IIAPI_DESCRIPTOR * sd_descriptor, RUBY_PARAMETER * parameter, int isProcedureCall, II_LONG lobSegmentSize)
 {
   int returnValue = 0;
-  char function_name[] = "setProcedureNameDescriptor";
-  if (ii_globals.debug)
-    printf ("Entering %s.\n", function_name);
 
-  /* setup the first parameter as the procedure name */
-  sd_descriptor->ds_dataType = IIAPI_CHA_TYPE;
-  sd_descriptor->ds_length = strlen (procedureName);
-  sd_descriptor->ds_nullable = FALSE;
-  sd_descriptor->ds_precision = 0;
-  sd_descriptor->ds_scale = 0;
-  sd_descriptor->ds_columnType = IIAPI_COL_SVCPARM;
-  sd_descriptor->ds_columnName = NULL;
+  switch (sd_descriptor->ds_dataType)
+  {
+    case IIAPI_INT_TYPE:
+      Check_Type (parameter->vvalue, T_FIXNUM);
+      break;
 
-  if (ii_globals.debug)
-    printf ("Exiting %s, returning %i.\n", function_name, returnValue);
+    case IIAPI_FLT_TYPE:
+      Check_Type (parameter->vvalue, T_FLOAT);
+      break;
+
+    case IIAPI_DEC_TYPE:
+      Check_Type (parameter->vvalue, T_STRING);
+      break;
+
+    case IIAPI_LBYTE_TYPE:
+    case IIAPI_LVCH_TYPE:
+      checkLOBParameterValue (parameter);
+      break;
+
+    default:
+      returnValue = setParameterDescriptor (sd_descriptor, parameter, isProcedureCall, lobSegmentSize);
+      break;
+  }
+  return (returnValue);
+}
+
+
+int
+setProcedureNameDescriptor (IIAPI_DESCRIPTOR * sd_descriptor,
+                            char *procedureName)
+{
+  int returnValue = 0;
+  char function_name[] = "setProcedureNameDescriptor";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  /* setup the first parameter as the procedure name */
+  sd_descriptor->ds_dataType = IIAPI_CHA_TYPE;
+  sd_descriptor->ds_length = strlen (procedureName);
+  sd_descriptor->ds_nullable = FALSE;
+  sd_descriptor->ds_precision = 0;
+  sd_descriptor->ds_scale = 0;
+  sd_descriptor->ds_columnType = IIAPI_COL_SVCPARM;
+  sd_descriptor->ds_columnName = NULL;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s, returning %i.\n", function_name, returnValue);
   return (returnValue);
 }
 
@@ -1838,10 +2445,11 @@ ii_putParamter (II_CONN *ii_conn, II_BOOL moreSegments, II_BOOL dv_null, II_UINT
   putParmParm.pp_stmtHandle = ii_conn->stmtHandle;
   putParmParm.pp_parmCount = 1;
   IIapi_putParms (&putParmParm);
-  ii_sync (&(putParmParm.pp_genParm));
+  ii_sync (ii_conn, &(putParmParm.pp_genParm));
 
   if (ii_checkError (&(putParmParm.pp_genParm)))
     rb_raise (rb_eRuntimeError, "Error putting a parameter.");
+  ii_conn->moreSegments = moreSegments;
 
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
@@ -1849,6 +2457,103 @@ ii_putParamter (II_CONN *ii_conn, II_BOOL moreSegments, II_BOOL dv_null, II_UINT
 }
 
 
+/*
+**      ii_parm_add() - Queue a parameter value to be sent
+**
+**      Description -
+**              Returns dv_length bytes for the value to be written into,
+**              valid until the next call.  The values queued are sent
+**              together by ii_parm_flush(), rather than with one
+**              IIapi_putParms() and one wait each.
+*/
+char *
+ii_parm_add (II_CONN *ii_conn, II_BOOL dv_null, long dv_length)
+{
+  II_ROW_ARENA *arena = &ii_conn->arena;
+  long offset;
+
+  if (arena->parmCount == arena->parmMax)
+  {
+    arena->parmMax = arena->parmMax ? arena->parmMax * 2 : 16;
+    arena->parmData = (IIAPI_DATAVALUE *) ii_reallocate (arena->parmData, arena->parmMax, sizeof (IIAPI_DATAVALUE));
+    arena->parmOffset = (long *) ii_reallocate (arena->parmOffset, arena->parmMax, sizeof (long));
+  }
+
+  /* keep every value aligned for the integer and float types */
+  offset = (arena->parmUsed + 7) & ~7L;
+  if (arena->parmBuffer == NULL || offset + dv_length > arena->parmLen)
+  {
+    arena->parmLen = (arena->parmLen < 256) ? 256 : arena->parmLen * 2;
+    if (offset + dv_length > arena->parmLen)
+      arena->parmLen = offset + dv_length;
+    arena->parmBuffer = (char *) ii_reallocate (arena->parmBuffer, arena->parmLen, sizeof (char));
+  }
+
+  arena->parmData[arena->parmCount].dv_null = dv_null;
+  arena->parmData[arena->parmCount].dv_length = (II_UINT2) dv_length;
+  arena->parmData[arena->parmCount].dv_value = NULL;
+  arena->parmOffset[arena->parmCount] = offset;
+  arena->parmCount++;
+  arena->parmUsed = offset + dv_length;
+
+  return arena->parmBuffer + offset;
+}
+
+/* Set the length of the value last queued, when less than was asked for */
+void
+ii_parm_trim (II_CONN *ii_conn, long dv_length)
+{
+  II_ROW_ARENA *arena = &ii_conn->arena;
+
+  arena->parmData[arena->parmCount - 1].dv_length = (II_UINT2) dv_length;
+}
+
+/* Send the values queued by ii_parm_add() in a single IIapi_putParms() */
+void
+ii_parm_flush (II_CONN *ii_conn)
+{
+  II_ROW_ARENA *arena = &ii_conn->arena;
+  IIAPI_PUTPARMPARM putParmParm;
+  long parm;
+  char function_name[] = "ii_parm_flush";
+
+  if (arena->parmCount == 0)
+    return;
+
+  if (ii_globals.debug)
+    printf ("Entering %s, %li parameter(s).\n", function_name, arena->parmCount);
+
+  /* the buffer may have moved as it grew */
+  for (parm = 0; parm < arena->parmCount; parm++)
+    arena->parmData[parm].dv_value = arena->parmBuffer + arena->parmOffset[parm];
+
+  putParmParm.pp_moreSegments = FALSE;
+  putParmParm.pp_parmData = arena->parmData;
+  putParmParm.pp_genParm.gp_callback = NULL;
+  putParmParm.pp_genParm.gp_closure = NULL;
+  putParmParm.pp_stmtHandle = ii_conn->stmtHandle;
+  putParmParm.pp_parmCount = (II_INT2) arena->parmCount;
+  ii_parm_reset (ii_conn);
+
+  IIapi_putParms (&putParmParm);
+  ii_sync (ii_conn, &(putParmParm.pp_genParm));
+
+  if (ii_checkError (&(putParmParm.pp_genParm)))
+    rb_raise (rb_eRuntimeError, "Error putting a parameter.");
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+/* Drop any values queued and not sent, such as by a statement that failed */
+void
+ii_parm_reset (II_CONN *ii_conn)
+{
+  ii_conn->arena.parmCount = 0;
+  ii_conn->arena.parmUsed = 0;
+}
+
+
 int
 putProcedureNameParameter (II_CONN *ii_conn, char *procedureName)
 {
@@ -1857,8 +2562,7 @@ putProcedureNameParameter (II_CONN *ii_conn, char *procedureName)
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  returnValue =
-    ii_putParamter (ii_conn, 0, FALSE, (II_UINT2) strlen (procedureName), procedureName);
+  memcpy (ii_parm_add (ii_conn, FALSE, strlen (procedureName)), procedureName, strlen (procedureName));
 
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
@@ -1875,7 +2579,7 @@ putRubyFixNumParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  returnValue = ii_putParamter (ii_conn, 0, FALSE, sizeof (number), &number);
+  memcpy (ii_parm_add (ii_conn, FALSE, sizeof (number)), &number, sizeof (number));
 
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
@@ -1892,7 +2596,7 @@ putRubyFloatParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  returnValue = ii_putParamter (ii_conn, 0, FALSE, sizeof (number), &number);
+  memcpy (ii_parm_add (ii_conn, FALSE, sizeof (number)), &number, sizeof (number));
 
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
@@ -1907,28 +2611,23 @@ putNVarcharParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
   char *value_ptr = RSTRING_PTR (parameter->vvalue);
   int value_len = RSTRING_LEN (parameter->vvalue);
   long ucs2strLen = value_len * sizeof (UCS2);
-  char *ucs2str = ALLOC_N (char, ucs2strLen + 2 + sizeof (UCS2));
   int returnValue = 0;
   char function_name[] = "putNVarcharParameter";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  if (utf8_to_utf16 (value_ptr, value_ptr + value_len, (UCS2 *) ucs2str,
-                     (UCS2 *) (ucs2str + ucs2strLen), &ucs2strLen))
+  /* transcode straight into the parameter buffer, leaving 2 bytes at the
+   * start for the size of the string in chars
+   */
+  nvarchar = ii_parm_add (ii_conn, FALSE, 2 + ucs2strLen + sizeof (UCS2));
+  if (utf8_to_utf16 (value_ptr, value_ptr + value_len, (UCS2 *) (nvarchar + 2),
+                     (UCS2 *) (nvarchar + 2 + ucs2strLen), &ucs2strLen))
     rb_raise (rb_eRuntimeError,
               "Error! Failed to transcode %s (N) to utf16.\n", value_ptr);
+  *((II_INT2 *) (nvarchar)) = (II_INT2) ucs2strLen;
   ucs2strLen *= sizeof (UCS2);
 
-  /* copy the data to a new buffer then set the size of the string in
-   * chars at the begining of the buffer
-   * Note: allocate 2 bytes at the start and a null char at the end
-   * of the new buffer
-   */
-  nvarchar = ALLOC_N (char, 2 + ucs2strLen + sizeof (UCS2));
-  memcpy (nvarchar + 2, ucs2str, ucs2strLen);
-  *((II_INT2 *) (nvarchar)) = (II_INT2) ucs2strLen / sizeof (UCS2);
-
-  returnValue = ii_putParamter (ii_conn, 0, FALSE, (II_UINT2) (ucs2strLen + 2), nvarchar);
+  ii_parm_trim (ii_conn, ucs2strLen + 2);
 
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
@@ -1942,19 +2641,20 @@ putNCharParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
   char *value_ptr = RSTRING_PTR (parameter->vvalue);
   int value_len = RSTRING_LEN (parameter->vvalue);
   long ucs2strlen = value_len * sizeof (UCS2);
-  char *nchar = ALLOC_N (char, ucs2strlen + sizeof (UCS2));
+  char *nchar = NULL;
   int returnValue = 0;
   char function_name[] = "putNCharParameter";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
+  nchar = ii_parm_add (ii_conn, FALSE, ucs2strlen + sizeof (UCS2));
   if (utf8_to_utf16 (value_ptr, value_ptr + value_len, (UCS2 *) nchar,
                      (UCS2 *) (nchar + ucs2strlen), &ucs2strlen))
     rb_raise (rb_eRuntimeError,
               "Error! Failed to transcode %s (n) to utf16.\n", value_ptr);
   ucs2strlen *= sizeof (UCS2);
 
-  returnValue = ii_putParamter (ii_conn, 0, FALSE, (II_UINT2) ucs2strlen, nchar);
+  ii_parm_trim (ii_conn, ucs2strlen);
 
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
@@ -1967,21 +2667,20 @@ putVarcharParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
 {
   char *value_ptr = RSTRING_PTR (parameter->vvalue);
   int value_len = RSTRING_LEN (parameter->vvalue);
-  char *varchar = ALLOC_N (char, value_len + 2 + sizeof (char));
+  char *varchar = NULL;
   int returnValue = 0;
   char function_name[] = "putVarcharParameter";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  /* copy the data to a new buffer then set the size
+  /* copy the data to the parameter buffer then set the size
    * of the string at the begining of the buffer
    */
+  varchar = ii_parm_add (ii_conn, FALSE, value_len + 2);
   memcpy (varchar + 2, value_ptr, value_len);
   /* set the 1st 2 bytes as the length of the string */
   *((II_INT2 *) (varchar)) = (II_INT2) value_len;
 
-  returnValue = ii_putParamter (ii_conn, 0, FALSE, (II_UINT2) (value_len + 2), varchar);
-
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
   return (returnValue);
@@ -1993,13 +2692,15 @@ putDecimalParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
   IIAPI_FORMATPARM formatParm;
   char *value_ptr = RSTRING_PTR (parameter->vvalue);
   int value_len = RSTRING_LEN (parameter->vvalue);
-  char decimal[DECIMAL_BUFFER_LEN + 1] = "";
+  char *decimal = NULL;
   int returnValue = 0;
   char function_name[] = "putDecimalParameter";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  formatParm.fd_envHandle = ii_globals.envHandle;
+  decimal = ii_parm_add (ii_conn, FALSE, DECIMAL_BUFFER_LEN);
+
+  formatParm.fd_envHandle = ii_conn->envHandle;
   formatParm.fd_srcDesc.ds_dataType = IIAPI_CHA_TYPE;
   formatParm.fd_srcDesc.ds_nullable = FALSE;
   formatParm.fd_srcDesc.ds_length = value_len;
@@ -2028,7 +2729,7 @@ putDecimalParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
               value_ptr);
   }
 
-  returnValue = ii_putParamter (ii_conn, 0, FALSE, formatParm.fd_dstValue.dv_length, decimal);
+  ii_parm_trim (ii_conn, formatParm.fd_dstValue.dv_length);
 
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
@@ -2041,7 +2742,7 @@ putLOBParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
 {
   IIAPI_FORMATPARM formatParm;
   II_BOOL moreSegments = 0;
-  char *segment = ALLOC_N (char, ii_conn->lobSegmentSize + 2);
+  char *segment = ii_arena_scratch (ii_conn, ii_conn->lobSegmentSize + 2);
   char *value_ptr = RSTRING_PTR (parameter->vvalue);
   long value_len = RSTRING_LEN (parameter->vvalue);
   long segment_length = 0;
@@ -2050,10 +2751,11 @@ putLOBParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
+  /* the values ahead of it go first, the LOB is sent a segment at a time */
+  ii_parm_flush (ii_conn);
+
   do
   {
-    memset (segment, 0, ii_conn->lobSegmentSize + 2);
-
     if (value_len <= ii_conn->lobSegmentSize)
     {
       moreSegments = 0;
@@ -2086,6 +2788,69 @@ putLOBParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
 }
 
 
+/*
+**      putLOBStreamParameter() - Send a LOB parameter read from an IO
+**
+**      Description -
+**              The IO is read a segment at a time into two reused
+**              buffers, reading one segment ahead so the last segment
+**              can be sent with moreSegments cleared.  Memory use does
+**              not depend on the size of the value.
+*/
+int
+putLOBStreamParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
+{
+  static ID id_read = 0;
+  VALUE io = parameter->vvalue;
+  VALUE readLength = LONG2NUM (ii_conn->lobSegmentSize);
+  VALUE buffers[2];
+  VALUE current, next;
+  char *segment = ii_arena_scratch (ii_conn, ii_conn->lobSegmentSize + 2);
+  long segment_length = 0;
+  int which = 0;
+  int returnValue = 0;
+  char function_name[] = "putLOBStreamParameter";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  if (!id_read)
+    id_read = rb_intern ("read");
+
+  ii_parm_flush (ii_conn);
+
+  buffers[0] = rb_str_buf_new (ii_conn->lobSegmentSize);
+  buffers[1] = rb_str_buf_new (ii_conn->lobSegmentSize);
+
+  current = rb_funcall (io, id_read, 2, readLength, buffers[which]);
+  do
+  {
+    which = !which;
+    next = NIL_P(current) ? Qnil : rb_funcall (io, id_read, 2, readLength, buffers[which]);
+
+    segment_length = NIL_P(current) ? 0 : RSTRING_LEN (current);
+    if (segment_length > ii_conn->lobSegmentSize)
+      rb_raise (rb_eRuntimeError, "read returned more than the %li bytes asked for", (long) ii_conn->lobSegmentSize);
+    if (segment_length > 0)
+      memcpy (segment + 2, RSTRING_PTR (current), segment_length);
+    /* set the 1st 2 bytes as the length of the segment */
+    *((II_UINT2 *) segment) = (II_UINT2) segment_length;
+
+    returnValue =
+      ii_putParamter (ii_conn, !NIL_P(next), FALSE, (II_UINT2) (segment_length + 2), segment);
+
+    current = next;
+  }
+  while (!NIL_P(current));
+
+  RB_GC_GUARD(buffers[0]);
+  RB_GC_GUARD(buffers[1]);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s, returning %i.\n", function_name, returnValue);
+  return (returnValue);
+}
+
+
 int
 putCharParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
 {
@@ -2094,9 +2859,8 @@ putCharParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  returnValue =
-    ii_putParamter (ii_conn, 0, FALSE, (II_UINT2) RSTRING_LEN (parameter->vvalue),
-                    RSTRING_PTR (parameter->vvalue));
+  memcpy (ii_parm_add (ii_conn, FALSE, RSTRING_LEN (parameter->vvalue)),
+          RSTRING_PTR (parameter->vvalue), RSTRING_LEN (parameter->vvalue));
 
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
@@ -2112,9 +2876,7 @@ putNullParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  returnValue =
-    ii_putParamter (ii_conn, 0, TRUE, (II_UINT2) RSTRING_LEN (parameter->vvalue),
-                    RSTRING_PTR (parameter->vvalue));
+  ii_parm_add (ii_conn, TRUE, 0);
 
   if (ii_globals.debug)
     printf ("Exiting %s, returning %i.\n", function_name, returnValue);
@@ -2186,8 +2948,20 @@ putParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
       break;
 
     default:
-      rb_raise (rb_eRuntimeError,
-                "Error putting a parameter of unknown type");
+      switch ((char) *(RSTRING_PTR (parameter->vtype)))
+      {
+        case RUBY_LONG_BYTE_PARAMETER:
+        case RUBY_LONG_TEXT_PARAMETER:
+        case RUBY_LONG_VARCHAR_PARAMETER:
+          /* an IO, checked by checkLOBParameterValue() */
+          returnValue = putLOBStreamParameter (ii_conn, parameter);
+          break;
+
+        default:
+          rb_raise (rb_eRuntimeError,
+                    "Error putting a parameter of unknown type");
+          break;
+      }
       break;
   }
   if (ii_globals.debug)
@@ -2197,14 +2971,72 @@ putParameter (II_CONN *ii_conn, RUBY_PARAMETER * parameter)
 
 
 
+/*
+**      ii_api_cancel() - Cancel the current statement and wait for it
+*/
+static void
+ii_api_cancel (II_CONN *ii_conn)
+{
+  IIAPI_CANCELPARM cancelParm;
+  char function_name[] = "ii_api_cancel";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  cancelParm.cn_genParm.gp_callback = NULL;
+  cancelParm.cn_genParm.gp_closure = NULL;
+  cancelParm.cn_stmtHandle = ii_conn->stmtHandle;
+
+  IIapi_cancel (&cancelParm);
+  ii_sync (ii_conn, &(cancelParm.cn_genParm));
+  ii_conn->moreSegments = FALSE;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+/*
+**      ii_api_query_abort() - Clean up a statement whose parameters failed
+**
+**      Description -
+**              By the time the parameters are sent IIapi_query() has
+**              returned a statement handle and may have started a
+**              transaction.  When sending them raises, from IO#read while
+**              streaming a LOB or from a bad value, the statement is
+**              cancelled if it was left part way through a LOB's segments
+**              and closed.  In auto-commit mode the transaction is rolled
+**              back.  The exception is then raised again.
+*/
+static void
+ii_api_query_abort (II_CONN *ii_conn, int param_state)
+{
+  char function_name[] = "ii_api_query_abort";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  ii_parm_reset (ii_conn);
+  if (ii_conn->stmtHandle)
+  {
+    if (ii_conn->moreSegments)
+      ii_api_cancel (ii_conn);
+    ii_api_query_close (ii_conn);
+  }
+  if (ii_conn->autocommit && ii_conn->cursorCount == 0 && ii_conn->tranHandle)
+    ii_api_rollback (ii_conn, NULL);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  rb_jump_tag (param_state);
+}
+
+
 /* static short ii_bind_params (VALUE param_params, char *procname, long paramCount,II_LONG lobSegmentSize) */
 /* Binds and sends data for parameters passed via param_params */
 /* param_params is expected to be a repeating list of n * [key, type, value] */
+/* setDescrParm holds the descriptors, from setDescriptorParms() or reused */
+/* *described is set once they are filled in, later calls only update them */
 static short
-ii_bind_params (int param_argc, VALUE param_params, char *procname, long paramCount, II_CONN *ii_conn)
+ii_bind_params (int param_argc, VALUE param_params, char *procname, long paramCount, II_CONN *ii_conn, IIAPI_SETDESCRPARM *setDescrParm, int *described)
 {
-  IIAPI_SETDESCRPARM setDescrParm;
-  IIAPI_PUTPARMPARM putParmParm;
   int param = 0;
   short isProcedureCall = 0;
   char function_name[] = "ii_bind_params";
@@ -2215,13 +3047,13 @@ ii_bind_params (int param_argc, VALUE param_params, char *procname, long paramCo
     printf ("%s: argc = %i, paramCount = %li, procedure name = %s.\n", function_name, param_argc, paramCount, procname);
 
   isProcedureCall = (procname != NULL) ? 1 : 0;
-  setDescriptorParms (&setDescrParm, paramCount, isProcedureCall, ii_conn);
+  setDescrParm->sd_stmtHandle = ii_conn->stmtHandle;
 
   if (isProcedureCall)
-    setProcedureNameDescriptor (&(setDescrParm.sd_descriptor[0]), procname);
+    setProcedureNameDescriptor (&(setDescrParm->sd_descriptor[0]), procname);
 
   /* extract the paramtypes */
-  for (param = isProcedureCall; param < setDescrParm.sd_descriptorCount; param++)
+  for (param = isProcedureCall; param < setDescrParm->sd_descriptorCount; param++)
   {
     RUBY_PARAMETER parameter;
 
@@ -2229,35 +3061,57 @@ ii_bind_params (int param_argc, VALUE param_params, char *procname, long paramCo
       printf ("%s: At start of loop for param = %i.\n", function_name, param);
 
     getIIParameter (&parameter, param_params, param, isProcedureCall);
-    setParameterDescriptor (&(setDescrParm.sd_descriptor[param]), &parameter, isProcedureCall, ii_conn->lobSegmentSize);
+    if (described != NULL && *described)
+      updateParameterDescriptor (&(setDescrParm->sd_descriptor[param]), &parameter, isProcedureCall, ii_conn->lobSegmentSize);
+    else
+      setParameterDescriptor (&(setDescrParm->sd_descriptor[param]), &parameter, isProcedureCall, ii_conn->lobSegmentSize);
   }
 
   if (ii_globals.debug)
     printf ("%s: About to set parameter descriptors.\n", function_name);
 
-  IIapi_setDescriptor (&setDescrParm);
+  /* needed even when nothing has changed, the descriptors belong to the
+   * statement handle and each run has a new one */
+  IIapi_setDescriptor (setDescrParm);
+  ii_sync (ii_conn, &(setDescrParm->sd_genParm));
 
-  if (ii_checkError (&setDescrParm.sd_genParm))
+  if (ii_checkError (&setDescrParm->sd_genParm))
     rb_raise (rb_eRuntimeError, "Failed to set parameter descriptors.");
+  if (described != NULL)
+    *described = TRUE;
 
   if (ii_globals.debug)
     printf ("%s: About to put parameters.\n", function_name);
 
+  /* the values are gathered and sent in one go, LOBs aside */
+  ii_parm_reset (ii_conn);
   if (isProcedureCall)
     putProcedureNameParameter (ii_conn, procname);
 
-  for (param = isProcedureCall; param < setDescrParm.sd_descriptorCount; param++)
+  for (param = isProcedureCall; param < setDescrParm->sd_descriptorCount; param++)
   {
     RUBY_PARAMETER parameter;
     getIIParameter (&parameter, param_params, param, isProcedureCall);
     putParameter (ii_conn, &parameter);
   }
+  ii_parm_flush (ii_conn);
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
   return 0;
 }
 
+/* ii_bind_params() run under rb_protect() */
+static VALUE
+ii_bind_params_protected (VALUE param_args)
+{
+  II_BIND_ARGS *args = (II_BIND_ARGS *) param_args;
+
+  if (ii_bind_params (args->argc, args->params, args->procname, args->paramCount, args->ii_conn, args->setDescrParm, args->described))
+    rb_raise (rb_eRuntimeError, "Error binding parameters.");
+  return Qnil;
+}
+
 
 char *
 convertParamMarkers (char *param_sqlText, long param_count)
@@ -2290,19 +3144,72 @@ convertParamMarkers (char *param_sqlText, long param_count)
     else
       new_statement[j++] = param_sqlText[i];
   }
+  new_statement[j] = '\0';
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
   return new_statement;
 }
 
-II_PTR ii_api_query (II_CONN *ii_conn, char *param_sqlText, int param_argc, VALUE param_params)
+/*
+**      ii_query_text_parse() - Turn SQL text into what ii_api_query_send() sends
+**
+**      Description -
+**              Works out whether a procedure is being called, counts the
+**              parameter markers and converts them to the ~V OpenAPI
+**              expects.  Anything allocated is released again by
+**              ii_query_text_free().
+*/
+void
+ii_query_text_parse (II_QUERY_TEXT *param_text, char *param_sqlText)
+{
+  param_text->procedureName = getProcedureName (param_sqlText);
+  param_text->paramCount = countParameters (param_sqlText);
+  param_text->queryText = NULL;
+  param_text->converted = FALSE;
+
+  if (param_text->procedureName == NULL)
+  {
+    param_text->converted = (param_text->paramCount > 0);
+    param_text->queryText = ((param_text->paramCount == 0) ? (param_sqlText) : (convertParamMarkers (param_sqlText, param_text->paramCount)));
+  }
+}
+
+void
+ii_query_text_free (II_QUERY_TEXT *param_text)
+{
+  if (param_text->converted)
+    xfree (param_text->queryText);
+  if (param_text->procedureName != NULL)
+    xfree (param_text->procedureName);
+  param_text->queryText = NULL;
+  param_text->procedureName = NULL;
+  param_text->converted = FALSE;
+}
+
+II_PTR ii_api_query (II_CONN *ii_conn, char *param_sqlText, int param_argc, VALUE param_params, II_LONG param_apiQueryType, II_QUERY_OPTIONS * param_options)
+{
+  II_QUERY_TEXT text;
+  II_PTR stmtHandle;
+
+  ii_query_text_parse (&text, param_sqlText);
+  stmtHandle = ii_api_query_send (ii_conn, &text, param_argc, param_params, param_apiQueryType, param_options, NULL, NULL);
+  ii_query_text_free (&text);
+  return stmtHandle;
+}
+
+/* Send a statement parsed by ii_query_text_parse() and its parameters.
+ * param_setDescrParm holds parameter descriptors to reuse, NULL if there
+ * are none.  param_described says whether they are already filled in, NULL
+ * to fill them in every time */
+II_PTR ii_api_query_send (II_CONN *ii_conn, II_QUERY_TEXT *param_text, int param_argc, VALUE param_params, II_LONG param_apiQueryType, II_QUERY_OPTIONS * param_options, IIAPI_SETDESCRPARM *param_setDescrParm, int *param_described)
 {
   IIAPI_QUERYPARM queryParm;
-  char function_name[] = "ii_api_query";
-  char *procedureName = getProcedureName (param_sqlText);
-  char *statement = NULL;
-  long paramCount = countParameters (param_sqlText);
+  IIAPI_SETDESCRPARM descrParm;
+  II_BIND_ARGS args;
+  int state = 0;
+  char function_name[] = "ii_api_query_send";
+  char *procedureName = param_text->procedureName;
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
@@ -2310,37 +3217,57 @@ II_PTR ii_api_query (II_CONN *ii_conn, char *param_sqlText, int param_argc, VALU
    ** Call IIapi_query to execute statement.
    */
 
-  if (procedureName == NULL)
-  {
-    statement = ((paramCount == 0) ?  (param_sqlText) : (convertParamMarkers (param_sqlText, paramCount)));
-  }
   queryParm.qy_connHandle = ii_conn->connHandle;
   queryParm.qy_genParm.gp_callback = NULL;
   queryParm.qy_genParm.gp_closure = NULL;
-  queryParm.qy_queryType = ((procedureName != NULL) ? IIAPI_QT_EXEC_PROCEDURE : IIAPI_QT_QUERY);
-  queryParm.qy_queryText = ((procedureName == NULL) ? statement : NULL);
+  queryParm.qy_queryType = ((procedureName != NULL) ? IIAPI_QT_EXEC_PROCEDURE : param_apiQueryType);
+  queryParm.qy_queryText = ((procedureName == NULL) ? param_text->queryText : NULL);
   queryParm.qy_parameters = ((param_argc > 0) ? TRUE : FALSE);
   queryParm.qy_tranHandle = ii_conn->tranHandle;
   queryParm.qy_stmtHandle = NULL;
 #if defined(IIAPI_VERSION_6)
-  queryParm.qy_flags  = 0;
+  queryParm.qy_flags  = param_options->queryFlags;
 #endif
+  ii_conn->deadline = ii_deadline (param_options->timeout);
+
+  ii_conn->moreSegments = FALSE;
 
   IIapi_query (&queryParm);
-  ii_sync (&(queryParm.qy_genParm));
+  ii_sync (ii_conn, &(queryParm.qy_genParm));
   ii_conn->stmtHandle = queryParm.qy_stmtHandle;
+  /* known from here on, so that a failure below can roll it back */
+  if (ii_conn->tranHandle == NULL)
+    ii_conn->tranHandle = queryParm.qy_tranHandle;
 
-  if (param_argc > 0 && ii_bind_params (param_argc, param_params, procedureName, paramCount, ii_conn))
+  if (param_argc > 0)
   {
-    rb_raise (rb_eRuntimeError, "Error binding parameters.");
+    args.ii_conn = ii_conn;
+    args.argc = param_argc;
+    args.params = param_params;
+    args.procname = procedureName;
+    args.paramCount = param_text->paramCount;
+    args.setDescrParm = param_setDescrParm;
+    args.described = param_described;
+    args.statement = NULL;
+    args.apiQueryType = param_apiQueryType;
+    if (param_setDescrParm == NULL)
+    {
+      args.setDescrParm = &descrParm;
+      args.described = NULL;
+      setDescriptorParms (&descrParm, param_text->paramCount, (procedureName != NULL), ii_conn);
+    }
+
+    rb_protect (ii_bind_params_protected, (VALUE) &args, &state);
+
+    if (param_setDescrParm == NULL)
+      xfree (descrParm.sd_descriptor);
+    if (state)
+      ii_api_query_abort (ii_conn, state);
   }
 
   if (ii_globals.debug)
     printf ("%s: Query status is >>%d<<\n", function_name, queryParm.qy_genParm.gp_status);
 
-  if (ii_conn->tranHandle == NULL)
-    ii_conn->tranHandle = queryParm.qy_tranHandle;
-
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
   return queryParm.qy_stmtHandle;
@@ -2361,7 +3288,7 @@ ii_api_get_metadata (II_CONN * ii_conn, IIAPI_GETDESCRPARM * param_descrParm)
   /* Iterate through each column loading the name and type in to global arrays */
   for (i = 0; i < param_descrParm->gd_descriptorCount; i++)
   {
-    ret_val = rb_ary_push (ii_conn->r_data_types, rb_str_new2 (getIngresDataTypeAsString (param_descrParm->gd_descriptor[i].ds_dataType)));
+    ret_val = rb_ary_push (ii_conn->r_data_types, rb_str_new2 (getIngresDataTypeAsString (ii_conn, param_descrParm->gd_descriptor[i].ds_dataType)));
     rb_ary_push (ii_conn->r_column_names, rb_str_new2 (param_descrParm->gd_descriptor[i].ds_columnName));
   }
   if (ii_globals.debug)
@@ -2369,22 +3296,28 @@ ii_api_get_metadata (II_CONN * ii_conn, IIAPI_GETDESCRPARM * param_descrParm)
 }
 
 
+/* Ask for the result descriptors without waiting for them to arrive.
+ * param_callback, if not NULL, is called with param_closure once they have */
 void
-ii_api_getDescriptors (II_CONN *ii_conn, IIAPI_GETDESCRPARM * param_descrParm)
+ii_api_getDescriptors_send (II_CONN *ii_conn, IIAPI_GETDESCRPARM * param_descrParm, II_API_CALLBACK param_callback, II_PTR param_closure)
 {
-  char function_name[] = "ii_api_getDescriptors";
-  if (ii_globals.debug)
-    printf ("Entering %s.\n", function_name);
-
-  param_descrParm->gd_genParm.gp_callback = NULL;
-  param_descrParm->gd_genParm.gp_closure = NULL;
+  param_descrParm->gd_genParm.gp_callback = param_callback;
+  param_descrParm->gd_genParm.gp_closure = param_closure;
   param_descrParm->gd_stmtHandle = ii_conn->stmtHandle;
   param_descrParm->gd_descriptorCount = 0;
   param_descrParm->gd_descriptor = NULL;
 
   IIapi_getDescriptor (param_descrParm);
+}
 
-  ii_sync (&(param_descrParm->gd_genParm));
+
+/* Check the descriptors sent by ii_api_getDescriptors_send() arrived */
+void
+ii_api_getDescriptors_check (II_CONN *ii_conn, IIAPI_GETDESCRPARM * param_descrParm)
+{
+  char function_name[] = "ii_api_getDescriptors_check";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
 
   if (ii_globals.debug)
     printf ("%s: GetDescriptor status is **%d**", function_name, param_descrParm->gd_genParm.gp_status);
@@ -2401,6 +3334,15 @@ ii_api_getDescriptors (II_CONN *ii_conn, IIAPI_GETDESCRPARM * param_descrParm)
 }
 
 
+void
+ii_api_getDescriptors (II_CONN *ii_conn, IIAPI_GETDESCRPARM * param_descrParm)
+{
+  ii_api_getDescriptors_send (ii_conn, param_descrParm, NULL, NULL);
+  ii_sync_query (ii_conn, &(param_descrParm->gd_genParm));
+  ii_api_getDescriptors_check (ii_conn, param_descrParm);
+}
+
+
 void
 ii_api_query_close (II_CONN *ii_conn)
 {
@@ -2415,7 +3357,7 @@ ii_api_query_close (II_CONN *ii_conn)
 
   IIapi_close (&closeParm);
 
-  ii_sync (&(closeParm.cl_genParm));
+  ii_sync (ii_conn, &(closeParm.cl_genParm));
 
   if (ii_globals.debug)
     printf ("%s: closeParm status is >>%d<<", function_name,
@@ -2423,6 +3365,8 @@ ii_api_query_close (II_CONN *ii_conn)
   ii_checkError (&closeParm.cl_genParm);
 
   ii_conn->stmtHandle = NULL;
+  ii_conn->deadline = 0;
+  ii_arena_free (ii_conn);
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -2443,41 +3387,227 @@ getRowsAffected (II_CONN *ii_conn)
 
   IIapi_getQueryInfo (&getQInfoParm);
 
-  ii_sync (&(getQInfoParm.gq_genParm));
+  ii_sync_query (ii_conn, &(getQInfoParm.gq_genParm));
 
   if (ii_globals.debug)
     printf ("%s: GetQueryInfo status is >>%d<<", function_name,
             getQInfoParm.gq_genParm.gp_status);
   ii_checkError (&getQInfoParm.gq_genParm);
 
+  /* kept for repeated queries, see ii_statement_run_repeated() */
+  ii_conn->queryInfoFlags = getQInfoParm.gq_flags;
+  if (getQInfoParm.gq_mask & IIAPI_GQ_REPEAT_QUERY_ID)
+    ii_conn->repeatQueryHandle = getQInfoParm.gq_repeatQueryHandle;
+
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
   return (II_LONG) getQInfoParm.gq_rowCount;
 }
 
 
-VALUE
-processDateField (IIAPI_DATAVALUE * param_columnData, int param_dataType)
+/*
+**      Native date/time decoding
+**
+**      Description -
+**              Used instead of processDateField() when the connection was
+**              opened with :native_dates => true.  The internal formats
+**              returned by OpenAPI are decoded directly into Ruby objects,
+**              avoiding IIapi_formatData() and the string parsing done by
+**              the caller afterwards.
+**
+**              ingresdate (12 bytes)  - status, highday, year, month,
+**                                       lowday, time (ms since midnight GMT)
+**              ANSI date (4 bytes)    - year, month, day
+**              ANSI time (10 bytes)   - seconds, nanoseconds, tz hour/minute
+**              ANSI timestamp (14)    - ANSI date followed by ANSI time
+**              interval ym (3 bytes)  - years, months
+**              interval ds (12 bytes) - days, seconds, nanoseconds
+**
+**              Values WITH LOCAL TIME ZONE are held in UTC and returned as
+**              local Times, WITH TIME ZONE values keep their own offset and
+**              WITHOUT TIME ZONE values are returned as UTC Times holding
+**              the wall clock time.  Time values are placed on 2000-01-01.
+*/
+#define II_DN_ABSOLUTE    0x01
+#define II_DN_TIMESPEC    0x20
+#define II_SECONDS_PER_DAY 86400L
+#define II_TIME_EPOCH_2000 946684800L
+
+static VALUE ii_cDate = Qnil;
+static ID ii_id_new, ii_id_utc, ii_id_getlocal;
+
+/* Days between 1970-01-01 and the given date in the proleptic Gregorian calendar */
+static long
+ii_days_from_civil (long param_year, int param_month, int param_day)
 {
-  VALUE returnValue;
-  IIAPI_CONVERTPARM convertParm;
-  IIAPI_FORMATPARM formatParm;
-  int dateStrLen = 260;
-  char *dateStr = NULL;
-  char function_name[] = "processDateField";
-  if (ii_globals.debug)
-    printf ("Entering %s.\n", function_name);
+  long era, yearOfEra, dayOfYear, dayOfEra;
+
+  param_year -= param_month <= 2;
+  era = (param_year >= 0 ? param_year : param_year - 399) / 400;
+  yearOfEra = param_year - era * 400;
+  dayOfYear = (153 * (param_month + (param_month > 2 ? -3 : 9)) + 2) / 5 + param_day - 1;
+  dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+  return era * 146097 + dayOfEra - 719468;
+}
 
-  dateStr = ALLOC_N (char, dateStrLen + 1);
+static VALUE
+ii_native_date (long param_year, int param_month, int param_day)
+{
+  if (NIL_P(ii_cDate))
+  {
+    rb_require ("date");
+    ii_cDate = rb_const_get (rb_cObject, rb_intern ("Date"));
+    rb_global_variable (&ii_cDate);
+    ii_id_new = rb_intern ("new");
+  }
+  return rb_funcall (ii_cDate, ii_id_new, 3, LONG2NUM (param_year), INT2FIX (param_month), INT2FIX (param_day));
+}
 
-  if (ii_globals.debug)
-    printf ("%s: Found a DATE or TIME field of type %d >>%s<<\n", function_name,
-            param_dataType, (char *)(param_columnData->dv_value));
+/* Build a Time from seconds since the epoch, in the zone implied by the type */
+static VALUE
+ii_native_time (int param_dataType, long param_seconds, long param_nanoseconds, int param_tzOffset)
+{
+  VALUE time = rb_time_nano_new (param_seconds, param_nanoseconds);
 
-  formatParm.fd_envHandle = ii_globals.envHandle;
-  formatParm.fd_srcDesc.ds_dataType = param_dataType;
-  formatParm.fd_srcDesc.ds_nullable = FALSE;
-  formatParm.fd_srcDesc.ds_length = param_columnData->dv_length;
+  if (!ii_id_utc)
+  {
+    ii_id_utc = rb_intern ("utc");
+    ii_id_getlocal = rb_intern ("getlocal");
+  }
+
+  switch (param_dataType)
+  {
+#ifdef IIAPI_DATE_TYPE
+    case IIAPI_TMWO_TYPE:
+    case IIAPI_TSWO_TYPE:
+      return rb_funcall (time, ii_id_utc, 0);
+    case IIAPI_TMTZ_TYPE:
+    case IIAPI_TSTZ_TYPE:
+      return rb_funcall (time, ii_id_getlocal, 1, INT2FIX (param_tzOffset));
+#endif
+    default:
+      return time;
+  }
+}
+
+/*
+**      processNativeDateField() - Decode an Ingres date/time value
+**
+**      Description -
+**              Returns Qundef for values that are not decoded natively,
+**              ingresdate intervals and empty dates, which are left to
+**              processDateField().
+*/
+VALUE
+processNativeDateField (IIAPI_DATAVALUE * param_columnData, int param_dataType)
+{
+  unsigned char *value = (unsigned char *) param_columnData->dv_value;
+  II_INT2 year = 0, months = 0;
+  II_UINT2 lowDay = 0;
+  II_INT4 seconds = 0, nanoseconds = 0, days = 0;
+  signed char month = 0, day = 0, tzHour = 0, tzMinute = 0;
+  long epochSeconds;
+  char function_name[] = "processNativeDateField";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  switch (param_dataType)
+  {
+    case IIAPI_DTE_TYPE:
+      if (param_columnData->dv_length < 12 || !(value[0] & II_DN_ABSOLUTE))
+        return Qundef;
+      memcpy (&year, value + 2, 2);
+      memcpy (&months, value + 4, 2);
+      memcpy (&lowDay, value + 6, 2);
+      memcpy (&seconds, value + 8, 4);
+      days = ((II_INT4) value[1] << 16) | lowDay;
+      if (!(value[0] & II_DN_TIMESPEC))
+        return ii_native_date (year, months, days);
+      /* absolute dates with a time are held in GMT, time in milliseconds */
+      epochSeconds = ii_days_from_civil (year, months, days) * II_SECONDS_PER_DAY + seconds / 1000;
+      return ii_native_time (param_dataType, epochSeconds, (seconds % 1000) * 1000000L, 0);
+
+#ifdef IIAPI_DATE_TYPE
+    case IIAPI_DATE_TYPE:
+      if (param_columnData->dv_length < 4)
+        return Qundef;
+      memcpy (&year, value, 2);
+      month = value[2];
+      day = value[3];
+      return ii_native_date (year, month, day);
+
+    case IIAPI_TIME_TYPE:
+    case IIAPI_TMWO_TYPE:
+    case IIAPI_TMTZ_TYPE:
+      if (param_columnData->dv_length < 10)
+        return Qundef;
+      memcpy (&seconds, value, 4);
+      memcpy (&nanoseconds, value + 4, 4);
+      tzHour = value[8];
+      tzMinute = value[9];
+      return ii_native_time (param_dataType, II_TIME_EPOCH_2000 + seconds, nanoseconds, (tzHour * 60 + tzMinute) * 60);
+
+    case IIAPI_TS_TYPE:
+    case IIAPI_TSWO_TYPE:
+    case IIAPI_TSTZ_TYPE:
+      if (param_columnData->dv_length < 14)
+        return Qundef;
+      memcpy (&year, value, 2);
+      month = value[2];
+      day = value[3];
+      memcpy (&seconds, value + 4, 4);
+      memcpy (&nanoseconds, value + 8, 4);
+      tzHour = value[12];
+      tzMinute = value[13];
+      epochSeconds = ii_days_from_civil (year, month, day) * II_SECONDS_PER_DAY + seconds;
+      return ii_native_time (param_dataType, epochSeconds, nanoseconds, (tzHour * 60 + tzMinute) * 60);
+
+    case IIAPI_INTYM_TYPE:
+      /* returned as a whole number of months */
+      if (param_columnData->dv_length < 3)
+        return Qundef;
+      memcpy (&year, value, 2);
+      month = value[2];
+      return INT2FIX (year * 12 + month);
+
+    case IIAPI_INTDS_TYPE:
+      /* returned as a number of seconds */
+      if (param_columnData->dv_length < 12)
+        return Qundef;
+      memcpy (&days, value, 4);
+      memcpy (&seconds, value + 4, 4);
+      memcpy (&nanoseconds, value + 8, 4);
+      return rb_float_new ((double) days * II_SECONDS_PER_DAY + seconds + nanoseconds / 1e9);
+#endif
+
+    default:
+      return Qundef;
+  }
+}
+
+
+VALUE
+processDateField (II_CONN *ii_conn, IIAPI_DATAVALUE * param_columnData, int param_dataType)
+{
+  VALUE returnValue;
+  IIAPI_CONVERTPARM convertParm;
+  IIAPI_FORMATPARM formatParm;
+  int dateStrLen = 260;
+  char *dateStr = NULL;
+  char function_name[] = "processDateField";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  dateStr = ii_arena_scratch (ii_conn, dateStrLen + 1);
+
+  if (ii_globals.debug)
+    printf ("%s: Found a DATE or TIME field of type %d >>%s<<\n", function_name,
+            param_dataType, (char *)(param_columnData->dv_value));
+
+  formatParm.fd_envHandle = ii_conn->envHandle;
+  formatParm.fd_srcDesc.ds_dataType = param_dataType;
+  formatParm.fd_srcDesc.ds_nullable = FALSE;
+  formatParm.fd_srcDesc.ds_length = param_columnData->dv_length;
   formatParm.fd_srcDesc.ds_precision = 0;
   formatParm.fd_srcDesc.ds_scale = 0;
   formatParm.fd_srcDesc.ds_columnType = IIAPI_COL_QPARM;
@@ -2514,6 +3644,89 @@ processDateField (IIAPI_DATAVALUE * param_columnData, int param_dataType)
 }
 
 
+/*
+**      processPackedDecimalField() - Decode an Ingres packed decimal
+**
+**      Description -
+**              Ingres DECIMAL values are packed two digits to a byte, most
+**              significant first, with the sign in the low nibble of the
+**              last byte (0xD or 0xB for negative values).  An even
+**              precision leaves the first nibble unused.  ds_precision and
+**              ds_scale from the descriptor give the number of digits and
+**              where the decimal point goes.
+**
+**              Returns an Integer when the scale is 0 and a BigDecimal
+**              otherwise, or Qundef if the value cannot be decoded so the
+**              caller can fall back to processDecimalField().
+*/
+#define II_MAX_DECIMAL_DIGITS 39
+
+static VALUE ii_mBigDecimal = Qnil;
+static ID ii_id_BigDecimal;
+
+/* Create a BigDecimal from a string of digits, loading bigdecimal on first use */
+static VALUE
+ii_big_decimal (char *param_digits, long param_length)
+{
+  if (NIL_P(ii_mBigDecimal))
+  {
+    rb_require ("bigdecimal");
+    ii_mBigDecimal = rb_mKernel;
+    ii_id_BigDecimal = rb_intern ("BigDecimal");
+  }
+  return rb_funcall (ii_mBigDecimal, ii_id_BigDecimal, 1, rb_str_new (param_digits, param_length));
+}
+
+VALUE
+processPackedDecimalField (IIAPI_DATAVALUE * param_columnData, IIAPI_DESCRIPTOR * param_descrParm)
+{
+  unsigned char *value = (unsigned char *) param_columnData->dv_value;
+  int precision = param_descrParm->ds_precision;
+  int scale = param_descrParm->ds_scale;
+  int length = precision / 2 + 1;
+  int nibble = (precision % 2 == 0) ? 1 : 0;  /* skip the unused leading nibble */
+  int negative, digit, i, pos = 0;
+  unsigned char sign;
+  unsigned long long integer = 0;
+  char digits[II_MAX_DECIMAL_DIGITS + 4];
+  char function_name[] = "processPackedDecimalField";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  if (precision < 1 || precision > II_MAX_DECIMAL_DIGITS || scale < 0 || scale > precision || param_columnData->dv_length < length)
+    return Qundef;
+
+  sign = value[length - 1] & 0x0F;
+  negative = (sign == 0x0D || sign == 0x0B);
+  if (negative)
+    digits[pos++] = '-';
+  if (scale == precision)
+    digits[pos++] = '0';
+
+  for (i = 0; i < precision; i++, nibble++)
+  {
+    digit = (nibble % 2 == 0) ? value[nibble / 2] >> 4 : value[nibble / 2] & 0x0F;
+    if (digit > 9)
+      return Qundef;
+    if (i == precision - scale)
+      digits[pos++] = '.';
+    digits[pos++] = '0' + digit;
+    integer = integer * 10 + digit;
+  }
+  digits[pos] = '\0';
+
+  if (scale == 0)
+  {
+    /* up to 18 digits always fit in a signed 64 bit integer */
+    if (precision <= 18)
+      return LL2NUM (negative ? -(__int64) integer : (__int64) integer);
+    return rb_cstr2inum (digits, 10);
+  }
+
+  return ii_big_decimal (digits, pos);
+}
+
+
 VALUE
 processDecimalField (IIAPI_DATAVALUE * param_columnData, IIAPI_DESCRIPTOR * param_descrParm)
 {
@@ -2560,6 +3773,15 @@ processDecimalField (IIAPI_DATAVALUE * param_columnData, IIAPI_DESCRIPTOR * para
 }
 
 
+/* The value returned for a NULL, the string "NULL" unless the connection
+ * was opened with :null_as_nil => true */
+VALUE
+processNullField (II_CONN * ii_conn)
+{
+  return ii_conn->nullAsNil ? Qnil : rb_str_new2 ("NULL");
+}
+
+
 /*
 **      processIntField() - Convert Ingres integer to Ruby numeric
 **
@@ -2593,7 +3815,7 @@ processDecimalField (IIAPI_DATAVALUE * param_columnData, IIAPI_DESCRIPTOR * para
 **                      Add function documentation.
 */
 VALUE
-processIntField (IIAPI_DATAVALUE * param_columnData)
+processIntField (II_CONN * ii_conn, IIAPI_DATAVALUE * param_columnData)
 {
   VALUE ret_val;
   char function_name[] = "processIntField";
@@ -2620,7 +3842,7 @@ processIntField (IIAPI_DATAVALUE * param_columnData)
         ("%s: Bad size for IIAPI_INT_TYPE. The size %d is invalid. Returning NULL.\n",
          function_name, param_columnData->dv_length);
       /* if the data size is zero, this is a NULL value. */
-      ret_val = rb_str_new2 ("NULL");
+      ret_val = processNullField (ii_conn);
       break;
   }
 
@@ -2631,7 +3853,7 @@ processIntField (IIAPI_DATAVALUE * param_columnData)
 
 
 VALUE
-processFloatField (IIAPI_DATAVALUE * param_columnData)
+processFloatField (II_CONN * ii_conn, IIAPI_DATAVALUE * param_columnData)
 {
   VALUE ret_val;
   char function_name[] = "processFloatField";
@@ -2655,7 +3877,7 @@ processFloatField (IIAPI_DATAVALUE * param_columnData)
         printf
         ("%s: Bad size for IIAPI_FLT_TYPE. The size %d is invalid. Valid sizes are 4 and 8. Returning NULL.",
          function_name, param_columnData->dv_length);
-      ret_val = rb_str_new2 ("NULL");;
+      ret_val = processNullField (ii_conn);
       break;
   }
 
@@ -2665,15 +3887,45 @@ processFloatField (IIAPI_DATAVALUE * param_columnData)
 }
 
 
+/*
+**      processMoneyField() - Convert an Ingres MONEY value
+**
+**      Description -
+**              MONEY is held as a double counting cents, which is always a
+**              whole number.  Depending on the connection's :money option
+**              it is returned as a Float of the amount (the default), an
+**              exact BigDecimal with a scale of 2 or an Integer count of
+**              cents.
+*/
 VALUE
-processMoneyField (IIAPI_DATAVALUE * param_columnData)
+processMoneyField (II_CONN *ii_conn, IIAPI_DATAVALUE * param_columnData)
 {
   VALUE ret_val;
+  II_FLOAT8 money;
+  long long cents;
+  char digits[32];
+  int length;
   char function_name[] = "processMoneyField";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  ret_val = rb_float_new ((double) * ((II_FLOAT8 *) param_columnData->dv_value) / 100.00);
+  memcpy (&money, param_columnData->dv_value, sizeof (II_FLOAT8));
+  cents = (long long) (money + (money < 0 ? -0.5 : 0.5));
+
+  switch (ii_conn->moneyMode)
+  {
+    case INGRES_MONEY_CENTS:
+      ret_val = LL2NUM (cents);
+      break;
+
+    case INGRES_MONEY_DECIMAL:
+      length = sprintf (digits, "%s%lld.%02lld", cents < 0 ? "-" : "", llabs (cents) / 100, llabs (cents) % 100);
+      ret_val = ii_big_decimal (digits, length);
+      break;
+
+    default:
+      ret_val = rb_float_new (money / 100.00);
+  }
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -2682,27 +3934,35 @@ processMoneyField (IIAPI_DATAVALUE * param_columnData)
 
 
 
+/* Trim trailing blanks from a value already copied into the scratch area */
 VALUE
-processCharField (char *param_char_field, int param_char_length)
+processTrimmedField (char *param_char_field, int param_char_length)
 {
-  VALUE ret_val = (VALUE)FALSE;
   int trimmed_len = 0;
+
+  param_char_field[param_char_length] = '\0';
+  trimmed_len = STtrmwhite (param_char_field);
+  return rb_str_new (param_char_field, trimmed_len);
+}
+
+
+VALUE
+processCharField (II_CONN *ii_conn, char *param_char_field, int param_char_length)
+{
+  VALUE ret_val = (VALUE)FALSE;
   char *newstring = NULL;
   char function_name[] = "processCharField";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  newstring = (char *) ALLOC_N(char, param_char_length + 1);
+  newstring = ii_arena_scratch (ii_conn, param_char_length + 1);
   memcpy (newstring, param_char_field, param_char_length);
-  newstring[param_char_length] = '\0';
 
   /* remove any trailing blanks */
-  trimmed_len = STtrmwhite (newstring);
-  newstring[trimmed_len] = '\0';
-  ret_val = rb_str_new (newstring, trimmed_len);
+  ret_val = processTrimmedField (newstring, param_char_length);
 
   if (ii_globals.debug)
-    printf ("oldchar is >>%s<<, newchar is >>%s<<\n", param_char_field, RSTRING_PTR (ret_val));
+    printf ("newchar is >>%s<<\n", RSTRING_PTR (ret_val));
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -2714,23 +3974,18 @@ VALUE
 processStringField (char *param_varchar_field, int param_varchar_length)
 {
   VALUE result_value;
-  int i;
-  char *newstring = ALLOC_N (char, param_varchar_length - 1);
+  int string_length = 0;
   char function_name[] = "processStringField";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  /* the first two bytes holds the length. */
-  /* since we already have that, we don't need it, */
-  /* so we just skip over that information. */
-  memcpy (newstring, param_varchar_field + 2, param_varchar_length - 2);
-
-  if (ii_globals.debug)
-    printf ("oldstring is >>%s<<, newstring is >>%s<<\n", param_varchar_field,
-            newstring);
+  /* the first two bytes holds the length of the data that follows */
+  string_length = *((II_UINT2 *) param_varchar_field);
+  if (string_length > param_varchar_length - 2)
+    string_length = param_varchar_length - 2;
 
   /* make a Ruby value out of the result */
-  result_value = rb_str_new (newstring, param_varchar_length - 2);
+  result_value = rb_str_new (param_varchar_field + 2, string_length);
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -2739,30 +3994,35 @@ processStringField (char *param_varchar_field, int param_varchar_length)
 }
 
 VALUE
-processUTF16StringField (char *param_nvarchar_field,
+processUTF16StringField (II_CONN *ii_conn, char *param_nvarchar_field,
                          int param_nvarchar_length)
 {
   VALUE result_value;
-  int i, ret_val;
+  long ucs2strlen;
   long utf8strlen;
   unsigned char *utf8str = NULL;
   char function_name[] = "processUTF16StringField";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  utf8strlen = param_nvarchar_length * 4;
-  utf8str = ALLOC_N (char, utf8strlen + 3);
+  /* the first two bytes holds the length in UCS2 characters */
+  ucs2strlen = *((II_UINT2 *) param_nvarchar_field) * sizeof (UCS2);
+  if (ucs2strlen > param_nvarchar_length - 2)
+    ucs2strlen = param_nvarchar_length - 2;
+
+  utf8strlen = ucs2strlen * 2;
+  utf8str = (unsigned char *) ii_arena_scratch (ii_conn, utf8strlen + 1);
 
   if (utf16_to_utf8
       ((UCS2 *) (param_nvarchar_field + 2),
-       (UCS2 *) (param_nvarchar_field + param_nvarchar_length),
-       (char *) (utf8str + 2), (char *) (utf8str + utf8strlen + 2),
+       (UCS2 *) (param_nvarchar_field + 2 + ucs2strlen),
+       (char *) utf8str, (char *) (utf8str + utf8strlen),
        &utf8strlen))
     rb_raise (rb_eRuntimeError,
               "Transcode of UTF16 %s, string to UTF failed.",
               param_nvarchar_field);
 
-  result_value = processStringField (utf8str, utf8strlen + 2);
+  result_value = rb_str_new ((char *) utf8str, utf8strlen);
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -2772,7 +4032,7 @@ processUTF16StringField (char *param_nvarchar_field,
 
 
 VALUE
-processUTF16CharField (char *param_nchar_field, int param_nchar_length)
+processUTF16CharField (II_CONN *ii_conn, char *param_nchar_field, int param_nchar_length)
 {
   VALUE result_value;
   long utf8strlen;
@@ -2781,13 +4041,13 @@ processUTF16CharField (char *param_nchar_field, int param_nchar_length)
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  utf8strlen = param_nchar_length * 4;
-  utf8str = ALLOC_N (char, utf8strlen + 1);
+  utf8strlen = param_nchar_length * 2;
+  utf8str = (unsigned char *) ii_arena_scratch (ii_conn, utf8strlen + 1);
 
   if (utf16_to_utf8 ((UCS2 *) param_nchar_field, (UCS2 *) (param_nchar_field + param_nchar_length), (char *) utf8str, (char *) (utf8str + utf8strlen), &utf8strlen))
     rb_raise (rb_eRuntimeError, "Transcode of UTF16 %s, char to UTF failed.", param_nchar_field);
 
-  result_value = processCharField (utf8str, utf8strlen);
+  result_value = processTrimmedField ((char *) utf8str, utf8strlen);
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -2797,7 +4057,7 @@ processUTF16CharField (char *param_nchar_field, int param_nchar_length)
 
 
 VALUE
-processUTF16LOBField (char *param_nlob_field, int param_nlob_length)
+processUTF16LOBField (II_CONN *ii_conn, char *param_nlob_field, int param_nlob_length)
 {
   VALUE result_value;
   long utf8strlen;
@@ -2806,8 +4066,8 @@ processUTF16LOBField (char *param_nlob_field, int param_nlob_length)
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  utf8strlen = param_nlob_length * 4;
-  utf8str = ALLOC_N (char, utf8strlen + 1);
+  utf8strlen = param_nlob_length * 2;
+  utf8str = (unsigned char *) ii_arena_scratch (ii_conn, utf8strlen + 1);
 
   if (utf16_to_utf8
       ((UCS2 *) param_nlob_field,
@@ -2816,7 +4076,7 @@ processUTF16LOBField (char *param_nlob_field, int param_nlob_length)
     rb_raise (rb_eRuntimeError, "Transcode of UTF16 %s, char to UTF failed.",
               param_nlob_field);
 
-  result_value = rb_str_new (utf8str, utf8strlen);
+  result_value = rb_str_new ((char *) utf8str, utf8strlen);
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -2876,21 +4136,29 @@ processField (II_CONN * ii_conn, RUBY_IIAPI_DATAVALUE * param_columnData, int pa
       /* I followed the Ingres doc for these types */
       /* anything listed as a char * will be treated as varchar or text */
     case IIAPI_NVCH_TYPE:
-      ret_val = processUTF16StringField (dataValue->dv_value, param_columnData->dv_length);
+      ret_val = processUTF16StringField (ii_conn, dataValue->dv_value, param_columnData->dv_length);
       break;
 
     case IIAPI_LNVCH_TYPE:
-      ret_val = processUTF16LOBField (dataValue->dv_value, param_columnData->dv_length);
+      ret_val = processUTF16LOBField (ii_conn, dataValue->dv_value, param_columnData->dv_length);
       break;
 
     case IIAPI_LBYTE_TYPE:
     case IIAPI_LVCH_TYPE:
-      ret_val = processLOBField (dataValue->dv_value, param_columnData->dv_length);
-      break;
-
+      /* hand over the String the segments were assembled in */
+      if (param_columnData->lobValue)
+      {
+        ret_val = param_columnData->lobValue;
+        param_columnData->lobValue = 0;
+        break;
+      }
+      /* fixed length binary values have no length prefix */
     case IIAPI_BYTE_TYPE:
     case IIAPI_LOGKEY_TYPE:
     case IIAPI_TABKEY_TYPE:
+      ret_val = processLOBField (dataValue->dv_value, param_columnData->dv_length);
+      break;
+
     case IIAPI_VBYTE_TYPE:
       /* tested */
     case IIAPI_TXT_TYPE:
@@ -2899,15 +4167,17 @@ processField (II_CONN * ii_conn, RUBY_IIAPI_DATAVALUE * param_columnData, int pa
       break;
 
     case IIAPI_INT_TYPE:
-      ret_val = processIntField (dataValue);
+      ret_val = processIntField (ii_conn, dataValue);
       break;
 
     case IIAPI_DEC_TYPE:
-      ret_val = processDecimalField (dataValue, param_descrParm);
+      ret_val = ii_conn->nativeDecimals ? processPackedDecimalField (dataValue, param_descrParm) : Qundef;
+      if (ret_val == Qundef)
+        ret_val = processDecimalField (dataValue, param_descrParm);
       break;
 
     case IIAPI_FLT_TYPE:
-      ret_val = processFloatField (dataValue);
+      ret_val = processFloatField (ii_conn, dataValue);
       break;
 
     case IIAPI_DTE_TYPE:
@@ -2922,21 +4192,31 @@ processField (II_CONN * ii_conn, RUBY_IIAPI_DATAVALUE * param_columnData, int pa
     case IIAPI_INTYM_TYPE:
     case IIAPI_INTDS_TYPE:
 #endif
-      ret_val = processDateField (dataValue, param_dataType);
+      ret_val = ii_conn->nativeDates ? processNativeDateField (dataValue, param_dataType) : Qundef;
+      if (ret_val == Qundef)
+        ret_val = processDateField (ii_conn, dataValue, param_dataType);
       break;
 
     case IIAPI_MNY_TYPE:
-      ret_val = processMoneyField (dataValue);
+      ret_val = processMoneyField (ii_conn, dataValue);
+      break;
+
+#if defined(IIAPI_QF_LOCATORS)
+    case IIAPI_LBLOC_TYPE:
+    case IIAPI_LCLOC_TYPE:
+    case IIAPI_LNLOC_TYPE:
+      ret_val = ii_lob_new (ii_conn, dataValue, param_dataType);
       break;
+#endif
 
     case IIAPI_NCHA_TYPE:
-      ret_val = processUTF16CharField (dataValue->dv_value, param_columnData->dv_length);
+      ret_val = processUTF16CharField (ii_conn, dataValue->dv_value, param_columnData->dv_length);
       break;
 
     case IIAPI_CHR_TYPE:
     case IIAPI_CHA_TYPE:
     default:
-      ret_val = processCharField ((char *)dataValue->dv_value, param_columnData->dv_length);
+      ret_val = processCharField (ii_conn, (char *)dataValue->dv_value, param_columnData->dv_length);
   }
 
   if (ii_globals.debug)
@@ -2945,17 +4225,88 @@ processField (II_CONN * ii_conn, RUBY_IIAPI_DATAVALUE * param_columnData, int pa
 }
 
 
+int
+isLOBType (IIAPI_DT_ID param_dataType)
+{
+  return (param_dataType == IIAPI_LVCH_TYPE ||
+          param_dataType == IIAPI_LBYTE_TYPE ||
+          param_dataType == IIAPI_LNVCH_TYPE);
+}
+
+
+/*
+**      ii_lob_sink_write() - Pass a LOB segment to the :lob_sink option
+**
+**      Description -
+**              The sink is either called with each segment, if it responds
+**              to call, or has the segment written to it.  long nvarchar
+**              segments are converted to UTF-8 first, on whole code points:
+**              a high surrogate, or odd byte, at the end of a segment is
+**              carried over to the next one.  param_last is set for the
+**              last segment of the value, which flushes anything carried.
+**
+**      Returns -
+**              The number of bytes passed to the sink.
+*/
+long
+ii_lob_sink_write (II_CONN *ii_conn, RUBY_IIAPI_DATAVALUE *param_columnData, char *param_segment, long param_segmentLen, II_LONG param_columnType, int param_last)
+{
+  static ID id_call = 0, id_write = 0;
+  VALUE sink = param_columnData->lobSink;
+  VALUE segment;
+  VALUE units;
+  long unitsLen;
+  II_UINT2 lastUnit;
+
+  if (!id_call)
+  {
+    id_call = rb_intern ("call");
+    id_write = rb_intern ("write");
+  }
+
+  if (param_columnType == IIAPI_LNVCH_TYPE)
+  {
+    units = rb_str_buf_new (param_columnData->lobCarryLen + param_segmentLen);
+    rb_str_cat (units, param_columnData->lobCarry, param_columnData->lobCarryLen);
+    rb_str_cat (units, param_segment, param_segmentLen);
+    unitsLen = RSTRING_LEN (units) & ~1L;
+
+    if (!param_last && unitsLen >= 2)
+    {
+      memcpy (&lastUnit, RSTRING_PTR (units) + unitsLen - 2, 2);
+      if (lastUnit >= 0xD800 && lastUnit <= 0xDBFF)
+        unitsLen -= 2;
+    }
+
+    param_columnData->lobCarryLen = param_last ? 0 : (int) (RSTRING_LEN (units) - unitsLen);
+    memcpy (param_columnData->lobCarry, RSTRING_PTR (units) + unitsLen, param_columnData->lobCarryLen);
+
+    if (unitsLen == 0)
+      return 0;
+    segment = processUTF16LOBField (ii_conn, RSTRING_PTR (units), unitsLen);
+    RB_GC_GUARD(units);
+  }
+  else if (param_segmentLen > 0)
+    segment = rb_str_new (param_segment, param_segmentLen);
+  else
+    return 0;
+
+  if (rb_respond_to (sink, id_call))
+    rb_funcall (sink, id_call, 1, segment);
+  else
+    rb_funcall (sink, id_write, 1, segment);
+  return RSTRING_LEN (segment);
+}
+
+
 int getColumn (II_CONN  *ii_conn, RUBY_IIAPI_DATAVALUE * param_columnData, II_LONG param_columnType)
 {
   IIAPI_GETCOLPARM getColParm;
   IIAPI_DATAVALUE *dataValue = param_columnData->dataValue;
   int status = 0;
   long bufferLen = 0;
-  char *buffer = NULL;
-  char *bufferPtr = NULL;
   char function_name[] = "getColumn";
   short int segmentLen = 0;
-  char *lob_data = NULL;
 
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
@@ -2974,7 +4325,7 @@ int getColumn (II_CONN  *ii_conn, RUBY_IIAPI_DATAVALUE * param_columnData, II_LO
     dataValue->dv_length = 0;
 
     IIapi_getColumns (&getColParm);
-    ii_sync (&(getColParm.gc_genParm));
+    ii_sync_query (ii_conn, &(getColParm.gc_genParm));
     if (ii_checkError (&(getColParm.gc_genParm)))
     {
       memset (dataValue, 0, sizeof (IIAPI_DATAVALUE));
@@ -3003,36 +4354,39 @@ int getColumn (II_CONN  *ii_conn, RUBY_IIAPI_DATAVALUE * param_columnData, II_LO
       /* of the data fetched from the server */
       memcpy ((char *) &segmentLen, dataValue->dv_value, 2);
 
-      if (buffer == NULL)
+      /* Pass each segment straight on when streaming to a sink */
+      if (param_columnData->lobSink)
       {
-        /* Init buffer to place LOB data */
-        buffer = ii_allocate(LOB_SEGMENT_SIZE, sizeof(char *));
-        bufferPtr = buffer;
+        if (dataValue->dv_null == FALSE)
+          bufferLen += ii_lob_sink_write (ii_conn, param_columnData, (char *)dataValue->dv_value + 2, segmentLen, param_columnType, !getColParm.gc_moreSegments);
+        /* the row gets the number of bytes actually written */
+        param_columnData->dv_length = bufferLen;
+        continue;
       }
-      else
+
+      /*
+      ** Assemble the segments in a Ruby String.  rb_str_cat() doubles
+      ** the capacity as needed, so a large LOB costs a logarithmic
+      ** number of reallocations, and processField() can return the
+      ** String itself without another copy.
+      */
+      if (dataValue->dv_null == FALSE && segmentLen > 0)
       {
-        /*
-        ** TODO Improve performance by not reallocating new larger
-        ** buffer for every lob segment (approx 4K bytes each).  See
-        ** Ingres ODBC driver for more efficient algorithm.
-        */
-        buffer = ii_reallocate (buffer, bufferLen + segmentLen + 1, sizeof(char));
-        bufferPtr = buffer + bufferLen;
+        if (!param_columnData->lobValue)
+          param_columnData->lobValue = rb_str_buf_new (getColParm.gc_moreSegments ? segmentLen * 2 : segmentLen);
+        rb_str_cat (param_columnData->lobValue, (char *)dataValue->dv_value + 2, segmentLen);
+        bufferLen += segmentLen;
       }
-      memcpy (bufferPtr, (char *)dataValue->dv_value + 2, segmentLen);
-      bufferLen += segmentLen;
       param_columnData->dv_length = bufferLen;
     }
   }
   while (getColParm.gc_moreSegments);
 
-  if (buffer != NULL)   /* If blob col, return alloc'd buffer */
+  if (isLOBType (param_columnType) && !param_columnData->lobSink)   /* If blob col, return the assembled value */
   {
-    if (dataValue->dv_value)
-    {
-      ii_free((void **) &(dataValue->dv_value));
-    }
-    dataValue->dv_value = buffer;
+    if (!param_columnData->lobValue)
+      param_columnData->lobValue = rb_str_buf_new (0);
+    dataValue->dv_value = RSTRING_PTR (param_columnData->lobValue);
   }
 
   if (ii_globals.debug)
@@ -3042,27 +4396,35 @@ int getColumn (II_CONN  *ii_conn, RUBY_IIAPI_DATAVALUE * param_columnData, II_LO
 
 
 int
-processColumn (II_CONN *ii_conn, VALUE * param_values, int param_columnNumber, IIAPI_DESCRIPTOR * param_descrParm)
+processColumn (II_CONN *ii_conn, VALUE * param_values, int param_columnNumber, IIAPI_DESCRIPTOR * param_descrParm, II_QUERY_OPTIONS * param_options)
 {
-  RUBY_IIAPI_DATAVALUE columnData = {FALSE, 0, NULL};
+  RUBY_IIAPI_DATAVALUE columnData = {{{FALSE, 0, NULL}}, 0, 0, 0, {0}, 0};
   int done = FALSE;
-  char *tmp = NULL;
   char function_name[] = "processColumn";
 
 
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  /* Allocate storage space for incoming data */
-  tmp = (char *) ii_allocate(param_descrParm->ds_length + 1, sizeof(char));
-  memset (tmp, 0, param_descrParm->ds_length + 1);
-  columnData.dataValue[0].dv_value = tmp;
+  /* Fetch into the arena slot for this column of the first row */
+  columnData.dataValue[0].dv_value = ii_conn->arena.columnData[param_columnNumber].dv_value;
+  columnData.lobSink = param_options->lobSink;
 
   if (getColumn (ii_conn, &columnData, param_descrParm->ds_dataType ) >= IIAPI_ST_NO_DATA)
   {
     /* we've reached the end of the data */
     done = TRUE;
   }
+  else if (param_options->result)
+  {
+    /* keep the raw value, converted when it is accessed */
+    ii_result_add_cell (param_options->result, &columnData.dataValue[0], columnData.dv_length, param_descrParm);
+  }
+  else if (columnData.lobSink)
+  {
+    /* the value went to the sink, the row gets the number of bytes written */
+    rb_ary_push ((*param_values), columnData.dataValue[0].dv_null ? processNullField (ii_conn) : LONG2NUM (columnData.dv_length));
+  }
   else
   {
     /* let's copy out and convert the data */
@@ -3073,7 +4435,7 @@ processColumn (II_CONN *ii_conn, VALUE * param_values, int param_columnNumber, I
       /* this is a null value. Don't try to convert it. */
       if (ii_globals.debug)
         printf ("\nFound a NULL value\n");
-      nextEntry = rb_str_new2 ("NULL");
+      nextEntry = processNullField (ii_conn);
     }
     else
     {
@@ -3083,253 +4445,3643 @@ processColumn (II_CONN *ii_conn, VALUE * param_values, int param_columnNumber, I
     rb_ary_push ((*param_values), nextEntry);
   }
 
-  if (tmp)
-  {
-    ii_free((void **) &(columnData.dataValue[0].dv_value));
-  }
-
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
   return done;
 }
 
 
-void
-ii_api_get_data (II_CONN *ii_conn, IIAPI_GETDESCRPARM * param_descrParm)
+/*
+**      getFetchRowCount() - Number of rows to request per IIapi_getColumns()
+**
+**      Description -
+**              OpenAPI only allows one row per call when the result
+**              contains a LOB column, as LOB values are returned in
+**              segments.  Otherwise use the caller's value or size the
+**              block so that it holds roughly FETCH_BUFFER_SIZE bytes.
+*/
+II_INT2
+getFetchRowCount (IIAPI_GETDESCRPARM * param_descrParm, II_INT2 param_fetchRows)
 {
-  int done = FALSE;
-  char function_name[] = "ii_api_get_data";
+  long rowLength = 0;
+  long rowCount = 0;
+  int i;
+  char function_name[] = "getFetchRowCount";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  /* loop until all rows are fetched */
-  while (!done)
+  for (i = 0; i < param_descrParm->gd_descriptorCount; i++)
   {
-    VALUE values;
-    int columnCount = 0;
-
-    values = rb_ary_new ();
+    if (isLOBType (param_descrParm->gd_descriptor[i].ds_dataType))
+      return 1;
+    rowLength += param_descrParm->gd_descriptor[i].ds_length;
+  }
 
-    while (columnCount < param_descrParm->gd_descriptorCount && !done)
-    {
-      done = processColumn (ii_conn, &values, columnCount, &(param_descrParm->gd_descriptor[columnCount]));
-      columnCount++;
-    }
+  if (param_fetchRows > 0)
+    rowCount = param_fetchRows;
+  else
+    rowCount = FETCH_BUFFER_SIZE / (rowLength > 0 ? rowLength : 1);
 
-    if (!done)
-    {
-      rb_ary_push (ii_conn->resultset, values);
-    }
-  }
+  if (rowCount < 1)
+    rowCount = 1;
+  if (rowCount > MAX_FETCH_ROWS)
+    rowCount = MAX_FETCH_ROWS;
 
   if (ii_globals.debug)
-    printf ("Exiting %s.\n", function_name);
+    printf ("Exiting %s, returning %li.\n", function_name, rowCount);
+  return (II_INT2) rowCount;
 }
 
 
-VALUE
-ii_execute_query (II_CONN *ii_conn, char *param_sqlText, int param_argc, VALUE param_params)
+/* Fetch up to param_rowCount rows of param_columnCount non-LOB columns in one call.
+ * param_columnData holds param_rowCount * param_columnCount values, row by row.
+ */
+int
+getColumns (II_CONN *ii_conn, IIAPI_DATAVALUE * param_columnData, II_INT2 param_rowCount, II_INT2 param_columnCount, II_INT2 * param_rowsReturned)
 {
-  IIAPI_GETDESCRPARM getDescrParm;
-  IIAPI_WAITPARM waitParm = { -1 };
-  VALUE ret_val;
-  char function_name[] = "ii_execute_query";
+  IIAPI_GETCOLPARM getColParm;
+  char function_name[] = "getColumns";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  if (ii_globals.debug)
-    printf ("\n AUTOCOMMIT_ON = %d\n", ii_conn->autocommit);
+  getColParm.gc_genParm.gp_callback = NULL;
+  getColParm.gc_genParm.gp_closure = NULL;
+  getColParm.gc_rowCount = param_rowCount;
+  getColParm.gc_columnCount = param_columnCount;
+  getColParm.gc_rowsReturned = 0;
+  getColParm.gc_columnData = param_columnData;
+  getColParm.gc_stmtHandle = ii_conn->stmtHandle;
+  getColParm.gc_moreSegments = 0;
+
+  IIapi_getColumns (&getColParm);
+  ii_sync_query (ii_conn, &(getColParm.gc_genParm));
+  if (ii_checkError (&(getColParm.gc_genParm)))
+  {
+    rb_raise (rb_eRuntimeError, "IIapi_getColumns() failed.");
+  }
 
-  ii_api_query (ii_conn, param_sqlText, param_argc, param_params);
-  ii_api_getDescriptors (ii_conn, &getDescrParm);
+  *param_rowsReturned = getColParm.gc_rowsReturned;
 
   if (ii_globals.debug)
-    printf ("\nFound %d column(s)\n", getDescrParm.gd_descriptorCount);
+    printf ("Exiting %s, %d row(s) returned.\n", function_name, getColParm.gc_rowsReturned);
+  return getColParm.gc_genParm.gp_status;
+}
 
-  /* fetch the query results */
-  if (getDescrParm.gd_descriptorCount > 0)
+
+VALUE
+processCell (II_CONN *ii_conn, IIAPI_DATAVALUE * param_dataValue, int param_columnNumber, IIAPI_DESCRIPTOR * param_descrParm)
+{
+  RUBY_IIAPI_DATAVALUE columnData;
+
+  if (param_dataValue->dv_null == TRUE)
   {
-    init_rb_array (&ii_conn->resultset);
-    init_rb_array (&ii_conn->r_data_sizes);
-    init_rb_array (&ii_conn->r_column_names);
-    init_rb_array (&ii_conn->r_data_types);
+    if (ii_globals.debug)
+      printf ("\nFound a NULL value\n");
+    return processNullField (ii_conn);
+  }
+
+  columnData.dataValue[0] = *param_dataValue;
+  columnData.dv_length = param_dataValue->dv_length;
+  columnData.lobValue = 0;
+  return processField (ii_conn, &columnData, param_columnNumber, param_descrParm);
+}
+
+
+/*
+**      ii_result_add_cell() - Append a fetched cell to an Ingres::Result
+**
+**      Description -
+**              Copies the raw value into the result's data buffer, which
+**              is grown geometrically.  Variable length values only keep
+**              the bytes in use rather than the full column width.  Each
+**              value starts on an 8 byte boundary so numeric values can be
+**              read in place when converted.
+*/
+void
+ii_result_add_cell (II_RESULT *result, IIAPI_DATAVALUE * param_dataValue, long param_length, IIAPI_DESCRIPTOR * param_descrParm)
+{
+  II_RESULT_CELL *cell;
+  long length = param_length;
+  long offset = (result->dataLen + 7) & ~7L;
+  II_INT2 embeddedLength;
 
-    ii_api_get_metadata (ii_conn, &getDescrParm);
-    ii_api_get_data (ii_conn, &getDescrParm);
+  if (result->cellCount == result->cellCapacity)
+  {
+    result->cellCapacity = result->cellCapacity ? result->cellCapacity * 2 : 64;
+    result->cells = ii_reallocate (result->cells, result->cellCapacity, sizeof (II_RESULT_CELL));
   }
+  cell = &result->cells[result->cellCount++];
+  cell->isNull = param_dataValue->dv_null;
+  cell->offset = offset;
+  cell->length = 0;
 
-  ret_val = ii_conn->resultset;
-  global_rows_affected = getRowsAffected (ii_conn);
+  if (cell->isNull)
+    return;
 
-  ii_api_query_close (ii_conn);
+  switch (param_descrParm->ds_dataType)
+  {
+    case IIAPI_VBYTE_TYPE:
+    case IIAPI_TXT_TYPE:
+    case IIAPI_VCH_TYPE:
+      memcpy (&embeddedLength, param_dataValue->dv_value, 2);
+      if (embeddedLength >= 0 && embeddedLength + 2 < length)
+        length = embeddedLength + 2;
+      break;
+    case IIAPI_NVCH_TYPE:
+      memcpy (&embeddedLength, param_dataValue->dv_value, 2);
+      if (embeddedLength >= 0 && embeddedLength * 2 + 2 < length)
+        length = embeddedLength * 2 + 2;
+      break;
+  }
 
-  if (ii_conn->autocommit)
-    ii_api_commit (ii_conn);
+  if (offset + length + 1 > result->dataCapacity)
+  {
+    result->dataCapacity = result->dataCapacity ? result->dataCapacity * 2 : FETCH_BUFFER_SIZE;
+    if (offset + length + 1 > result->dataCapacity)
+      result->dataCapacity = offset + length + 1;
+    result->data = ii_reallocate (result->data, result->dataCapacity, sizeof (char));
+  }
+  memcpy (result->data + offset, param_dataValue->dv_value, length);
+  cell->length = length;
+  result->dataLen = offset + length;
+}
 
-  if (ii_globals.debug)
-    printf ("Exiting %s.\n", function_name);
-  return ret_val;
+
+/* Complete the current row of an Ingres::Result */
+void
+ii_result_end_row (II_RESULT *result)
+{
+  result->rowCount++;
 }
 
 
-/*
- * Document-method: execute
- *
- * call-seq:
- *    Ingres.execute(sql[ param_types, param_values]) -> Array
- *
- * Executes the supplied _sql_ statement returning the results as a
- * two-dimensional Array. The first dimension represents each row, and the 
+/* Drop the cells of a row that was only partly fetched */
+void
+ii_result_discard_row (II_RESULT *result)
+{
+  result->cellCount = result->rowCount * result->columnCount;
+}
+
+
+/* Hand a fetched row to the block for each_row(), or add it to the result set */
+void
+ii_api_store_row (II_CONN *ii_conn, VALUE param_values, II_QUERY_OPTIONS * param_options)
+{
+  long column;
+
+  if (param_options->yieldRows)
+    rb_yield (param_values);
+  else if (param_options->columnar)
+  {
+    for (column = 0; column < RARRAY_LEN(param_values); column++)
+      rb_ary_push (rb_ary_entry (param_options->columns, column), rb_ary_entry (param_values, column));
+  }
+  else
+    rb_ary_push (ii_conn->resultset, param_values);
+}
+
+
+/*
+**      processColumnBlock() - Convert one column of a block of fetched rows
+**
+**      Description -
+**              Used for columnar results.  The data type is switched on
+**              once for the column rather than once per cell, with the
+**              common fixed width and varchar types converted directly
+**              and anything else passed through processCell().
+*/
+void
+processColumnBlock (II_CONN *ii_conn, IIAPI_DATAVALUE * param_columnData, II_INT2 param_rowCount, II_INT2 param_columnCount, int param_columnNumber, IIAPI_DESCRIPTOR * param_descrParm, VALUE param_values)
+{
+  IIAPI_DATAVALUE *dataValue = &param_columnData[param_columnNumber];
+  int row;
+  char function_name[] = "processColumnBlock";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  if (param_rowCount > 0)
+    rb_ary_store (ii_conn->r_data_sizes, param_columnNumber, INT2NUM (dataValue->dv_length));
+
+  switch (param_descrParm->ds_dataType)
+  {
+    case IIAPI_INT_TYPE:
+      for (row = 0; row < param_rowCount; row++, dataValue += param_columnCount)
+        rb_ary_push (param_values, dataValue->dv_null ? processCell (ii_conn, dataValue, param_columnNumber, param_descrParm) : processIntField (ii_conn, dataValue));
+      break;
+
+    case IIAPI_FLT_TYPE:
+      for (row = 0; row < param_rowCount; row++, dataValue += param_columnCount)
+        rb_ary_push (param_values, dataValue->dv_null ? processCell (ii_conn, dataValue, param_columnNumber, param_descrParm) : processFloatField (ii_conn, dataValue));
+      break;
+
+    case IIAPI_VBYTE_TYPE:
+    case IIAPI_TXT_TYPE:
+    case IIAPI_VCH_TYPE:
+      for (row = 0; row < param_rowCount; row++, dataValue += param_columnCount)
+        rb_ary_push (param_values, dataValue->dv_null ? processCell (ii_conn, dataValue, param_columnNumber, param_descrParm) : processStringField (dataValue->dv_value, dataValue->dv_length));
+      break;
+
+    default:
+      for (row = 0; row < param_rowCount; row++, dataValue += param_columnCount)
+        rb_ary_push (param_values, processCell (ii_conn, dataValue, param_columnNumber, param_descrParm));
+  }
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+
+/*
+**      ii_api_get_data() - Fetch the result set of the current statement
+**
+**      Description -
+**              Without LOB columns whole blocks of rows are fetched per
+**              IIapi_getColumns() call.  With LOB columns a row is fetched
+**              as runs of non-LOB columns, with each LOB column in between
+**              fetched segment by segment through processColumn().
+**
+**              When param_options->maxRows is set no more than that many
+**              rows are requested from the server, so a cursor can carry
+**              on from the same point on the next call.
+**
+**              Returns TRUE once the end of the data has been reached.
+*/
+int
+ii_api_get_data (II_CONN *ii_conn, IIAPI_GETDESCRPARM * param_descrParm, II_QUERY_OPTIONS * param_options)
+{
+  IIAPI_DESCRIPTOR *descriptor = param_descrParm->gd_descriptor;
+  II_INT2 columnCount = param_descrParm->gd_descriptorCount;
+  II_INT2 rowCount = ii_conn->arena.rowCount;
+  II_INT2 rowsReturned = 0;
+  IIAPI_DATAVALUE *columnData = ii_conn->arena.columnData;
+  II_RESULT *result = param_options->result;
+  long maxRows = param_options->maxRows;
+  long rowsFetched = 0;
+  int hasLOB = FALSE;
+  int done = FALSE;
+  int row, column, lastColumn;
+  char function_name[] = "ii_api_get_data";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  for (column = 0; column < columnCount; column++)
+  {
+    if (isLOBType (descriptor[column].ds_dataType))
+      hasLOB = TRUE;
+  }
+
+  if (ii_globals.debug)
+    printf ("%s: fetching %d row(s) per call\n", function_name, rowCount);
+
+  /* loop until all rows, or all the rows asked for, are fetched */
+  while (!done && (maxRows == 0 || rowsFetched < maxRows))
+  {
+    if (!hasLOB)
+    {
+      if (maxRows > 0 && maxRows - rowsFetched < rowCount)
+        rowCount = (II_INT2) (maxRows - rowsFetched);
+
+      if (getColumns (ii_conn, columnData, rowCount, columnCount, &rowsReturned) >= IIAPI_ST_NO_DATA || rowsReturned == 0)
+        done = TRUE;
+      rowsFetched += rowsReturned;
+
+      if (param_options->columnar)
+      {
+        for (column = 0; column < columnCount; column++)
+          processColumnBlock (ii_conn, columnData, rowsReturned, columnCount, column, &descriptor[column], rb_ary_entry (param_options->columns, column));
+        continue;
+      }
+
+      for (row = 0; row < rowsReturned; row++)
+      {
+        VALUE values;
+
+        if (result)
+        {
+          for (column = 0; column < columnCount; column++)
+            ii_result_add_cell (result, &columnData[row * columnCount + column], columnData[row * columnCount + column].dv_length, &descriptor[column]);
+          ii_result_end_row (result);
+          continue;
+        }
+
+        values = rb_ary_new2 (columnCount);
+
+        for (column = 0; column < columnCount; column++)
+          rb_ary_push (values, processCell (ii_conn, &columnData[row * columnCount + column], column, &descriptor[column]));
+
+        ii_api_store_row (ii_conn, values, param_options);
+      }
+    }
+    else
+    {
+      VALUE values = result ? Qnil : rb_ary_new2 (columnCount);
+
+      column = 0;
+      while (column < columnCount && !done)
+      {
+        if (isLOBType (descriptor[column].ds_dataType))
+        {
+          done = processColumn (ii_conn, &values, column, &(descriptor[column]), param_options);
+          column++;
+          continue;
+        }
+
+        /* fetch the run of non-LOB columns up to the next LOB column */
+        lastColumn = column;
+        while (lastColumn < columnCount && !isLOBType (descriptor[lastColumn].ds_dataType))
+          lastColumn++;
+
+        if (getColumns (ii_conn, &columnData[column], 1, lastColumn - column, &rowsReturned) >= IIAPI_ST_NO_DATA || rowsReturned == 0)
+        {
+          done = TRUE;
+          break;
+        }
+        for (; column < lastColumn; column++)
+        {
+          if (result)
+            ii_result_add_cell (result, &columnData[column], columnData[column].dv_length, &descriptor[column]);
+          else
+            rb_ary_push (values, processCell (ii_conn, &columnData[column], column, &descriptor[column]));
+        }
+      }
+
+      if (done)
+      {
+        if (result)
+          ii_result_discard_row (result);
+      }
+      else
+      {
+        if (result)
+          ii_result_end_row (result);
+        else
+          ii_api_store_row (ii_conn, values, param_options);
+        rowsFetched++;
+      }
+    }
+  }
+
+  if (ii_globals.debug)
+    printf ("Exiting %s, %li row(s) fetched.\n", function_name, rowsFetched);
+  return done;
+}
+
+
+/* Check the options can be used in the connection's current state */
+static void
+ii_query_options_check (II_CONN *ii_conn, II_QUERY_OPTIONS * param_options)
+{
+  /* locators are freed at the end of the transaction, which would be before
+   * the rows were returned */
+  if (param_options->queryFlags && ii_conn->autocommit && ii_conn->cursorCount == 0)
+    rb_raise (rb_eRuntimeError, "The :lob_locators option can only be used within a transaction");
+}
+
+/*
+**      ii_execute_query_send() - Send a statement to the server
+**
+**      Description -
+**              The statement and its parameters are sent and its result
+**              descriptors asked for, without waiting for the server to
+**              run it.  ii_execute_query_finish() fetches the results once
+**              param_descrParm has completed.
+*/
+void
+ii_execute_query_send (II_CONN *ii_conn, char *param_sqlText, int param_argc, VALUE param_params, II_QUERY_OPTIONS * param_options, IIAPI_GETDESCRPARM * param_descrParm, II_API_CALLBACK param_callback, II_PTR param_closure)
+{
+  char function_name[] = "ii_execute_query_send";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  if (ii_globals.debug)
+    printf ("\n AUTOCOMMIT_ON = %d\n", ii_conn->autocommit);
+
+  ii_query_options_check (ii_conn, param_options);
+  ii_api_query (ii_conn, param_sqlText, param_argc, param_params, IIAPI_QT_QUERY, param_options);
+  ii_api_getDescriptors_send (ii_conn, param_descrParm, param_callback, param_closure);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+
+/* Fetch the results of a statement sent by ii_execute_query_send(), once
+ * its descriptors have arrived, and end the statement */
+VALUE
+ii_execute_query_finish (II_CONN *ii_conn, IIAPI_GETDESCRPARM * param_descrParm, II_QUERY_OPTIONS * param_options)
+{
+  VALUE ret_val;
+  VALUE lazy_result = Qnil;
+  int i;
+  char function_name[] = "ii_execute_query_finish";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  ii_api_getDescriptors_check (ii_conn, param_descrParm);
+
+  if (ii_globals.debug)
+    printf ("\nFound %d column(s)\n", param_descrParm->gd_descriptorCount);
+
+  /* fetch the query results */
+  if (param_descrParm->gd_descriptorCount > 0)
+  {
+    init_rb_array (&ii_conn->resultset);
+    init_rb_array (&ii_conn->r_data_sizes);
+    init_rb_array (&ii_conn->r_column_names);
+    init_rb_array (&ii_conn->r_data_types);
+
+    ii_api_get_metadata (ii_conn, param_descrParm);
+    ii_arena_init (ii_conn, param_descrParm, getFetchRowCount (param_descrParm, param_options->fetchRows));
+    if (param_options->lazy)
+      lazy_result = ii_result_new (ii_conn, param_descrParm, &param_options->result);
+    if (param_options->columnar)
+    {
+      param_options->columns = rb_ary_new2 (param_descrParm->gd_descriptorCount);
+      for (i = 0; i < param_descrParm->gd_descriptorCount; i++)
+        rb_ary_push (param_options->columns, rb_ary_new2 (ii_conn->arena.rowCount));
+    }
+    ii_api_get_data (ii_conn, param_descrParm, param_options);
+  }
+
+  if (lazy_result != Qnil)
+    ret_val = lazy_result;
+  else if (param_options->columnar)
+  {
+    ret_val = rb_hash_new ();
+    for (i = 0; i < param_descrParm->gd_descriptorCount; i++)
+      rb_hash_aset (ret_val, rb_ary_entry (ii_conn->r_column_names, i), rb_ary_entry (param_options->columns, i));
+  }
+  else
+    ret_val = ii_conn->resultset;
+  ii_conn->rowsAffected = getRowsAffected (ii_conn);
+
+  ii_api_query_close (ii_conn);
+
+  /* committing would close any cursors still open on the connection */
+  if (ii_conn->autocommit && ii_conn->cursorCount == 0)
+    ii_api_commit (ii_conn);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return ret_val;
+}
+
+
+VALUE
+ii_execute_query (II_CONN *ii_conn, char *param_sqlText, int param_argc, VALUE param_params, II_QUERY_OPTIONS * param_options)
+{
+  IIAPI_GETDESCRPARM getDescrParm;
+
+  ii_execute_query_send (ii_conn, param_sqlText, param_argc, param_params, param_options, &getDescrParm, NULL, NULL);
+  ii_sync_query (ii_conn, &(getDescrParm.gd_genParm));
+  return ii_execute_query_finish (ii_conn, &getDescrParm, param_options);
+}
+
+
+/* Fill param_options from the connection defaults, overridden by any
+ * entries in the options hash passed to execute()
+ */
+void
+ii_query_options (II_CONN *ii_conn, VALUE param_hash, II_QUERY_OPTIONS * param_options)
+{
+  VALUE option = Qnil;
+  char function_name[] = "ii_query_options";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  param_options->fetchRows = ii_conn->fetchRows;
+  param_options->yieldRows = FALSE;
+  param_options->maxRows = 0;
+  param_options->lazy = FALSE;
+  param_options->result = NULL;
+  param_options->columnar = FALSE;
+  param_options->columns = Qnil;
+  param_options->lobSink = 0;
+  param_options->queryFlags = 0;
+  param_options->timeout = ii_conn->timeout;
+
+  if (TYPE (param_hash) == T_HASH)
+  {
+    option = rb_hash_aref (param_hash, ID2SYM (rb_intern ("timeout")));
+    if (TYPE (option) != T_NIL)
+      param_options->timeout = ii_timeout_value (option);
+
+    option = rb_hash_aref (param_hash, ID2SYM (rb_intern ("fetch_rows")));
+    if (TYPE (option) != T_NIL)
+      param_options->fetchRows = ii_fetch_rows_value (option);
+
+    option = rb_hash_aref (param_hash, ID2SYM (rb_intern ("lazy")));
+    param_options->lazy = RTEST (option);
+
+    option = rb_hash_aref (param_hash, ID2SYM (rb_intern ("format")));
+    if (option == ID2SYM (rb_intern ("columns")))
+      param_options->columnar = TRUE;
+    else if (TYPE (option) != T_NIL && option != ID2SYM (rb_intern ("rows")))
+      rb_raise (rb_eArgError, "format must be :rows or :columns");
+
+    if (param_options->lazy && param_options->columnar)
+      rb_raise (rb_eArgError, "The :lazy and :format => :columns options cannot be combined");
+
+    option = rb_hash_aref (param_hash, ID2SYM (rb_intern ("lob_sink")));
+    if (TYPE (option) != T_NIL)
+    {
+      if (param_options->lazy)
+        rb_raise (rb_eArgError, "The :lazy and :lob_sink options cannot be combined");
+      param_options->lobSink = option;
+    }
+
+    option = rb_hash_aref (param_hash, ID2SYM (rb_intern ("lob_locators")));
+    if (RTEST (option))
+    {
+#if defined(IIAPI_QF_LOCATORS)
+      if (ii_conn->apiLevel < IIAPI_LEVEL_4)
+        rb_raise (rb_eRuntimeError, "LOB locators are not supported by the server, API level %d", ii_conn->apiLevel);
+      if (param_options->lobSink)
+        rb_raise (rb_eArgError, "The :lob_locators and :lob_sink options cannot be combined");
+      param_options->queryFlags = IIAPI_QF_LOCATORS;
+#else
+      rb_raise (rb_eRuntimeError, "LOB locators are not supported by this version of Ingres");
+#endif
+    }
+  }
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+/*
+ * Document-method: execute
+ *
+ * call-seq:
+ *    Ingres.execute(sql[ param_types, param_values]) -> Array
+ *
+ * Executes the supplied _sql_ statement returning the results as a
+ * two-dimensional Array. The first dimension represents each row, and the 
  * second dimension represents each column within the row. _param_types_ is
  * a string of letters, with each letter representing the type of each
  * parameter being passed.
  *
- * For SQL queries or database procedure calls that contain parameters, use the
- * Ingres.execute() method in one of the following formats.
- * For selects, inserts, deletes, and updates:
- * 
- *   execute(sql [ [, param_type, param_value ] … ] )
- * 
- * For database procedure calls:
- * 
- *   execute("{ <call> | <execute procedure> procedure_name [ (column_name = ? [
- *   [ , column_name = ? ] … ] ) ] }" [ [ , column_name, param_type, param_value
- *   ] … ] )
- * 
- * where parameters in the sql text are represented by question marks (?) and
- * there is one set of param_type/param_value entries for each one.
- * param_type must be one of the following single characters:
- * 
- * <table>
- * <tr><td>*param_type*<td>*Description*
- * <tr><td>b<td>byte
- * <tr><td>B<td>long_byte
- * <tr><td>c<td>char
- * <tr><td>d<td>date
- * <tr><td>D<td>decimal
- * <tr><td>f<td>float
- * <tr><td>i<td>integer
- * <tr><td>n<td>nchar
- * <tr><td>N<td>nvarchar
- * <tr><td>t<td>text
- * <tr><td>T<td>long_text
- * <tr><td>v<td>varchar
- * <tr><td>V<td>long_varchar
- * </table>
- * 
- * param_value should correspond to the expected type being sent.
- * 
+ * For SQL queries or database procedure calls that contain parameters, use the
+ * Ingres.execute() method in one of the following formats.
+ * For selects, inserts, deletes, and updates:
+ * 
+ *   execute(sql [ [, param_type, param_value ] … ] )
+ * 
+ * For database procedure calls:
+ * 
+ *   execute("{ <call> | <execute procedure> procedure_name [ (column_name = ? [
+ *   [ , column_name = ? ] … ] ) ] }" [ [ , column_name, param_type, param_value
+ *   ] … ] )
+ * 
+ * where parameters in the sql text are represented by question marks (?) and
+ * there is one set of param_type/param_value entries for each one.
+ * param_type must be one of the following single characters:
+ * 
+ * <table>
+ * <tr><td>*param_type*<td>*Description*
+ * <tr><td>b<td>byte
+ * <tr><td>B<td>long_byte
+ * <tr><td>c<td>char
+ * <tr><td>d<td>date
+ * <tr><td>D<td>decimal
+ * <tr><td>f<td>float
+ * <tr><td>i<td>integer
+ * <tr><td>n<td>nchar
+ * <tr><td>N<td>nvarchar
+ * <tr><td>t<td>text
+ * <tr><td>T<td>long_text
+ * <tr><td>v<td>varchar
+ * <tr><td>V<td>long_varchar
+ * </table>
+ * 
+ * param_value should correspond to the expected type being sent.
+ * 
+ * A Hash may be passed as the last argument to override connection settings
+ * for this call only. Valid hash keys are:
+ *
+ * * <tt>:fetch_rows</tt> - number of rows fetched from the server per call,
+ *   see fetch_rows=
+ * * <tt>:timeout</tt> - seconds the statement may run for before it is
+ *   cancelled and Ingres::TimeoutError raised, see timeout=
+ * * <tt>:lazy</tt> - when true a SELECT returns an Ingres::Result holding the
+ *   fetched data as it came from the server, values are only converted to
+ *   Ruby objects as they are accessed
+ * * <tt>:format</tt> - <tt>:rows</tt> (the default) or <tt>:columns</tt>, which
+ *   returns a SELECT as a Hash of column name => Array of that column's
+ *   values instead of an Array of rows
+ * * <tt>:lob_sink</tt> - an IO, or anything responding to +write+ or +call+,
+ *   that long varchar, long byte and long nvarchar values are streamed to
+ *   a segment at a time. The values are never held in memory in full, the
+ *   row holds the number of bytes written instead
+ * * <tt>:lob_locators</tt> - when true long varchar, long byte and long
+ *   nvarchar values are returned as Ingres::Lob objects holding a locator,
+ *   the value itself is only read from the server when asked for. Needs a
+ *   server at API level 4 or later, and as locators are freed at the end
+ *   of the transaction they can only be used within a transaction
+ *
+ * Example usage:
+ *
+ *   conn = Ingres.new()
+ *   conn.connect(:database => "demodb")
+ *   results = conn.execute("select up_first, up_last, up_email from user_profile where up_id = ?", "i", 1)
+ *   results = conn.execute("select * from airport", :fetch_rows => 500)
+ *   results = conn.execute("select * from airport", :timeout => 2.5)
+ *   codes = conn.execute("select * from airport", :lazy => true).column("ap_iatacode")
+ *   columns = conn.execute("select ap_iatacode, ap_place from airport", :format => :columns)
+ *   columns["ap_place"].uniq
+ *   File.open("image.png", "wb") do |file|
+ *     conn.execute("select up_image from user_profile where up_id = ?", "i", 1, :lob_sink => file)
+ *   end
+ *
+ */
+VALUE
+ii_execute (int param_argc, VALUE * param_argv, VALUE param_self)
+{
+  VALUE ret_val = Qnil;
+  VALUE param_queryText;
+  VALUE params;
+  VALUE savePtName;
+  VALUE options = Qnil;
+  II_QUERY_OPTIONS queryOptions;
+  int i;
+  char function_name[] = "ii_execute";
+  II_CONN *ii_conn;
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  rb_scan_args (param_argc, param_argv, "1*", &param_queryText, &params);
+
+  Check_Type(param_queryText, T_STRING);
+
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+  ii_async_check_idle (ii_conn);
+
+  /* A trailing hash holds options for this call, not a parameter value */
+  if (RARRAY_LEN(params) > 0 && TYPE (rb_ary_entry (params, -1)) == T_HASH)
+    options = rb_ary_pop (params);
+  ii_query_options (ii_conn, options, &queryOptions);
+
+  /* determine what sort of query is being executed */
+  if (ii_globals.debug)
+    printf ("Classifying query\n");
+  ii_conn->queryType = ii_query_type(RSTRING_PTR (param_queryText));
+  if (ii_globals.debug)
+    printf ("Classified query\n");
+
+  switch (ii_conn->queryType)
+  {
+    case INGRES_SQL_COMMIT:
+      if (ii_conn->tranHandle != NULL)
+        ii_api_commit (ii_conn);
+      else if (ii_globals.debug || ii_globals.debug_transactions)
+        rb_warn ("Attempting to ii_api_commit a non-existent transaction");
+      break;
+    case INGRES_SQL_ROLLBACK:
+      if (ii_conn->tranHandle != NULL)
+        ii_api_rollback (ii_conn, NULL);
+      else if (ii_globals.debug || ii_globals.debug_transactions)
+        rb_warn ("Attempting to ii_api_rollback a non-existent transaction");
+      break;
+    case INGRES_SQL_ROLLBACK_TO:
+    case INGRES_SQL_ROLLBACK_WORK_TO:
+      /* ROLLBACK [WORK] TO SAVEPOINT */
+      if (ii_conn->tranHandle == NULL)
+      {
+        rb_raise (rb_eRuntimeError, "Unable to rollback a non-existent transaction");
+      }
+      else
+      {
+        /* Extract Savepoint name */
+        savePtName = ii_savepoint_name(ii_conn, StringValuePtr(param_queryText));
+        ii_rollback (1, &savePtName, param_self);
+      }
+      break;
+    case INGRES_START_TRANSACTION:
+      startTransaction (param_self);
+      break;
+    case INGRES_SQL_CONNECT:
+      rb_warn ("Use connect() to connect to a database");
+      break;
+    case INGRES_SQL_DISCONNECT:
+      rb_warn ("Use disconnect() to disconnect from a database");
+      break;
+    case INGRES_SQL_GETDBEVENT:
+      rb_warn ("Ingres 'GET DBEVENT' is not supported at the current time");
+      break;
+    case INGRES_SQL_SAVEPOINT:
+      /* We cannot generate a save point if there is no transaction or if auto commit is in effect */
+      if (ii_conn->tranHandle == NULL)
+      {
+        rb_raise (rb_eRuntimeError, "Unable to generate a save point if there is no active transaction");
+      }
+      else
+      {
+        /* Extract Savepoint name */
+        savePtName = ii_savepoint_name(ii_conn, StringValuePtr(param_queryText));
+        ii_api_savepoint (ii_conn, savePtName);
+      }
+      break;
+    case INGRES_SQL_AUTOCOMMIT:
+      rb_warn ("Use autocommit() to set the auto-commit state");
+      break;
+    case INGRES_SQL_COPY:
+      rb_warn ("Ingres 'COPY TABLE() INTO/FROM' is not supported by execute, use copy_in() to load a table");
+      break;
+    case INGRES_SQL_SELECT:
+    case INGRES_SQL_INSERT:
+    case INGRES_SQL_UPDATE:
+    case INGRES_SQL_DELETE:
+    case INGRES_SQL_CREATE:
+    case INGRES_SQL_ALTER:
+    case INGRES_SQL_EXECUTE_PROCEDURE:
+    case INGRES_SQL_CALL:
+    default:
+      if (ii_globals.debug || ii_globals.debug_transactions)
+        printf ("Executing %s\n", StringValuePtr (param_queryText));
+      ret_val = ii_execute_query (ii_conn, StringValuePtr (param_queryText), RARRAY_LEN(params), params, &queryOptions);
+      break;
+  }
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return ret_val;
+}
+
+static VALUE
+ii_each_row_fetch (VALUE param_args)
+{
+  II_EACH_ROW_ARGS *args = (II_EACH_ROW_ARGS *) param_args;
+  II_CONN *ii_conn = args->ii_conn;
+
+  /* sent in here so that a failure is cleaned up by ii_each_row_close() */
+  ii_api_query (ii_conn, StringValuePtr (args->queryText), RARRAY_LEN(args->params), args->params, IIAPI_QT_QUERY, args->options);
+  ii_api_getDescriptors (ii_conn, args->descrParm);
+
+  if (args->descrParm->gd_descriptorCount > 0)
+  {
+    init_rb_array (&ii_conn->r_data_sizes);
+    init_rb_array (&ii_conn->r_column_names);
+    init_rb_array (&ii_conn->r_data_types);
+
+    ii_api_get_metadata (ii_conn, args->descrParm);
+    ii_arena_init (ii_conn, args->descrParm, getFetchRowCount (args->descrParm, args->options->fetchRows));
+    ii_api_get_data (ii_conn, args->descrParm, args->options);
+  }
+
+  /* only available once all the rows have been fetched */
+  ii_conn->rowsAffected = getRowsAffected (ii_conn);
+  return Qnil;
+}
+
+static VALUE
+ii_each_row_rescue (VALUE param_args, VALUE param_exception)
+{
+  II_EACH_ROW_ARGS *args = (II_EACH_ROW_ARGS *) param_args;
+
+  args->failed = TRUE;
+  rb_exc_raise (param_exception);
+  return Qnil;
+}
+
+static VALUE
+ii_each_row_body (VALUE param_args)
+{
+  return rb_rescue2 (ii_each_row_fetch, param_args, ii_each_row_rescue, param_args, rb_eException, (VALUE) 0);
+}
+
+/* Close the statement however the iteration ended, a break from the block
+ * commits in the same way as reaching the end of the data */
+static VALUE
+ii_each_row_close (VALUE param_args)
+{
+  II_EACH_ROW_ARGS *args = (II_EACH_ROW_ARGS *) param_args;
+  II_CONN *ii_conn = args->ii_conn;
+
+  if (ii_conn->stmtHandle)
+    ii_api_query_close (ii_conn);
+
+  if (ii_conn->autocommit && ii_conn->cursorCount == 0 && ii_conn->tranHandle)
+  {
+    if (args->failed)
+      ii_api_rollback (ii_conn, NULL);
+    else
+      ii_api_commit (ii_conn);
+  }
+  return Qnil;
+}
+
+/*
+ * Document-method: each_row
+ *
+ * call-seq:
+ *    Ingres.each_row(sql[ param_types, param_values]) { |row| ... } -> Ingres
+ *
+ * Executes the supplied _sql_ statement and yields each row as an Array as
+ * soon as it has been fetched, without building the whole result set in
+ * memory. Parameters and the trailing options Hash are the same as for
+ * execute.
+ *
+ * The statement is closed when the block returns for the last row, breaks
+ * out early or raises an exception. In auto-commit mode the statement is
+ * committed, or rolled back if an exception was raised.
+ *
+ * Example usage:
+ *
+ *   conn = Ingres.new()
+ *   conn.connect(:database => "demodb")
+ *   conn.each_row("select up_id, up_email from user_profile where up_id > ?", "i", 100) do |row|
+ *     puts row[1]
+ *   end
+ *
+ */
+VALUE
+ii_each_row (int param_argc, VALUE * param_argv, VALUE param_self)
+{
+  VALUE param_queryText;
+  VALUE params;
+  VALUE options = Qnil;
+  II_QUERY_OPTIONS queryOptions;
+  IIAPI_GETDESCRPARM getDescrParm;
+  II_EACH_ROW_ARGS args;
+  char function_name[] = "ii_each_row";
+  II_CONN *ii_conn;
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  rb_need_block ();
+  rb_scan_args (param_argc, param_argv, "1*", &param_queryText, &params);
+
+  Check_Type(param_queryText, T_STRING);
+
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+
+  if (ii_conn->connHandle == NULL)
+    rb_raise (rb_eRuntimeError, "Unable to execute a statement without a connection");
+  ii_async_check_idle (ii_conn);
+
+  if (RARRAY_LEN(params) > 0 && TYPE (rb_ary_entry (params, -1)) == T_HASH)
+    options = rb_ary_pop (params);
+  ii_query_options (ii_conn, options, &queryOptions);
+  queryOptions.yieldRows = TRUE;
+  queryOptions.lazy = FALSE;
+  queryOptions.columnar = FALSE;
+
+  ii_conn->queryType = ii_query_type(RSTRING_PTR (param_queryText));
+
+  args.ii_conn = ii_conn;
+  args.descrParm = &getDescrParm;
+  args.options = &queryOptions;
+  args.queryText = param_queryText;
+  args.params = params;
+  args.failed = FALSE;
+  rb_ensure (ii_each_row_body, (VALUE) &args, ii_each_row_close, (VALUE) &args);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return param_self;
+}
+
+/* Keep the Ruby objects held by an Ingres::Result alive */
+static void
+ii_result_mark (II_RESULT *result)
+{
+  rb_gc_mark (result->conv.r_data_sizes);
+  rb_gc_mark (result->conv.connection);
+  rb_gc_mark (result->columnNames);
+}
+
+static void
+ii_result_free (II_RESULT *result)
+{
+  int i;
+  char function_name[] = "ii_result_free";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  if (result->descriptor)
+  {
+    for (i = 0; i < result->columnCount; i++)
+      ii_free ((void **) &result->descriptor[i].ds_columnName);
+  }
+  ii_free ((void **) &result->descriptor);
+  ii_free ((void **) &result->cells);
+  ii_free ((void **) &result->data);
+  ii_arena_free (&result->conv);
+  xfree (result);
+}
+
+/*
+**      ii_result_new() - Create an empty Ingres::Result
+**
+**      Description -
+**              The descriptors are copied, including the column names,
+**              as the ones returned by IIapi_getDescriptor() are only
+**              valid until the statement is closed.
+*/
+VALUE
+ii_result_new (II_CONN *ii_conn, IIAPI_GETDESCRPARM * param_descrParm, II_RESULT **param_result)
+{
+  VALUE result_obj;
+  II_RESULT *result = NULL;
+  char *columnName;
+  int i;
+  char function_name[] = "ii_result_new";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  result_obj = Data_Make_Struct (cIngresResult, II_RESULT, ii_result_mark, ii_result_free, result);
+  ii_conn_init (&result->conv);
+  result->conv.nullAsNil = ii_conn->nullAsNil;
+  result->conv.nativeDates = ii_conn->nativeDates;
+  result->conv.nativeDecimals = ii_conn->nativeDecimals;
+  result->conv.moneyMode = ii_conn->moneyMode;
+  result->conv.connection = ii_conn->connection;
+  result->conv.tranHandle = ii_conn->tranHandle;
+  result->conv.tranCount = ii_conn->tranCount;
+  result->conv.envHandle = ii_conn->envHandle;
+  result->conv.r_data_sizes = rb_ary_new ();
+  result->columnNames = rb_ary_new2 (param_descrParm->gd_descriptorCount);
+  result->columnCount = param_descrParm->gd_descriptorCount;
+  result->descriptor = ii_allocate (result->columnCount, sizeof (IIAPI_DESCRIPTOR));
+
+  for (i = 0; i < result->columnCount; i++)
+  {
+    result->descriptor[i] = param_descrParm->gd_descriptor[i];
+    columnName = param_descrParm->gd_descriptor[i].ds_columnName;
+    result->descriptor[i].ds_columnName = ii_allocate (strlen (columnName) + 1, sizeof (char));
+    strcpy (result->descriptor[i].ds_columnName, columnName);
+    rb_ary_push (result->columnNames, rb_str_new2 (columnName));
+  }
+
+  *param_result = result;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return result_obj;
+}
+
+/* Convert a single cell of an Ingres::Result to its Ruby value */
+static VALUE
+ii_result_cell (II_RESULT *result, long param_row, int param_column)
+{
+  RUBY_IIAPI_DATAVALUE columnData;
+  II_RESULT_CELL *cell = &result->cells[param_row * result->columnCount + param_column];
+
+  if (cell->isNull)
+    return processNullField (&result->conv);
+
+  columnData.dataValue[0].dv_null = FALSE;
+  columnData.dataValue[0].dv_length = (II_UINT2) cell->length;
+  columnData.dataValue[0].dv_value = result->data + cell->offset;
+  columnData.dv_length = cell->length;
+  columnData.lobValue = 0;
+  return processField (&result->conv, &columnData, param_column, &result->descriptor[param_column]);
+}
+
+static VALUE
+ii_result_row (II_RESULT *result, long param_row)
+{
+  VALUE values = rb_ary_new2 (result->columnCount);
+  int column;
+
+  for (column = 0; column < result->columnCount; column++)
+    rb_ary_push (values, ii_result_cell (result, param_row, column));
+  return values;
+}
+
+/* Map a column number or name to a column number, raising IndexError if
+ * there is no such column */
+static int
+ii_result_column_index (II_RESULT *result, VALUE param_column)
+{
+  int column;
+
+  if (TYPE (param_column) == T_STRING || TYPE (param_column) == T_SYMBOL)
+  {
+    VALUE name = rb_obj_as_string (param_column);
+
+    for (column = 0; column < result->columnCount; column++)
+    {
+      if (strcmp (result->descriptor[column].ds_columnName, StringValuePtr (name)) == 0)
+        return column;
+    }
+    rb_raise (rb_eIndexError, "No column named %s", StringValuePtr (name));
+  }
+
+  column = NUM2INT (param_column);
+  if (column < 0)
+    column += result->columnCount;
+  if (column < 0 || column >= result->columnCount)
+    rb_raise (rb_eIndexError, "Column %d is out of range", NUM2INT (param_column));
+  return column;
+}
+
+/*
+ * Document-method: size
+ *
+ * call-seq:
+ *    Ingres::Result.size() -> Fixnum
+ *
+ * Returns the number of rows in the result.
+ *
+ */
+static VALUE
+ii_result_size (VALUE param_self)
+{
+  II_RESULT *result = NULL;
+
+  Data_Get_Struct(param_self, II_RESULT, result);
+  return LONG2NUM (result->rowCount);
+}
+
+/*
+ * Document-method: columns
+ *
+ * call-seq:
+ *    Ingres::Result.columns() -> Array
+ *
+ * Returns the names of the columns in the result.
+ *
+ */
+static VALUE
+ii_result_columns (VALUE param_self)
+{
+  II_RESULT *result = NULL;
+
+  Data_Get_Struct(param_self, II_RESULT, result);
+  return rb_ary_dup (result->columnNames);
+}
+
+/*
+ * Document-method: []
+ *
+ * call-seq:
+ *    Ingres::Result[row] -> Array or nil
+ *    Ingres::Result[row, column] -> Object
+ *
+ * With one argument returns the row at index _row_ as an Array, or nil if
+ * there is no such row. With two arguments returns the single value in
+ * _column_, given as a number or a column name, of that row. Only the
+ * values returned are converted to Ruby objects.
+ *
+ * Example usage:
+ *
+ *   result = conn.execute("select ap_iatacode, ap_place from airport", :lazy => true)
+ *   result[0]                  # => ["VLL", "Valladolid"]
+ *   result[0, "ap_place"]      # => "Valladolid"
+ *
+ */
+static VALUE
+ii_result_aref (int param_argc, VALUE * param_argv, VALUE param_self)
+{
+  VALUE param_row, param_column;
+  II_RESULT *result = NULL;
+  long row;
+
+  rb_scan_args (param_argc, param_argv, "11", &param_row, &param_column);
+  Data_Get_Struct(param_self, II_RESULT, result);
+
+  row = NUM2LONG (param_row);
+  if (row < 0)
+    row += result->rowCount;
+  if (row < 0 || row >= result->rowCount)
+    return Qnil;
+
+  if (NIL_P(param_column))
+    return ii_result_row (result, row);
+  return ii_result_cell (result, row, ii_result_column_index (result, param_column));
+}
+
+/*
+ * Document-method: column
+ *
+ * call-seq:
+ *    Ingres::Result.column(column) -> Array
+ *
+ * Returns all the values of _column_, given as a number or a column name,
+ * leaving the other columns unconverted.
+ *
+ * Example usage:
+ *
+ *   result = conn.execute("select * from airport", :lazy => true)
+ *   codes = result.column("ap_iatacode")
+ *
+ */
+static VALUE
+ii_result_column (VALUE param_self, VALUE param_column)
+{
+  II_RESULT *result = NULL;
+  VALUE values;
+  long row;
+  int column;
+
+  Data_Get_Struct(param_self, II_RESULT, result);
+  column = ii_result_column_index (result, param_column);
+
+  values = rb_ary_new2 (result->rowCount);
+  for (row = 0; row < result->rowCount; row++)
+    rb_ary_push (values, ii_result_cell (result, row, column));
+  return values;
+}
+
+/*
+ * Document-method: each
+ *
+ * call-seq:
+ *    Ingres::Result.each { |row| ... } -> Ingres::Result
+ *
+ * Yields each row of the result as an Array.
+ *
+ */
+static VALUE
+ii_result_each (VALUE param_self)
+{
+  II_RESULT *result = NULL;
+  long row;
+
+  RETURN_ENUMERATOR(param_self, 0, 0);
+  Data_Get_Struct(param_self, II_RESULT, result);
+
+  for (row = 0; row < result->rowCount; row++)
+    rb_yield (ii_result_row (result, row));
+  return param_self;
+}
+
+/*
+ * Document-method: to_a
+ *
+ * call-seq:
+ *    Ingres::Result.to_a() -> Array
+ *
+ * Converts the whole result, returning the same Array of rows as
+ * Ingres#execute without the <tt>:lazy</tt> option.
+ *
+ */
+static VALUE
+ii_result_to_a (VALUE param_self)
+{
+  II_RESULT *result = NULL;
+  VALUE rows;
+  long row;
+
+  Data_Get_Struct(param_self, II_RESULT, result);
+
+  rows = rb_ary_new2 (result->rowCount);
+  for (row = 0; row < result->rowCount; row++)
+    rb_ary_push (rows, ii_result_row (result, row));
+  return rows;
+}
+
+/* Keep the parent connection and the Ruby arrays held by a cursor alive */
+static void
+ii_cursor_mark (II_CURSOR *cursor)
+{
+  rb_gc_mark (cursor->connection);
+  rb_gc_mark (cursor->stmt.resultset);
+  rb_gc_mark (cursor->stmt.r_column_names);
+  rb_gc_mark (cursor->stmt.r_data_sizes);
+  rb_gc_mark (cursor->stmt.r_data_types);
+}
+
+/* A cursor still open on the server when it is garbage collected hands its
+ * statement handle to the connection, which closes it before the transaction
+ * ends, see ii_close_orphans().  No OpenAPI calls are made from here.  The
+ * II_CONN of the connection is never freed, so it can still be looked at
+ * when the connection was collected first */
+static void
+ii_cursor_free (II_CURSOR *cursor)
+{
+  II_CONN *ii_conn = cursor->ii_conn;
+  II_PTR *handles;
+  char function_name[] = "ii_cursor_free";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  if (ii_conn != NULL && cursor->stmt.stmtHandle != NULL && !cursor->closed &&
+      ii_conn->connHandle != NULL && ii_conn->cursorGeneration == cursor->generation)
+  {
+    if (ii_conn->orphanCount == ii_conn->orphanMax)
+    {
+      /* plain realloc(), the Ruby allocator cannot be used during GC */
+      handles = realloc (ii_conn->orphanHandles, (ii_conn->orphanMax + 8) * sizeof (II_PTR));
+      if (handles != NULL)
+      {
+        ii_conn->orphanHandles = handles;
+        ii_conn->orphanMax += 8;
+      }
+    }
+    /* without memory the handle is left to go with the connection */
+    if (ii_conn->orphanCount < ii_conn->orphanMax)
+      ii_conn->orphanHandles[ii_conn->orphanCount++] = cursor->stmt.stmtHandle;
+    ii_conn->cursorCount--;
+  }
+
+  ii_arena_free (&cursor->stmt);
+  xfree (cursor);
+}
+
+/* A COMMIT or ROLLBACK on the connection closes any open cursors on the
+ * server, detect that by the cursor generation having moved on */
+static int
+ii_cursor_is_stale (II_CURSOR *cursor)
+{
+  return (cursor->ii_conn->connHandle == NULL || cursor->ii_conn->cursorGeneration != cursor->generation);
+}
+
+/* Close the statement of a cursor that is still open on the server and stop
+ * counting it.  Once the last cursor has gone an auto-commit transaction is
+ * committed */
+static void
+ii_cursor_release (II_CURSOR *cursor)
+{
+  II_CONN *ii_conn = cursor->ii_conn;
+
+  ii_api_query_close (&cursor->stmt);
+  ii_conn->cursorCount--;
+
+  if (ii_conn->autocommit && ii_conn->cursorCount == 0 && ii_conn->tranHandle)
+    ii_api_commit (ii_conn);
+}
+
+/* Runs when opening or fetching from a cursor raises.  A cancelled wait, or
+ * a failure opening the cursor, has already closed the statement, count the
+ * cursor as closed and end an auto-commit transaction before re-raising */
+static VALUE
+ii_cursor_rescue (VALUE param_self, VALUE param_exception)
+{
+  II_CURSOR *cursor = NULL;
+  II_CONN *ii_conn = NULL;
+
+  Data_Get_Struct(param_self, II_CURSOR, cursor);
+  ii_conn = cursor->ii_conn;
+
+  /* a transaction started by a statement that failed to open */
+  if (ii_conn->tranHandle == NULL)
+    ii_conn->tranHandle = cursor->stmt.tranHandle;
+
+  if (cursor->stmt.stmtHandle == NULL && !cursor->closed && !ii_cursor_is_stale (cursor))
+  {
+    cursor->done = TRUE;
+    cursor->closed = TRUE;
+    ii_arena_free (&cursor->stmt);
+    ii_conn->cursorCount--;
+    if (ii_conn->autocommit && ii_conn->cursorCount == 0 && ii_conn->tranHandle)
+      ii_api_rollback (ii_conn, NULL);
+  }
+  rb_exc_raise (param_exception);
+  return Qnil;
+}
+
+/* Send the cursor's statement and describe its result, a failure is
+ * cleaned up by ii_cursor_rescue() */
+static VALUE
+ii_cursor_describe (VALUE param_args)
+{
+  II_EACH_ROW_ARGS *args = (II_EACH_ROW_ARGS *) param_args;
+  II_CONN *stmt = args->ii_conn;
+
+  ii_api_query (stmt, StringValuePtr (args->queryText), RARRAY_LEN(args->params), args->params, IIAPI_QT_OPEN, args->options);
+
+  args->descrParm->gd_genParm.gp_callback = NULL;
+  args->descrParm->gd_genParm.gp_closure = NULL;
+  args->descrParm->gd_stmtHandle = stmt->stmtHandle;
+  args->descrParm->gd_descriptorCount = 0;
+  args->descrParm->gd_descriptor = NULL;
+
+  IIapi_getDescriptor (args->descrParm);
+  ii_sync_query (stmt, &(args->descrParm->gd_genParm));
+
+  if (ii_checkError (&(args->descrParm->gd_genParm)))
+  {
+    ii_api_query_close (stmt);
+    rb_raise (rb_eRuntimeError, "Error! Failed while opening the cursor.");
+  }
+  return Qnil;
+}
+
+static VALUE
+ii_cursor_get_data (VALUE param_args)
+{
+  II_EACH_ROW_ARGS *args = (II_EACH_ROW_ARGS *) param_args;
+
+  return INT2NUM (ii_api_get_data (args->ii_conn, args->descrParm, args->options));
+}
+
+/*
+ * Document-method: close
+ *
+ * call-seq:
+ *    Ingres::Cursor.close() -> nil
+ *
+ * Closes the cursor. Once the last open cursor on a connection in
+ * auto-commit mode has been closed, the transaction is committed. Calling
+ * close on a cursor that is already closed does nothing.
+ *
+ */
+static VALUE
+ii_cursor_close (VALUE param_self)
+{
+  char function_name[] = "ii_cursor_close";
+  II_CURSOR *cursor = NULL;
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  Data_Get_Struct(param_self, II_CURSOR, cursor);
+
+  if (cursor->closed)
+    return Qnil;
+  ii_check_busy (cursor->ii_conn);
+  cursor->closed = TRUE;
+
+  /* the statement is already closed once all the rows have been fetched */
+  if (cursor->stmt.stmtHandle != NULL)
+  {
+    if (ii_cursor_is_stale (cursor))
+    {
+      /* already closed on the server by the end of the transaction */
+      cursor->stmt.stmtHandle = NULL;
+      ii_arena_free (&cursor->stmt);
+    }
+    else
+      ii_cursor_release (cursor);
+  }
+  cursor->done = TRUE;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return Qnil;
+}
+
+/*
+**      ii_cursor_query_text() - The SELECT to open a cursor with
+**
+**      Description -
+**              Read-only cursors can be prefetched a block of rows at a
+**              time, so FOR READONLY is added to the statement.  Any
+**              trailing semicolon is dropped first, and a statement that
+**              already has its own FOR READONLY or FOR UPDATE clause is
+**              used as it is.
+*/
+static VALUE
+ii_cursor_query_text (VALUE param_queryText)
+{
+  char *sql = RSTRING_PTR (param_queryText);
+  long length = RSTRING_LEN (param_queryText);
+  long pos;
+  char *clause;
+  VALUE queryText;
+
+  while (length > 0 && (isspace (sql[length - 1]) || sql[length - 1] == ';'))
+    length--;
+  queryText = rb_str_new (sql, length);
+
+  for (pos = 0; pos + 3 < length; pos++)
+  {
+    if (strncasecmp (sql + pos, "for", 3) != 0 || !isspace (sql[pos + 3]))
+      continue;
+    if (pos > 0 && (isalnum (sql[pos - 1]) || sql[pos - 1] == '_'))
+      continue;
+    clause = sql + pos + 3;
+    while (clause < sql + length && isspace (*clause))
+      clause++;
+    if (strncasecmp (clause, "readonly", 8) == 0 || strncasecmp (clause, "read ", 5) == 0 ||
+        strncasecmp (clause, "update", 6) == 0 || strncasecmp (clause, "deferred", 8) == 0 ||
+        strncasecmp (clause, "direct", 6) == 0)
+      return queryText;
+  }
+
+  rb_str_cat2 (queryText, " FOR READONLY");
+  return queryText;
+}
+
+/*
+ * Document-method: cursor
+ *
+ * call-seq:
+ *    Ingres.cursor(sql[ param_types, param_values]) -> Ingres::Cursor
+ *    Ingres.cursor(sql[ param_types, param_values]) { |cursor| ... } -> Object
+ *
+ * Opens a read-only server side cursor for the SELECT statement in _sql_.
+ * Rows are only sent by the server as they are requested with
+ * Ingres::Cursor#fetch. Parameters and the trailing options Hash are the
+ * same as for execute. More than one cursor can be open on a connection at
+ * the same time, and other statements can be executed while they are open.
+ *
+ * COMMIT and ROLLBACK close all the cursors open on the connection. In
+ * auto-commit mode the transaction is held open until the last cursor has
+ * been closed, has had all its rows fetched or has been garbage collected.
+ * A semicolon at the end of _sql_ is ignored.
+ *
+ * When a block is given the cursor is passed to it and closed when the
+ * block ends, the value of the block is returned.
+ *
+ * Example usage:
+ *
+ *   conn = Ingres.new()
+ *   conn.connect(:database => "demodb")
+ *   conn.cursor("select up_id, up_email from user_profile") do |cursor|
+ *     while (rows = cursor.fetch(100)).size > 0
+ *       rows.each { |row| puts row[1] }
+ *     end
+ *   end
+ *
+ */
+static VALUE
+ii_cursor_open (int param_argc, VALUE * param_argv, VALUE param_self)
+{
+  VALUE param_queryText;
+  VALUE params;
+  VALUE options = Qnil;
+  VALUE queryText;
+  VALUE cursor_obj;
+  II_QUERY_OPTIONS queryOptions;
+  II_EACH_ROW_ARGS args;
+  II_CURSOR *cursor = NULL;
+  II_CONN *ii_conn = NULL;
+  char function_name[] = "ii_cursor_open";
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  rb_scan_args (param_argc, param_argv, "1*", &param_queryText, &params);
+  Check_Type(param_queryText, T_STRING);
+
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+
+  if (ii_conn->connHandle == NULL)
+    rb_raise (rb_eRuntimeError, "Unable to open a cursor without a connection");
+  ii_async_check_idle (ii_conn);
+
+  if (ii_query_type (RSTRING_PTR (param_queryText)) != INGRES_SQL_SELECT)
+    rb_raise (rb_eArgError, "Cursors can only be opened for SELECT statements");
+
+  if (RARRAY_LEN(params) > 0 && TYPE (rb_ary_entry (params, -1)) == T_HASH)
+    options = rb_ary_pop (params);
+  ii_query_options (ii_conn, options, &queryOptions);
+
+  cursor_obj = Data_Make_Struct (cIngresCursor, II_CURSOR, ii_cursor_mark, ii_cursor_free, cursor);
+  ii_conn_init (&cursor->stmt);
+  cursor->ii_conn = ii_conn;
+  cursor->connection = param_self;
+  cursor->generation = ii_conn->cursorGeneration;
+  cursor->done = FALSE;
+  cursor->closed = TRUE;  /* until it is counted as open */
+  cursor->stmt.connHandle = ii_conn->connHandle;
+  cursor->stmt.envHandle = ii_conn->envHandle;
+  cursor->stmt.busy = ii_conn->busy;
+  cursor->stmt.tranHandle = ii_conn->tranHandle;
+  cursor->stmt.tranCount = ii_conn->tranCount;
+  cursor->stmt.apiLevel = ii_conn->apiLevel;
+  cursor->stmt.lobSegmentSize = ii_conn->lobSegmentSize;
+  cursor->stmt.fetchRows = queryOptions.fetchRows;
+  cursor->stmt.timeout = queryOptions.timeout;
+  cursor->stmt.nullAsNil = ii_conn->nullAsNil;
+  cursor->stmt.nativeDates = ii_conn->nativeDates;
+  cursor->stmt.nativeDecimals = ii_conn->nativeDecimals;
+  cursor->stmt.moneyMode = ii_conn->moneyMode;
+  cursor->stmt.connection = param_self;
+  cursor->stmt.autocommit = FALSE;
+  cursor->stmt.cursor_mode = INGRES_CURSOR_READONLY;
+  cursor->stmt.resultset = rb_ary_new ();
+  cursor->stmt.r_column_names = rb_ary_new ();
+  cursor->stmt.r_data_sizes = rb_ary_new ();
+  cursor->stmt.r_data_types = rb_ary_new ();
+
+  queryText = ii_cursor_query_text (param_queryText);
+
+  /* counted as open from here on, ii_cursor_rescue() undoes that if the
+   * statement fails to be sent, is closed by an error or is cancelled */
+  ii_conn->cursorCount++;
+  cursor->closed = FALSE;
+  args.ii_conn = &cursor->stmt;
+  args.descrParm = &cursor->descrParm;
+  args.options = &queryOptions;
+  args.queryText = queryText;
+  args.params = params;
+  args.failed = FALSE;
+  rb_rescue2 (ii_cursor_describe, (VALUE) &args, ii_cursor_rescue, cursor_obj, rb_eException, (VALUE) 0);
+  RB_GC_GUARD(queryText);
+
+  if (ii_conn->tranHandle == NULL)
+    ii_conn->tranHandle = cursor->stmt.tranHandle;
+
+  ii_api_get_metadata (&cursor->stmt, &cursor->descrParm);
+  ii_arena_init (&cursor->stmt, &cursor->descrParm, getFetchRowCount (&cursor->descrParm, queryOptions.fetchRows));
+
+  if (ii_globals.debug)
+    printf ("Exiting %s, %d cursor(s) open.\n", function_name, ii_conn->cursorCount);
+
+  if (rb_block_given_p ())
+    return rb_ensure (rb_yield, cursor_obj, ii_cursor_close, cursor_obj);
+  return cursor_obj;
+}
+
+/*
+ * Document-method: fetch
+ *
+ * call-seq:
+ *    Ingres::Cursor.fetch([rows]) -> Array
+ *
+ * Fetches up to _rows_ further rows from the cursor, returning them as an
+ * Array of Arrays in the same form as Ingres#execute. An empty Array is
+ * returned once all the rows have been fetched, the cursor's statement is
+ * closed on the server as soon as the last row has been read. _rows_ defaults to the
+ * number of rows fetched from the server per call, see Ingres#fetch_rows.
+ *
+ * Example usage:
+ *
+ *   cursor = conn.cursor("select up_id from user_profile")
+ *   first_ten = cursor.fetch(10)
+ *   cursor.close
+ *
+ */
+static VALUE
+ii_cursor_fetch (int param_argc, VALUE * param_argv, VALUE param_self)
+{
+  VALUE param_rows;
+  II_QUERY_OPTIONS queryOptions;
+  II_EACH_ROW_ARGS args;
+  II_CURSOR *cursor = NULL;
+  long rows;
+  char function_name[] = "ii_cursor_fetch";
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  rb_scan_args (param_argc, param_argv, "01", &param_rows);
+
+  Data_Get_Struct(param_self, II_CURSOR, cursor);
+
+  if (cursor->closed)
+    rb_raise (rb_eRuntimeError, "The cursor has been closed");
+  ii_check_busy (cursor->ii_conn);
+
+  if (!cursor->done && ii_cursor_is_stale (cursor))
+  {
+    cursor->stmt.stmtHandle = NULL;
+    ii_arena_free (&cursor->stmt);
+    cursor->done = TRUE;
+    cursor->closed = TRUE;
+    rb_raise (rb_eRuntimeError, "The cursor was closed by the end of its transaction");
+  }
+
+  rows = NIL_P(param_rows) ? cursor->stmt.arena.rowCount : NUM2LONG (param_rows);
+  if (rows < 1 && !cursor->done)
+    rb_raise (rb_eArgError, "The number of rows to fetch must be at least 1");
+
+  cursor->stmt.resultset = rb_ary_new ();
+  if (!cursor->done)
+  {
+    ii_query_options (&cursor->stmt, Qnil, &queryOptions);
+    queryOptions.maxRows = rows;
+    cursor->stmt.deadline = ii_deadline (cursor->stmt.timeout);
+    args.ii_conn = &cursor->stmt;
+    args.descrParm = &cursor->descrParm;
+    args.options = &queryOptions;
+    args.failed = FALSE;
+    cursor->done = NUM2INT (rb_rescue2 (ii_cursor_get_data, (VALUE) &args, ii_cursor_rescue, param_self, rb_eException, (VALUE) 0));
+
+    /* close the statement as soon as the last row is in, so that an
+     * auto-commit transaction does not wait for close() */
+    if (cursor->done)
+      ii_cursor_release (cursor);
+  }
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return cursor->stmt.resultset;
+}
+
+/*
+ * Document-method: columns
+ *
+ * call-seq:
+ *    Ingres::Cursor.columns() -> Array
+ *
+ * Returns the names of the columns in the cursor's result set.
+ *
+ */
+static VALUE
+ii_cursor_columns (VALUE param_self)
+{
+  II_CURSOR *cursor = NULL;
+
+  Data_Get_Struct(param_self, II_CURSOR, cursor);
+  return rb_ary_dup (cursor->stmt.r_column_names);
+}
+
+/*
+ * Document-method: closed?
+ *
+ * call-seq:
+ *    Ingres::Cursor.closed?() -> true or false
+ *
+ * Returns true once the cursor has been closed.
+ *
+ */
+static VALUE
+ii_cursor_closed (VALUE param_self)
+{
+  II_CURSOR *cursor = NULL;
+
+  Data_Get_Struct(param_self, II_CURSOR, cursor);
+  if (!cursor->closed && cursor->stmt.stmtHandle != NULL && ii_cursor_is_stale (cursor))
+  {
+    cursor->stmt.stmtHandle = NULL;
+    ii_arena_free (&cursor->stmt);
+    cursor->done = TRUE;
+    cursor->closed = TRUE;
+  }
+  return cursor->closed ? Qtrue : Qfalse;
+}
+
+/* Keep the connection a LOB locator was returned on alive */
+static void
+ii_lob_mark (II_LOB *lob)
+{
+  rb_gc_mark (lob->connection);
+}
+
+/*
+**      ii_lob_new() - Wrap a LOB locator in an Ingres::Lob
+**
+**      Description -
+**              Called by processField() for the locator types returned
+**              by a query run with :lob_locators.  The locator is only
+**              valid in the transaction of the statement it was fetched
+**              on, which is recorded so stale locators can be detected.
+*/
+VALUE
+ii_lob_new (II_CONN *ii_conn, IIAPI_DATAVALUE *dataValue, IIAPI_DT_ID dataType)
+{
+  VALUE lob_obj;
+  II_LOB *lob = NULL;
+  char function_name[] = "ii_lob_new";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  lob_obj = Data_Make_Struct (cIngresLob, II_LOB, ii_lob_mark, RUBY_DEFAULT_FREE, lob);
+  lob->connection = ii_conn->connection;
+  lob->tranCount = ii_conn->tranCount;
+  lob->dataType = dataType;
+  memcpy (&lob->locator, dataValue->dv_value, sizeof (II_UINT4));
+
+  if (ii_globals.debug)
+    printf ("Exiting %s, locator %u.\n", function_name, (unsigned int) lob->locator);
+  return lob_obj;
+}
+
+/* The connection a locator can be used on, once the transaction it was
+ * returned in has ended the server has freed it */
+static II_CONN *
+ii_lob_conn (II_LOB *lob)
+{
+  II_CONN *ii_conn = NULL;
+
+  Data_Get_Struct(lob->connection, II_CONN, ii_conn);
+  ii_check_busy (ii_conn);
+  if (ii_conn->connHandle == NULL || ii_conn->tranHandle == NULL || ii_conn->tranCount != lob->tranCount)
+    rb_raise (rb_eRuntimeError, "The LOB locator is no longer valid, the transaction it was returned in has ended");
+  return ii_conn;
+}
+
+/* Close the statement and raise if an API call made by ii_lob_query() failed */
+static void
+ii_lob_check (II_CONN *ii_conn, IIAPI_GENPARM * param_genParm)
+{
+  if (ii_checkError (param_genParm))
+  {
+    if (ii_conn->stmtHandle)
+      ii_api_query_close (ii_conn);
+    rb_raise (rb_eRuntimeError, "Error! Failed while reading a LOB locator.");
+  }
+}
+
+/*
+**      ii_lob_query() - Run a statement taking a LOB locator parameter
+**
+**      Description -
+**              The locator is sent as the first parameter followed by
+**              param_argc integer parameters.  The statement shares the
+**              connection and transaction handles of the connection the
+**              locator came from, in the same way as a cursor, leaving
+**              the connection's own statement state untouched.
+*/
+static void
+ii_lob_query (II_LOB *lob, II_LOB_QUERY *query, char *param_sqlText, int param_argc, II_INT4 *param_args)
+{
+  IIAPI_QUERYPARM queryParm;
+  IIAPI_SETDESCRPARM setDescrParm;
+  IIAPI_PUTPARMPARM putParmParm;
+  IIAPI_DESCRIPTOR descriptors[3];
+  IIAPI_DATAVALUE values[3];
+  II_CONN *ii_conn = ii_lob_conn (lob);
+  II_CONN *stmt = &query->stmt;
+  int i;
+  char function_name[] = "ii_lob_query";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  ii_conn_init (stmt);
+  stmt->connHandle = ii_conn->connHandle;
+  stmt->envHandle = ii_conn->envHandle;
+  stmt->busy = ii_conn->busy;
+  stmt->tranHandle = ii_conn->tranHandle;
+  stmt->apiLevel = ii_conn->apiLevel;
+  stmt->lobSegmentSize = ii_conn->lobSegmentSize;
+  stmt->nullAsNil = ii_conn->nullAsNil;
+  stmt->timeout = ii_conn->timeout;
+  stmt->connection = lob->connection;
+  stmt->autocommit = FALSE;
+  stmt->resultset = rb_ary_new ();
+  stmt->r_column_names = rb_ary_new ();
+  stmt->r_data_sizes = rb_ary_new ();
+  stmt->r_data_types = rb_ary_new ();
+  ii_query_options (stmt, Qnil, &query->options);
+  stmt->deadline = ii_deadline (stmt->timeout);
+
+  queryParm.qy_connHandle = stmt->connHandle;
+  queryParm.qy_genParm.gp_callback = NULL;
+  queryParm.qy_genParm.gp_closure = NULL;
+  queryParm.qy_queryType = IIAPI_QT_QUERY;
+  queryParm.qy_queryText = param_sqlText;
+  queryParm.qy_parameters = TRUE;
+  queryParm.qy_tranHandle = stmt->tranHandle;
+  queryParm.qy_stmtHandle = NULL;
+#if defined(IIAPI_VERSION_6)
+  queryParm.qy_flags  = 0;
+#endif
+
+  IIapi_query (&queryParm);
+  ii_sync (stmt, &(queryParm.qy_genParm));
+  stmt->stmtHandle = queryParm.qy_stmtHandle;
+  ii_lob_check (stmt, &(queryParm.qy_genParm));
+
+  for (i = 0; i <= param_argc; i++)
+  {
+    descriptors[i].ds_dataType = (i == 0) ? lob->dataType : IIAPI_INT_TYPE;
+    descriptors[i].ds_nullable = FALSE;
+    descriptors[i].ds_length = (i == 0) ? sizeof (II_UINT4) : sizeof (II_INT4);
+    descriptors[i].ds_precision = 0;
+    descriptors[i].ds_scale = 0;
+    descriptors[i].ds_columnType = IIAPI_COL_QPARM;
+    descriptors[i].ds_columnName = NULL;
+    values[i].dv_null = FALSE;
+    values[i].dv_length = descriptors[i].ds_length;
+    values[i].dv_value = (i == 0) ? (II_PTR) &lob->locator : (II_PTR) &param_args[i - 1];
+  }
+
+  setDescrParm.sd_genParm.gp_callback = NULL;
+  setDescrParm.sd_genParm.gp_closure = NULL;
+  setDescrParm.sd_stmtHandle = stmt->stmtHandle;
+  setDescrParm.sd_descriptorCount = param_argc + 1;
+  setDescrParm.sd_descriptor = descriptors;
+  IIapi_setDescriptor (&setDescrParm);
+  ii_sync (stmt, &(setDescrParm.sd_genParm));
+  ii_lob_check (stmt, &(setDescrParm.sd_genParm));
+
+  putParmParm.pp_genParm.gp_callback = NULL;
+  putParmParm.pp_genParm.gp_closure = NULL;
+  putParmParm.pp_stmtHandle = stmt->stmtHandle;
+  putParmParm.pp_parmCount = param_argc + 1;
+  putParmParm.pp_parmData = values;
+  putParmParm.pp_moreSegments = 0;
+  IIapi_putParms (&putParmParm);
+  ii_sync (stmt, &(putParmParm.pp_genParm));
+  ii_lob_check (stmt, &(putParmParm.pp_genParm));
+
+  query->descrParm.gd_genParm.gp_callback = NULL;
+  query->descrParm.gd_genParm.gp_closure = NULL;
+  query->descrParm.gd_stmtHandle = stmt->stmtHandle;
+  query->descrParm.gd_descriptorCount = 0;
+  query->descrParm.gd_descriptor = NULL;
+  IIapi_getDescriptor (&query->descrParm);
+  ii_sync_query (stmt, &(query->descrParm.gd_genParm));
+  ii_lob_check (stmt, &(query->descrParm.gd_genParm));
+
+  ii_api_get_metadata (stmt, &query->descrParm);
+  ii_arena_init (stmt, &query->descrParm, getFetchRowCount (&query->descrParm, 0));
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+static VALUE
+ii_lob_fetch (VALUE param_query)
+{
+  II_LOB_QUERY *query = (II_LOB_QUERY *) param_query;
+
+  ii_api_get_data (&query->stmt, &query->descrParm, &query->options);
+  return rb_ary_entry (rb_ary_entry (query->stmt.resultset, 0), 0);
+}
+
+static VALUE
+ii_lob_close (VALUE param_query)
+{
+  II_LOB_QUERY *query = (II_LOB_QUERY *) param_query;
+
+  if (query->stmt.stmtHandle)
+    ii_api_query_close (&query->stmt);
+  return Qnil;
+}
+
+/* Run a statement on the locator, returning the single value it selects.
+ * LOB values are streamed to param_sink instead when it is set */
+static VALUE
+ii_lob_value (II_LOB *lob, char *param_sqlText, int param_argc, II_INT4 *param_args, VALUE param_sink)
+{
+  II_LOB_QUERY query;
+
+  ii_lob_query (lob, &query, param_sqlText, param_argc, param_args);
+  query.options.lobSink = param_sink;
+  return rb_ensure (ii_lob_fetch, (VALUE) &query, ii_lob_close, (VALUE) &query);
+}
+
+/*
+ * Document-method: length
+ *
+ * call-seq:
+ *    Ingres::Lob.length() -> Integer
+ *
+ * Returns the length of the value, in bytes for long byte and long varchar
+ * columns and in characters for long nvarchar columns. Only the length is
+ * sent by the server.
+ *
+ */
+static VALUE
+ii_lob_length (VALUE param_self)
+{
+  II_LOB *lob = NULL;
+
+  Data_Get_Struct(param_self, II_LOB, lob);
+  return ii_lob_value (lob, "SELECT length(~V )", 0, NULL, 0);
+}
+
+/*
+ * Document-method: read
+ *
+ * call-seq:
+ *    Ingres::Lob.read([offset[, length]]) -> String
+ *
+ * Reads _length_ bytes, or characters for long nvarchar columns, starting
+ * _offset_ from the start of the value. Without a _length_ the rest of the
+ * value is read, without an _offset_ the whole value.
+ *
+ * Example usage:
+ *
+ *   conn.execute("start transaction")
+ *   lob = conn.execute("select up_image from user_profile where up_id = ?", "i", 1, :lob_locators => true)[0][0]
+ *   header = lob.read(0, 8)
+ *
+ */
+static VALUE
+ii_lob_read (int param_argc, VALUE * param_argv, VALUE param_self)
+{
+  VALUE param_offset, param_length;
+  II_INT4 args[2];
+  II_LOB *lob = NULL;
+
+  rb_scan_args (param_argc, param_argv, "02", &param_offset, &param_length);
+  Data_Get_Struct(param_self, II_LOB, lob);
+
+  args[0] = NIL_P(param_offset) ? 0 : NUM2INT (param_offset);
+  if (args[0] < 0)
+    rb_raise (rb_eArgError, "offset must not be negative");
+  /* SQL substring positions start at 1 */
+  args[0]++;
+
+  if (NIL_P(param_length))
+    return ii_lob_value (lob, "SELECT substring(~V FROM ~V )", 1, args, 0);
+
+  args[1] = NUM2INT (param_length);
+  if (args[1] < 0)
+    rb_raise (rb_eArgError, "length must not be negative");
+  return ii_lob_value (lob, "SELECT substring(~V FROM ~V FOR ~V )", 2, args, 0);
+}
+
+/*
+ * Document-method: each_segment
+ *
+ * call-seq:
+ *    Ingres::Lob.each_segment { |segment| ... } -> Ingres::Lob
+ *
+ * Reads the whole value, yielding it a segment at a time as it arrives
+ * from the server without holding it in memory in full.
+ *
+ * Example usage:
+ *
+ *   File.open("image.png", "wb") do |file|
+ *     lob.each_segment { |segment| file.write(segment) }
+ *   end
+ *
+ */
+static VALUE
+ii_lob_each_segment (VALUE param_self)
+{
+  II_INT4 args[1] = { 1 };
+  II_LOB *lob = NULL;
+
+  rb_need_block ();
+  Data_Get_Struct(param_self, II_LOB, lob);
+  ii_lob_value (lob, "SELECT substring(~V FROM ~V )", 1, args, rb_block_proc ());
+  return param_self;
+}
+
+/*
+ * Document-method: locator
+ *
+ * call-seq:
+ *    Ingres::Lob.locator() -> Integer
+ *
+ * Returns the locator the server returned for the value.
+ *
+ */
+static VALUE
+ii_lob_locator (VALUE param_self)
+{
+  II_LOB *lob = NULL;
+
+  Data_Get_Struct(param_self, II_LOB, lob);
+  return ULONG2NUM (lob->locator);
+}
+
+/* OpenAPI completion callback for execute_async(), called from inside
+ * IIapi_wait() by whichever thread is waiting, possibly without the GVL.
+ * No Ruby API calls may be made here */
+static II_VOID II_FAR II_CALLBACK
+ii_async_callback (II_PTR param_closure, II_PTR param_parmBlock)
+{
+  II_ASYNC *async = (II_ASYNC *) param_closure;
+
+  async->completed = TRUE;
+}
+
+/* Keep the connection and the Ruby objects held by an Ingres::AsyncResult alive */
+static void
+ii_async_mark (II_ASYNC *async)
+{
+  rb_gc_mark (async->connection);
+  rb_gc_mark (async->value);
+  rb_gc_mark (async->error);
+  rb_gc_mark (async->options.columns);
+  rb_gc_mark (async->options.lobSink);
+}
+
+/* A running statement keeps its Ingres::AsyncResult alive through the
+ * connection's keep_me, so one can only be collected along with its
+ * connection.  OpenAPI may still write to it until the statement has been
+ * ended, which free_ii_conn() does before freeing it.  No OpenAPI calls are
+ * made from here */
+static void
+ii_async_free (II_ASYNC *async)
+{
+  char function_name[] = "ii_async_free";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  if (async->ii_conn != NULL && async->ii_conn->async == async)
+  {
+    async->freed = TRUE;
+    return;
+  }
+  xfree (async);
+}
+
+/* Let OpenAPI process anything that has arrived for any connection, without
+ * blocking, and report whether the statement has been run */
+static int
+ii_async_poll (II_ASYNC *async)
+{
+  IIAPI_WAITPARM waitParm;
+
+  if (!async->completed)
+  {
+    waitParm.wt_timeout = 0;
+    waitParm.wt_status = IIAPI_ST_SUCCESS;
+    IIapi_wait (&waitParm);
+  }
+  return async->completed;
+}
+
+/* When a fiber scheduler is running, poll for the statement to complete,
+ * sleeping through the scheduler in between so other fibers carry on.
+ * OpenAPI has no descriptor that could be handed to the scheduler to wait on */
+static VALUE
+ii_async_poll_scheduler (VALUE param_async)
+{
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+  II_ASYNC *async = (II_ASYNC *) param_async;
+  VALUE scheduler = rb_fiber_scheduler_current ();
+  double delay = 0.001;
+
+  if (NIL_P(scheduler))
+    return Qnil;
+
+  async->polling = TRUE;
+  while (!ii_async_poll (async))
+  {
+    /* left to ii_sync_query() to cancel */
+    if (async->ii_conn->deadline > 0 && ii_clock_ms () >= async->ii_conn->deadline)
+      break;
+    rb_fiber_scheduler_kernel_sleep (scheduler, rb_float_new (delay));
+    if (delay < 0.05)
+      delay *= 2;
+  }
+  async->polling = FALSE;
+#endif
+  return Qnil;
+}
+
+/* A fiber interrupted while sleeping in ii_async_poll_scheduler() cancels
+ * the statement */
+static VALUE
+ii_async_poll_ensure (VALUE param_async)
+{
+  II_ASYNC *async = (II_ASYNC *) param_async;
+
+  if (async->polling)
+  {
+    async->polling = FALSE;
+    ii_async_abandon (async);
+  }
+  return Qnil;
+}
+
+static VALUE
+ii_async_finish (VALUE param_async)
+{
+  II_ASYNC *async = (II_ASYNC *) param_async;
+  II_CONN *ii_conn = async->ii_conn;
+
+  rb_ensure (ii_async_poll_scheduler, param_async, ii_async_poll_ensure, param_async);
+
+  /* blocks without the GVL if the scheduler did not see the statement complete */
+  ii_sync_query (ii_conn, &(async->descrParm.gd_genParm));
+  ii_conn->async = NULL;
+  ii_conn->keep_me = Qfalse;
+  return ii_execute_query_finish (ii_conn, &async->descrParm, &async->options);
+}
+
+/*
+ * Document-method: execute_async
+ *
+ * call-seq:
+ *    Ingres.execute_async(sql[ param_types, param_values]) -> Ingres::AsyncResult
+ *
+ * Sends the _sql_ statement to the server and returns straight away,
+ * without waiting for the server to run it. Parameters and the trailing
+ * options Hash are the same as for execute. Ingres::AsyncResult#value
+ * returns the same result execute would have. Nothing else can be run on
+ * the connection until it has been called, or the statement has been
+ * stopped with Ingres::AsyncResult#cancel. The connection keeps the
+ * Ingres::AsyncResult alive until then.
+ *
+ * Other connections can be used while the statement runs, and with a
+ * Ruby 3 Fiber scheduler active waiting for the value lets other fibers
+ * run instead of blocking the thread.
+ *
+ * Example usage:
+ *
+ *   pending = [conn1, conn2].map { |conn| conn.execute_async("select count(*) from airport") }
+ *   counts = pending.map { |result| result.value[0][0] }
+ *
+ */
+static VALUE
+ii_execute_async (int param_argc, VALUE * param_argv, VALUE param_self)
+{
+  VALUE param_queryText;
+  VALUE params;
+  VALUE options = Qnil;
+  VALUE async_obj;
+  II_ASYNC *async = NULL;
+  II_CONN *ii_conn = NULL;
+  char function_name[] = "ii_execute_async";
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  rb_scan_args (param_argc, param_argv, "1*", &param_queryText, &params);
+  Check_Type(param_queryText, T_STRING);
+
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+
+  if (ii_conn->connHandle == NULL)
+    rb_raise (rb_eRuntimeError, "Unable to execute a statement without a connection");
+  ii_async_check_idle (ii_conn);
+
+  switch (ii_query_type (RSTRING_PTR (param_queryText)))
+  {
+    case INGRES_SQL_COMMIT:
+    case INGRES_SQL_ROLLBACK:
+    case INGRES_SQL_ROLLBACK_TO:
+    case INGRES_SQL_ROLLBACK_WORK_TO:
+    case INGRES_START_TRANSACTION:
+    case INGRES_SQL_CONNECT:
+    case INGRES_SQL_DISCONNECT:
+    case INGRES_SQL_GETDBEVENT:
+    case INGRES_SQL_SAVEPOINT:
+    case INGRES_SQL_AUTOCOMMIT:
+    case INGRES_SQL_COPY:
+      rb_raise (rb_eArgError, "Only queries can be run by execute_async, use execute");
+  }
+  ii_conn->queryType = ii_query_type (RSTRING_PTR (param_queryText));
+
+  if (RARRAY_LEN(params) > 0 && TYPE (rb_ary_entry (params, -1)) == T_HASH)
+    options = rb_ary_pop (params);
+
+  async_obj = Data_Make_Struct (cIngresAsyncResult, II_ASYNC, ii_async_mark, ii_async_free, async);
+  async->connection = param_self;
+  async->ii_conn = ii_conn;
+  async->completed = FALSE;
+  async->polling = FALSE;
+  async->finished = FALSE;
+  async->freed = FALSE;
+  async->value = Qnil;
+  async->error = Qnil;
+  ii_query_options (ii_conn, options, &async->options);
+
+  ii_execute_query_send (ii_conn, StringValuePtr (param_queryText), RARRAY_LEN(params), params, &async->options, &async->descrParm, ii_async_callback, async);
+  ii_conn->async = async;
+  ii_conn->keep_me = async_obj;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return async_obj;
+}
+
+/*
+ * Document-method: ready?
+ *
+ * call-seq:
+ *    Ingres::AsyncResult.ready?() -> true or false
+ *
+ * Returns true once the server has run the statement, when value will
+ * return without waiting for it.
+ *
+ */
+static VALUE
+ii_async_ready (VALUE param_self)
+{
+  II_ASYNC *async = NULL;
+
+  Data_Get_Struct(param_self, II_ASYNC, async);
+  if (async->finished || async->ii_conn == NULL)
+    return Qtrue;
+  return ii_async_poll (async) ? Qtrue : Qfalse;
+}
+
+/*
+ * Document-method: value
+ *
+ * call-seq:
+ *    Ingres::AsyncResult.value() -> Array
+ *
+ * Waits for the server to run the statement and returns its result, the
+ * same as Ingres#execute would have. An error running the statement is
+ * raised here. Once it has returned, value can be called again to return
+ * the same result and the connection is free for other statements.
+ *
+ */
+static VALUE
+ii_async_value (VALUE param_self)
+{
+  II_ASYNC *async = NULL;
+  II_CONN *ii_conn = NULL;
+  VALUE error;
+  int state = 0;
+
+  Data_Get_Struct(param_self, II_ASYNC, async);
+
+  if (!async->finished)
+  {
+    ii_conn = async->ii_conn;
+    if (ii_conn == NULL)
+      rb_raise (rb_eRuntimeError, "The statement was cancelled before it finished");
+    ii_check_busy (ii_conn);
+
+    async->value = rb_protect (ii_async_finish, (VALUE) async, &state);
+    async->finished = TRUE;
+    if (ii_conn->async == async)
+    {
+      ii_conn->async = NULL;
+      ii_conn->keep_me = Qfalse;
+    }
+
+    if (state)
+    {
+      error = rb_errinfo ();
+      if (rb_obj_is_kind_of (error, rb_eException))
+        async->error = error;
+      else
+      {
+        /* the thread is being killed, there is no result to keep */
+        async->finished = FALSE;
+        async->ii_conn = NULL;
+      }
+      rb_jump_tag (state);
+    }
+  }
+
+  if (!NIL_P(async->error))
+    rb_exc_raise (async->error);
+  return async->value;
+}
+
+/*
+ * Document-method: cancel
+ *
+ * call-seq:
+ *    Ingres::AsyncResult.cancel() -> nil
+ *
+ * Cancels the statement if the server is still running it, and closes it.
+ * In auto-commit mode the transaction is rolled back. The connection is
+ * then free for other statements, and value raises a RuntimeError. Does
+ * nothing once value has returned.
+ *
+ * Example usage:
+ *
+ *   pending = conn.execute_async("select count(*) from iicolumns a, iicolumns b")
+ *   pending.cancel unless pending.ready?
+ *
+ */
+static VALUE
+ii_async_cancel (VALUE param_self)
+{
+  II_ASYNC *async = NULL;
+
+  Data_Get_Struct(param_self, II_ASYNC, async);
+
+  if (!async->finished && async->ii_conn != NULL && async->ii_conn->async == async)
+  {
+    ii_check_busy (async->ii_conn);
+    ii_async_abandon (async);
+  }
+  return Qnil;
+}
+
+/* Wait for every statement in an II_ASYNC_WAIT to be run by the server.
+ * No Ruby API calls may be made here as it runs without the GVL, and the
+ * connections are not looked at, their deadlines are copied in beforehand.
+ * The wait is given up on when Ruby interrupts the thread, or a statement's
+ * deadline passes, leaving the rest to Ingres::AsyncResult#value */
+static void *
+ii_async_wait_all (void *param_wait)
+{
+  II_ASYNC_WAIT *wait = (II_ASYNC_WAIT *) param_wait;
+  IIAPI_WAITPARM waitParm;
+  II_ASYNC *async;
+  double now;
+  long i;
+  int pending = TRUE;
+
+  while (pending && !wait->interrupted)
+  {
+    pending = FALSE;
+    now = ii_clock_ms ();
+    for (i = 0; i < wait->count; i++)
+    {
+      async = wait->asyncs[i];
+      if (async->completed)
+        continue;
+      if (wait->deadlines[i] > 0 && now >= wait->deadlines[i])
+        return NULL;
+      pending = TRUE;
+    }
+
+    if (pending)
+    {
+      /* wake up now and again to notice an interrupt or a deadline */
+      waitParm.wt_timeout = 100;
+      waitParm.wt_status = IIAPI_ST_SUCCESS;
+      IIapi_wait (&waitParm);
+    }
+  }
+  return NULL;
+}
+
+static void
+ii_async_wait_all_unblock (void *param_wait)
+{
+  II_ASYNC_WAIT *wait = (II_ASYNC_WAIT *) param_wait;
+
+  wait->interrupted = TRUE;
+}
+
+static VALUE
+ii_parallel_execute_body (VALUE param_args)
+{
+  VALUE *args = (VALUE *) param_args;
+  VALUE statements = args[0];
+  VALUE pending = args[1];
+  VALUE statement;
+  VALUE results;
+  II_ASYNC_WAIT wait;
+  long i;
+
+  for (i = 0; i < RARRAY_LEN(statements); i++)
+  {
+    statement = rb_ary_entry (statements, i);
+    Check_Type(statement, T_ARRAY);
+    if (RARRAY_LEN(statement) < 2 || !rb_obj_is_kind_of (rb_ary_entry (statement, 0), cIngres))
+      rb_raise (rb_eArgError, "Each statement must be an Array of an Ingres connection, the SQL and any parameters");
+    rb_ary_push (pending, ii_execute_async ((int) RARRAY_LEN(statement) - 1, RARRAY_PTR(statement) + 1, rb_ary_entry (statement, 0)));
+  }
+
+  wait.count = RARRAY_LEN(pending);
+  wait.asyncs = ALLOCA_N (II_ASYNC *, wait.count);
+  wait.deadlines = ALLOCA_N (double, wait.count);
+  wait.interrupted = FALSE;
+  for (i = 0; i < wait.count; i++)
+  {
+    Data_Get_Struct(rb_ary_entry (pending, i), II_ASYNC, wait.asyncs[i]);
+    wait.deadlines[i] = wait.asyncs[i]->ii_conn->deadline;
+  }
+
+  /* under a fiber scheduler each value polls through the scheduler instead */
+#ifdef HAVE_RB_FIBER_SCHEDULER_CURRENT
+  if (NIL_P(rb_fiber_scheduler_current ()))
+#endif
+  {
+#ifdef HAVE_RB_THREAD_CALL_WITHOUT_GVL2
+    /* other threads may run now, keep them off the connections */
+    for (i = 0; i < wait.count; i++)
+      *wait.asyncs[i]->ii_conn->busy = TRUE;
+    rb_thread_call_without_gvl2 (ii_async_wait_all, &wait, ii_async_wait_all_unblock, &wait);
+    for (i = 0; i < wait.count; i++)
+      *wait.asyncs[i]->ii_conn->busy = FALSE;
+    rb_thread_check_ints ();
+#endif
+  }
+
+  results = rb_ary_new2 (wait.count);
+  for (i = 0; i < wait.count; i++)
+    rb_ary_push (results, ii_async_value (rb_ary_entry (pending, i)));
+  return results;
+}
+
+/* Whatever happened, no statement is left running on a connection */
+static VALUE
+ii_parallel_execute_ensure (VALUE param_args)
+{
+  VALUE *args = (VALUE *) param_args;
+  VALUE pending = args[1];
+  II_ASYNC *async = NULL;
+  long i;
+
+  for (i = 0; i < RARRAY_LEN(pending); i++)
+  {
+    Data_Get_Struct(rb_ary_entry (pending, i), II_ASYNC, async);
+    if (async->ii_conn != NULL && async->ii_conn->async == async)
+      ii_async_abandon (async);
+  }
+  return Qnil;
+}
+
+/*
+ * Document-method: Ingres.parallel_execute
+ *
+ * call-seq:
+ *    Ingres.parallel_execute([[connection, sql[, param_types, param_values]], ...]) -> Array
+ *
+ * Runs a statement on each of a number of connections at the same time,
+ * returning an Array of their results in the same order. Each statement is
+ * given as an Array of the connection followed by the arguments to
+ * Ingres#execute. A connection can only appear once. All the statements
+ * are sent before waiting for any of them, without holding the GVL, so
+ * the whole call takes as long as the slowest statement rather than the
+ * sum of them all.
+ *
+ * The first error is raised once all the statements have been sent, any
+ * statements that have not finished are then cancelled.
+ *
+ * Example usage:
+ *
+ *   counts = Ingres.parallel_execute([
+ *     [shard1, "select count(*) from orders where o_status = ?", "c", "open"],
+ *     [shard2, "select count(*) from orders where o_status = ?", "c", "open"]
+ *   ])
+ *
+ */
+static VALUE
+ii_parallel_execute (VALUE param_class, VALUE param_statements)
+{
+  VALUE args[2];
+  VALUE results;
+  char function_name[] = "ii_parallel_execute";
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  Check_Type(param_statements, T_ARRAY);
+  args[0] = param_statements;
+  args[1] = rb_ary_new2 (RARRAY_LEN(param_statements));
+  results = rb_ensure (ii_parallel_execute_body, (VALUE) args, ii_parallel_execute_ensure, (VALUE) args);
+  RB_GC_GUARD(args[1]);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return results;
+}
+
+static void
+ii_statement_mark (II_STATEMENT *statement)
+{
+  rb_gc_mark (statement->connection);
+  rb_gc_mark (statement->sqlText);
+  rb_gc_mark (statement->params);
+}
+
+/* Release what prepare() allocated, the statement cannot be run again */
+static void
+ii_statement_release (II_STATEMENT *statement)
+{
+  ii_query_text_free (&statement->text);
+  if (statement->setDescrParm.sd_descriptor != NULL)
+    xfree (statement->setDescrParm.sd_descriptor);
+  statement->setDescrParm.sd_descriptor = NULL;
+  statement->closed = TRUE;
+}
+
+static void
+ii_statement_free (II_STATEMENT *statement)
+{
+  if (!statement->closed)
+    ii_statement_release (statement);
+  xfree (statement);
+}
+
+/*
+**      ii_statement_prepare_server() - PREPARE a statement on the server
+**
+**      Description -
+**              The server drops PREPAREd statements at the end of the
+**              transaction, so this is run again by execute() the second
+**              time it is used in each transaction.  The statement is
+**              prepared from the SQL as given, with its ? markers, as the
+**              parameter values are only sent by the EXECUTE.
+*/
+static void
+ii_statement_prepare_server (II_STATEMENT *statement, II_QUERY_OPTIONS *param_options)
+{
+  II_CONN *ii_conn = statement->ii_conn;
+  IIAPI_GETDESCRPARM getDescrParm;
+  II_QUERY_OPTIONS prepareOptions;
+  II_QUERY_TEXT text;
+  VALUE prepareText;
+  char function_name[] = "ii_statement_prepare_server";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  prepareText = rb_str_new2 ("prepare ");
+  rb_str_cat2 (prepareText, statement->name);
+  rb_str_cat2 (prepareText, " from ");
+  rb_str_append (prepareText, statement->sqlText);
+
+  ii_query_options (ii_conn, Qnil, &prepareOptions);
+  prepareOptions.timeout = param_options->timeout;
+
+  text.queryText = StringValueCStr (prepareText);
+  text.procedureName = NULL;
+  text.paramCount = 0;
+  text.converted = FALSE;
+
+  ii_api_query_send (ii_conn, &text, 0, Qnil, IIAPI_QT_QUERY, &prepareOptions, NULL, NULL);
+  ii_api_getDescriptors_send (ii_conn, &getDescrParm, NULL, NULL);
+  ii_sync_query (ii_conn, &(getDescrParm.gd_genParm));
+  ii_execute_query_finish (ii_conn, &getDescrParm, &prepareOptions);
+  RB_GC_GUARD(prepareText);
+
+  statement->preparedTran = ii_conn->tranCount;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+/* Run a statement that is not a repeated query.  Within a transaction it is
+ * PREPAREd on the server once it is used a second time, a statement run
+ * only once is sent as it is rather than costing a PREPARE as well */
+static VALUE
+ii_statement_run (II_STATEMENT *statement, II_QUERY_OPTIONS * param_options)
+{
+  II_CONN *ii_conn = statement->ii_conn;
+  IIAPI_GETDESCRPARM getDescrParm;
+  II_QUERY_TEXT execText;
+  char execQuery[INGRES_STATEMENT_NAME_LEN + 8];
+
+  if (!ii_conn->autocommit && statement->queryType != INGRES_SQL_SELECT &&
+      (statement->preparedTran == ii_conn->tranCount || statement->sentTran == ii_conn->tranCount))
+  {
+    if (statement->preparedTran != ii_conn->tranCount)
+      ii_statement_prepare_server (statement, param_options);
+
+    snprintf (execQuery, sizeof (execQuery), "execute %s", statement->name);
+    execText.queryText = execQuery;
+    execText.procedureName = NULL;
+    execText.paramCount = statement->text.paramCount;
+    execText.converted = FALSE;
+    ii_api_query_send (ii_conn, &execText, RARRAY_LEN(statement->params), statement->params, IIAPI_QT_EXEC, param_options, &statement->setDescrParm, &statement->described);
+  }
+  else
+  {
+    statement->sentTran = ii_conn->tranCount;
+    ii_api_query_send (ii_conn, &statement->text, RARRAY_LEN(statement->params), statement->params, IIAPI_QT_QUERY, param_options, &statement->setDescrParm, &statement->described);
+  }
+
+  ii_api_getDescriptors_send (ii_conn, &getDescrParm, NULL, NULL);
+  ii_sync_query (ii_conn, &(getDescrParm.gd_genParm));
+  return ii_execute_query_finish (ii_conn, &getDescrParm, param_options);
+}
+
+/* FNV-1a, so a repeated query gets the same id in every session */
+static II_UINT4
+ii_repeat_hash (char *param_data, long param_len, II_UINT4 param_hash)
+{
+  long i;
+
+  for (i = 0; i < param_len; i++)
+  {
+    param_hash ^= (unsigned char) param_data[i];
+    param_hash *= 16777619;
+  }
+  return param_hash;
+}
+
+static void
+ii_repeat_descriptor (IIAPI_DESCRIPTOR * sd_descriptor, IIAPI_DT_ID ds_dataType, II_UINT2 ds_length)
+{
+  sd_descriptor->ds_dataType = ds_dataType;
+  sd_descriptor->ds_nullable = FALSE;
+  sd_descriptor->ds_length = ds_length;
+  sd_descriptor->ds_precision = 0;
+  sd_descriptor->ds_scale = 0;
+  sd_descriptor->ds_columnType = IIAPI_COL_SVCPARM;
+  sd_descriptor->ds_columnName = NULL;
+}
+
+/* The service parameters and values of ii_repeat_query_send(), run under
+ * rb_protect() */
+static VALUE
+ii_repeat_query_bind (VALUE param_args)
+{
+  II_BIND_ARGS *args = (II_BIND_ARGS *) param_args;
+  II_STATEMENT *statement = args->statement;
+  II_CONN *ii_conn = args->ii_conn;
+  IIAPI_SETDESCRPARM *setDescrParm = args->setDescrParm;
+  RUBY_PARAMETER parameter;
+  int svcCount;
+  long param;
+
+  if (args->apiQueryType == IIAPI_QT_DEF_REPEAT_QUERY)
+  {
+    svcCount = INGRES_REPEAT_DEFINE_PARMS;
+    ii_repeat_descriptor (&setDescrParm->sd_descriptor[0], IIAPI_INT_TYPE, sizeof (II_INT4));
+    ii_repeat_descriptor (&setDescrParm->sd_descriptor[1], IIAPI_INT_TYPE, sizeof (II_INT4));
+    ii_repeat_descriptor (&setDescrParm->sd_descriptor[2], IIAPI_CHA_TYPE, strlen (statement->name));
+  }
+  else
+  {
+    svcCount = INGRES_REPEAT_EXEC_PARMS;
+    ii_repeat_descriptor (&setDescrParm->sd_descriptor[0], IIAPI_HNDL_TYPE, sizeof (II_PTR));
+  }
+
+  for (param = 0; param < statement->text.paramCount; param++)
+  {
+    getIIParameter (&parameter, statement->params, param, 0);
+    setParameterDescriptor (&setDescrParm->sd_descriptor[svcCount + param], &parameter, 0, ii_conn->lobSegmentSize);
+  }
+  setDescrParm->sd_stmtHandle = ii_conn->stmtHandle;
+  setDescrParm->sd_descriptorCount = svcCount + statement->text.paramCount;
+
+  IIapi_setDescriptor (setDescrParm);
+  ii_sync (ii_conn, &(setDescrParm->sd_genParm));
+  if (ii_checkError (&setDescrParm->sd_genParm))
+    rb_raise (rb_eRuntimeError, "Failed to set parameter descriptors.");
+
+  /* the service parameters go in the same IIapi_putParms() as the values */
+  ii_parm_reset (ii_conn);
+  if (args->apiQueryType == IIAPI_QT_DEF_REPEAT_QUERY)
+  {
+    memcpy (ii_parm_add (ii_conn, FALSE, sizeof (II_INT4)), &statement->repeatId[0], sizeof (II_INT4));
+    memcpy (ii_parm_add (ii_conn, FALSE, sizeof (II_INT4)), &statement->repeatId[1], sizeof (II_INT4));
+    memcpy (ii_parm_add (ii_conn, FALSE, strlen (statement->name)), statement->name, strlen (statement->name));
+  }
+  else
+    memcpy (ii_parm_add (ii_conn, FALSE, sizeof (II_PTR)), &statement->repeatHandle, sizeof (II_PTR));
+
+  for (param = 0; param < statement->text.paramCount; param++)
+  {
+    getIIParameter (&parameter, statement->params, param, 0);
+    putParameter (ii_conn, &parameter);
+  }
+  ii_parm_flush (ii_conn);
+  return Qnil;
+}
+
+/*
+**      ii_repeat_query_send() - Define or run a repeated query
+**
+**      Description -
+**              Both are sent with service parameters ahead of the query's
+**              own: the ids and name of the query when defining it, the
+**              handle the server returned for it when running it.  The
+**              parameter values are sent both times.  A failure sending
+**              them is cleaned up by ii_api_query_abort().
+*/
+static void
+ii_repeat_query_send (II_STATEMENT *statement, II_LONG param_apiQueryType, II_QUERY_OPTIONS * param_options)
+{
+  II_CONN *ii_conn = statement->ii_conn;
+  IIAPI_QUERYPARM queryParm;
+  II_BIND_ARGS args;
+  int state = 0;
+  char function_name[] = "ii_repeat_query_send";
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  queryParm.qy_connHandle = ii_conn->connHandle;
+  queryParm.qy_genParm.gp_callback = NULL;
+  queryParm.qy_genParm.gp_closure = NULL;
+  queryParm.qy_queryType = param_apiQueryType;
+  queryParm.qy_queryText = ((param_apiQueryType == IIAPI_QT_DEF_REPEAT_QUERY) ? statement->text.queryText : NULL);
+  queryParm.qy_parameters = TRUE;
+  queryParm.qy_tranHandle = ii_conn->tranHandle;
+  queryParm.qy_stmtHandle = NULL;
+#if defined(IIAPI_VERSION_6)
+  queryParm.qy_flags  = param_options->queryFlags;
+#endif
+  ii_conn->deadline = ii_deadline (param_options->timeout);
+  ii_conn->moreSegments = FALSE;
+
+  IIapi_query (&queryParm);
+  ii_sync (ii_conn, &(queryParm.qy_genParm));
+  ii_conn->stmtHandle = queryParm.qy_stmtHandle;
+  if (ii_conn->tranHandle == NULL)
+    ii_conn->tranHandle = queryParm.qy_tranHandle;
+
+  args.ii_conn = ii_conn;
+  args.argc = 0;
+  args.params = statement->params;
+  args.procname = NULL;
+  args.paramCount = statement->text.paramCount;
+  args.setDescrParm = &statement->setDescrParm;
+  args.described = NULL;
+  args.statement = statement;
+  args.apiQueryType = param_apiQueryType;
+  rb_protect (ii_repeat_query_bind, (VALUE) &args, &state);
+  if (state)
+    ii_api_query_abort (ii_conn, state);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+/* Define the statement as a repeated query, the server returns a handle
+ * it is run with from then on */
+static void
+ii_statement_define_repeat (II_STATEMENT *statement, II_QUERY_OPTIONS * param_options)
+{
+  II_CONN *ii_conn = statement->ii_conn;
+  IIAPI_GETDESCRPARM getDescrParm;
+  II_QUERY_OPTIONS defineOptions;
+  char function_name[] = "ii_statement_define_repeat";
+  if (ii_globals.debug)
+    printf ("Entering %s, defining %s.\n", function_name, statement->name);
+
+  ii_query_options (ii_conn, Qnil, &defineOptions);
+  defineOptions.timeout = param_options->timeout;
+
+  ii_conn->repeatQueryHandle = NULL;
+  ii_repeat_query_send (statement, IIAPI_QT_DEF_REPEAT_QUERY, &defineOptions);
+  ii_api_getDescriptors_send (ii_conn, &getDescrParm, NULL, NULL);
+  ii_sync_query (ii_conn, &(getDescrParm.gd_genParm));
+  ii_execute_query_finish (ii_conn, &getDescrParm, &defineOptions);
+
+  if (ii_conn->repeatQueryHandle == NULL)
+    rb_raise (rb_eRuntimeError, "The server did not return a handle for the repeated query");
+  statement->repeatHandle = ii_conn->repeatQueryHandle;
+  statement->repeatSession = ii_conn->sessionCount;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+/* Run a repeated query, defining it first if it has not been in this
+ * session.  The server can drop a repeated query at any time, in which
+ * case it says so after the run and the query is defined again */
+static VALUE
+ii_statement_run_repeated (II_STATEMENT *statement, II_QUERY_OPTIONS * param_options)
+{
+  II_CONN *ii_conn = statement->ii_conn;
+  IIAPI_GETDESCRPARM getDescrParm;
+  VALUE ret_val;
+  int attempt;
+
+  for (attempt = 0; attempt < 2; attempt++)
+  {
+    if (statement->repeatHandle == NULL || statement->repeatSession != ii_conn->sessionCount)
+      ii_statement_define_repeat (statement, param_options);
+
+    ii_repeat_query_send (statement, IIAPI_QT_EXEC_REPEAT_QUERY, param_options);
+    ii_api_getDescriptors_send (ii_conn, &getDescrParm, NULL, NULL);
+    ii_sync_query (ii_conn, &(getDescrParm.gd_genParm));
+    ret_val = ii_execute_query_finish (ii_conn, &getDescrParm, param_options);
+
+    if (!(ii_conn->queryInfoFlags & IIAPI_GQF_UNKNOWN_REPEAT_QUERY))
+      return ret_val;
+
+    if (ii_globals.debug)
+      printf ("ii_statement_run_repeated: %s was dropped by the server\n", statement->name);
+    statement->repeatHandle = NULL;
+  }
+
+  rb_raise (rb_eRuntimeError, "The server did not recognise the repeated query after it was defined");
+  return Qnil;
+}
+
+/*
+ * Document-method: prepare
+ *
+ * call-seq:
+ *    Ingres.prepare(sql[, param_type, ...]) -> Ingres::Statement
+ *
+ * Parses _sql_ once and returns an Ingres::Statement that can be run
+ * repeatedly with Ingres::Statement#execute, passing just the parameter
+ * values. A type, as used by execute, must be given for each ? in _sql_.
+ *
+ * Within a transaction statements other than SELECTs are PREPAREd on the
+ * server the second time they are run in each transaction and only
+ * EXECUTEd after that, so one run just once costs no extra round trip.
+ * Otherwise the SQL is sent each time, saving only the work done by the
+ * driver. Procedure calls cannot be prepared.
+ *
+ * A trailing Hash of options may be given, valid hash keys are:
+ *
+ * * <tt>:repeated</tt> - when true a SELECT, INSERT, UPDATE or DELETE is
+ *   run as an Ingres repeated query. The server keeps its query plan, so
+ *   later runs in any session skip parsing and optimizing it. The query is
+ *   defined again if the server has dropped it
+ *
+ * Example usage:
+ *
+ *   find = conn.prepare("select up_first, up_last from user_profile where up_id = ?", "i")
+ *   users = [1, 2, 3].map { |id| find.execute(id).first }
+ *   lookup = conn.prepare("select ap_place from airport where ap_iatacode = ?", "c", :repeated => true)
+ *
+ */
+static VALUE
+ii_prepare (int param_argc, VALUE * param_argv, VALUE param_self)
+{
+  VALUE param_queryText;
+  VALUE types;
+  VALUE options = Qnil;
+  VALUE statement_obj;
+  II_STATEMENT *statement = NULL;
+  II_CONN *ii_conn = NULL;
+  II_UINT4 hash;
+  long i;
+  char function_name[] = "ii_prepare";
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  rb_scan_args (param_argc, param_argv, "1*", &param_queryText, &types);
+  Check_Type(param_queryText, T_STRING);
+
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+
+  if (RARRAY_LEN(types) > 0 && TYPE (rb_ary_entry (types, -1)) == T_HASH)
+    options = rb_ary_pop (types);
+
+  statement_obj = Data_Make_Struct (cIngresStatement, II_STATEMENT, ii_statement_mark, ii_statement_free, statement);
+  statement->ii_conn = ii_conn;
+  statement->connection = param_self;
+  statement->sqlText = rb_obj_freeze (rb_str_new (RSTRING_PTR (param_queryText), RSTRING_LEN (param_queryText)));
+  statement->params = Qnil;
+  statement->preparedTran = -1;
+  statement->sentTran = -1;
+  statement->repeated = (options != Qnil && RTEST (rb_hash_aref (options, ID2SYM (rb_intern ("repeated")))));
+  statement->repeatHandle = NULL;
+  statement->repeatSession = -1;
+  statement->closed = TRUE;
+  statement->queryType = ii_query_type (RSTRING_PTR (statement->sqlText));
+
+  switch (statement->queryType)
+  {
+    case INGRES_SQL_COMMIT:
+    case INGRES_SQL_ROLLBACK:
+    case INGRES_SQL_ROLLBACK_TO:
+    case INGRES_SQL_ROLLBACK_WORK_TO:
+    case INGRES_START_TRANSACTION:
+    case INGRES_SQL_CONNECT:
+    case INGRES_SQL_DISCONNECT:
+    case INGRES_SQL_GETDBEVENT:
+    case INGRES_SQL_SAVEPOINT:
+    case INGRES_SQL_AUTOCOMMIT:
+    case INGRES_SQL_COPY:
+      rb_raise (rb_eArgError, "Only queries can be prepared, use execute");
+  }
+  if (statement->repeated)
+  {
+    switch (statement->queryType)
+    {
+      case INGRES_SQL_SELECT:
+      case INGRES_SQL_INSERT:
+      case INGRES_SQL_UPDATE:
+      case INGRES_SQL_DELETE:
+        break;
+      default:
+        rb_raise (rb_eArgError, "Only SELECT, INSERT, UPDATE and DELETE can be repeated queries");
+    }
+  }
+
+  statement->closed = FALSE;
+  ii_query_text_parse (&statement->text, RSTRING_PTR (statement->sqlText));
+  if (statement->text.procedureName != NULL)
+  {
+    ii_statement_release (statement);
+    rb_raise (rb_eArgError, "Procedure calls cannot be prepared, use execute");
+  }
+  if (RARRAY_LEN(types) != statement->text.paramCount)
+  {
+    ii_statement_release (statement);
+    rb_raise (rb_eArgError, "%ld parameter types given for %ld parameters", RARRAY_LEN(types), statement->text.paramCount);
+  }
+
+  statement->params = rb_ary_new2 (statement->text.paramCount * 2);
+  for (i = 0; i < statement->text.paramCount; i++)
+  {
+    Check_Type(rb_ary_entry (types, i), T_STRING);
+    rb_ary_push (statement->params, rb_obj_freeze (rb_str_dup (rb_ary_entry (types, i))));
+    rb_ary_push (statement->params, Qnil);
+  }
+
+  statement->setDescrParm.sd_genParm.gp_callback = NULL;
+  statement->setDescrParm.sd_genParm.gp_closure = NULL;
+  statement->setDescrParm.sd_stmtHandle = NULL;
+  statement->setDescrParm.sd_descriptorCount = statement->text.paramCount;
+  statement->setDescrParm.sd_descriptor = NULL;
+  statement->described = FALSE;
+  if (statement->repeated)
+    statement->setDescrParm.sd_descriptor = ALLOC_N (IIAPI_DESCRIPTOR, statement->text.paramCount + INGRES_REPEAT_DEFINE_PARMS);
+  else if (statement->text.paramCount > 0)
+    statement->setDescrParm.sd_descriptor = ALLOC_N (IIAPI_DESCRIPTOR, statement->text.paramCount);
+
+  if (statement->repeated)
+  {
+    /* the same text and types give the same id, sharing the plan between sessions */
+    hash = 2166136261U;
+    for (i = 0; i < statement->text.paramCount; i++)
+      hash = ii_repeat_hash (RSTRING_PTR (rb_ary_entry (statement->params, i * 2)), 1, hash);
+    statement->repeatId[0] = (II_INT4) ii_repeat_hash (RSTRING_PTR (statement->sqlText), RSTRING_LEN (statement->sqlText), hash);
+    statement->repeatId[1] = (II_INT4) ii_repeat_hash (RSTRING_PTR (statement->sqlText), RSTRING_LEN (statement->sqlText), (II_UINT4) RSTRING_LEN (statement->sqlText));
+    snprintf (statement->name, INGRES_STATEMENT_NAME_LEN, "ii_rq_%08x%08x", (unsigned int) statement->repeatId[0], (unsigned int) statement->repeatId[1]);
+  }
+  else
+    snprintf (statement->name, INGRES_STATEMENT_NAME_LEN, "ii_stmt_%ld", ++ii_conn->statementCount);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s, prepared as %s.\n", function_name, statement->name);
+  return statement_obj;
+}
+
+/*
+ * Document-method: execute
+ *
+ * call-seq:
+ *    Ingres::Statement.execute([param_value, ...]) -> Array
+ *
+ * Runs the statement with a value for each of its parameters, returning
+ * the same result Ingres#execute would have. A trailing Hash of options
+ * is accepted as for Ingres#execute.
+ *
+ */
+static VALUE
+ii_statement_execute (int param_argc, VALUE * param_argv, VALUE param_self)
+{
+  VALUE values;
+  VALUE options = Qnil;
+  VALUE ret_val;
+  II_STATEMENT *statement = NULL;
+  II_CONN *ii_conn = NULL;
+  II_QUERY_OPTIONS queryOptions;
+  long i;
+  char function_name[] = "ii_statement_execute";
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  rb_scan_args (param_argc, param_argv, "0*", &values);
+  Data_Get_Struct(param_self, II_STATEMENT, statement);
+
+  if (statement->closed)
+    rb_raise (rb_eRuntimeError, "The statement has been closed");
+  ii_conn = statement->ii_conn;
+  if (ii_conn->connHandle == NULL)
+    rb_raise (rb_eRuntimeError, "Unable to execute a statement without a connection");
+  ii_async_check_idle (ii_conn);
+
+  if (RARRAY_LEN(values) > 0 && TYPE (rb_ary_entry (values, -1)) == T_HASH)
+    options = rb_ary_pop (values);
+  if (RARRAY_LEN(values) != statement->text.paramCount)
+    rb_raise (rb_eArgError, "wrong number of parameter values (%ld for %ld)", RARRAY_LEN(values), statement->text.paramCount);
+
+  for (i = 0; i < statement->text.paramCount; i++)
+    rb_ary_store (statement->params, i * 2 + 1, rb_ary_entry (values, i));
+
+  ii_query_options (ii_conn, options, &queryOptions);
+  ii_query_options_check (ii_conn, &queryOptions);
+  ii_conn->queryType = statement->queryType;
+
+  if (statement->repeated)
+    ret_val = ii_statement_run_repeated (statement, &queryOptions);
+  else
+    ret_val = ii_statement_run (statement, &queryOptions);
+
+  /* the values are not kept alive by the statement */
+  for (i = 0; i < statement->text.paramCount; i++)
+    rb_ary_store (statement->params, i * 2 + 1, Qnil);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return ret_val;
+}
+
+/* Run the statement for one row of execute_batch() */
+static VALUE
+ii_statement_batch_row (RB_BLOCK_CALL_FUNC_ARGLIST(param_row, param_args))
+{
+  II_BATCH_ARGS *args = (II_BATCH_ARGS *) param_args;
+  II_STATEMENT *statement = args->statement;
+  VALUE row = rb_check_array_type (param_row);
+  long i;
+
+  if (NIL_P(row))
+    rb_raise (rb_eTypeError, "each row must be an Array of parameter values");
+  if (RARRAY_LEN(row) != statement->text.paramCount)
+    rb_raise (rb_eArgError, "wrong number of parameter values (%ld for %ld)", RARRAY_LEN(row), statement->text.paramCount);
+
+  for (i = 0; i < statement->text.paramCount; i++)
+    rb_ary_store (statement->params, i * 2 + 1, rb_ary_entry (row, i));
+
+  if (statement->repeated)
+    ii_statement_run_repeated (statement, args->options);
+  else
+    ii_statement_run (statement, args->options);
+  args->rowsAffected += statement->ii_conn->rowsAffected;
+
+  RB_GC_GUARD(row);
+  return Qnil;
+}
+
+static VALUE
+ii_statement_batch_body (VALUE param_args)
+{
+  II_BATCH_ARGS *args = (II_BATCH_ARGS *) param_args;
+
+  II_CONN *ii_conn = args->statement->ii_conn;
+
+  rb_block_call (args->rows, rb_intern ("each"), 0, NULL, ii_statement_batch_row, param_args);
+
+  if (args->ownTransaction && ii_conn->tranHandle)
+    ii_api_commit (ii_conn);
+  args->committed = TRUE;
+  return Qnil;
+}
+
+/* However the batch ended, by an error, throw, break or the thread being
+ * killed, none of the rows are kept unless it ran to the end, and a batch
+ * with its own transaction puts auto-commit back on */
+static VALUE
+ii_statement_batch_ensure (VALUE param_args)
+{
+  II_BATCH_ARGS *args = (II_BATCH_ARGS *) param_args;
+  II_CONN *ii_conn = args->statement->ii_conn;
+  long i;
+
+  for (i = 0; i < args->statement->text.paramCount; i++)
+    rb_ary_store (args->statement->params, i * 2 + 1, Qnil);
+
+  if (args->ownTransaction)
+  {
+    if (!args->committed)
+      ii_api_rollback (ii_conn, NULL);
+    ii_conn->autocommit = TRUE;
+  }
+  return Qnil;
+}
+
+/*
+ * Document-method: execute_batch
+ *
+ * call-seq:
+ *    Ingres::Statement.execute_batch(rows) -> Integer
+ *
+ * Runs the statement once for each row of _rows_, an Array or anything
+ * else with an each method, yielding an Array of parameter values per
+ * row. Returns the total number of rows affected, which rows_affected
+ * also returns afterwards. Any results of a SELECT are discarded.
+ *
+ * Unless a transaction is already open all the rows are run in a single
+ * transaction, committed once at the end rather than after every row. The
+ * statement is then PREPAREd on the server once and only EXECUTEd for
+ * each row. If any row fails the transaction is rolled back and the error
+ * raised.
+ *
+ * Example usage:
+ *
+ *   insert = conn.prepare("insert into airport (ap_iatacode, ap_place) values (?, ?)", "c", "v")
+ *   insert.execute_batch([["LHR", "London"], ["CDG", "Paris"]])
+ *
+ */
+static VALUE
+ii_statement_execute_batch (VALUE param_self, VALUE param_rows)
+{
+  II_STATEMENT *statement = NULL;
+  II_CONN *ii_conn = NULL;
+  II_QUERY_OPTIONS queryOptions;
+  II_BATCH_ARGS args;
+  char function_name[] = "ii_statement_execute_batch";
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  Data_Get_Struct(param_self, II_STATEMENT, statement);
+  if (statement->closed)
+    rb_raise (rb_eRuntimeError, "The statement has been closed");
+  ii_conn = statement->ii_conn;
+  if (ii_conn->connHandle == NULL)
+    rb_raise (rb_eRuntimeError, "Unable to execute a statement without a connection");
+  ii_async_check_idle (ii_conn);
+
+  ii_query_options (ii_conn, Qnil, &queryOptions);
+  ii_conn->queryType = statement->queryType;
+
+  args.statement = statement;
+  args.rows = param_rows;
+  args.options = &queryOptions;
+  args.rowsAffected = 0;
+  args.committed = FALSE;
+  /* a cursor still open would be closed by the commit at the end */
+  args.ownTransaction = (ii_conn->autocommit && ii_conn->cursorCount == 0);
+  if (args.ownTransaction)
+    ii_conn->autocommit = FALSE;
+
+  rb_ensure (ii_statement_batch_body, (VALUE) &args, ii_statement_batch_ensure, (VALUE) &args);
+  ii_conn->rowsAffected = args.rowsAffected;
+
+  if (ii_globals.debug)
+    printf ("Exiting %s, %li row(s) affected.\n", function_name, args.rowsAffected);
+  return LONG2NUM (args.rowsAffected);
+}
+
+/*
+ * Document-method: sql
+ *
+ * call-seq:
+ *    Ingres::Statement.sql() -> String
+ *
+ * Returns the SQL the statement was prepared from.
+ *
+ */
+static VALUE
+ii_statement_sql (VALUE param_self)
+{
+  II_STATEMENT *statement = NULL;
+
+  Data_Get_Struct(param_self, II_STATEMENT, statement);
+  return statement->sqlText;
+}
+
+/*
+ * Document-method: close
+ *
+ * call-seq:
+ *    Ingres::Statement.close() -> nil
+ *
+ * Releases the statement, it cannot be executed again. The server forgets
+ * it at the end of the transaction anyway.
+ *
+ */
+static VALUE
+ii_statement_close (VALUE param_self)
+{
+  II_STATEMENT *statement = NULL;
+
+  Data_Get_Struct(param_self, II_STATEMENT, statement);
+  if (!statement->closed)
+  {
+    ii_check_busy (statement->ii_conn);
+    ii_statement_release (statement);
+  }
+  return Qnil;
+}
+
+static VALUE
+ii_execute_many_body (VALUE param_args)
+{
+  VALUE *args = (VALUE *) param_args;
+
+  return ii_statement_execute_batch (args[0], args[1]);
+}
+
+/*
+ * Document-method: execute_many
+ *
+ * call-seq:
+ *    Ingres.execute_many(sql, param_types, rows[, options]) -> Integer
+ *
+ * Prepares _sql_ with the Array _param_types_ and runs it once for each
+ * row of parameter values in _rows_, as Ingres::Statement#execute_batch
+ * does, returning the total number of rows affected. _options_ are passed
+ * on to prepare.
+ *
+ * Example usage:
+ *
+ *   conn.execute_many("insert into airport (ap_iatacode, ap_place) values (?, ?)",
+ *                     ["c", "v"], [["LHR", "London"], ["CDG", "Paris"]])
+ *
+ */
+static VALUE
+ii_execute_many (int param_argc, VALUE * param_argv, VALUE param_self)
+{
+  VALUE sql, types, rows, options;
+  VALUE prepare_args;
+  VALUE args[2];
+  VALUE ret_val;
+  char function_name[] = "ii_execute_many";
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  rb_scan_args (param_argc, param_argv, "31", &sql, &types, &rows, &options);
+  Check_Type(types, T_ARRAY);
+
+  prepare_args = rb_ary_dup (types);
+  rb_ary_unshift (prepare_args, sql);
+  if (!NIL_P(options))
+    rb_ary_push (prepare_args, options);
+
+  args[0] = ii_prepare ((int) RARRAY_LEN(prepare_args), RARRAY_PTR(prepare_args), param_self);
+  args[1] = rows;
+  ret_val = rb_ensure (ii_execute_many_body, (VALUE) args, ii_statement_close, args[0]);
+  RB_GC_GUARD(prepare_args);
+  RB_GC_GUARD(args[0]);
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+  return ret_val;
+}
+
+/* Table and column names are put into the COPY statement as given */
+static void
+ii_copy_check_name (VALUE param_name, int param_qualified)
+{
+  char *name;
+  long i;
+
+  Check_Type(param_name, T_STRING);
+  name = RSTRING_PTR (param_name);
+  if (RSTRING_LEN (param_name) == 0)
+    rb_raise (rb_eArgError, "A table or column name cannot be empty");
+  for (i = 0; i < RSTRING_LEN (param_name); i++)
+  {
+    if (!(isalnum ((unsigned char) name[i]) || name[i] == '_' || name[i] == '#' || name[i] == '@' || name[i] == '$' || (param_qualified && name[i] == '.')))
+      rb_raise (rb_eArgError, "Invalid table or column name %s", name);
+  }
+}
+
+/*
+**      ii_copy_value() - Queue a value for a column of the table being loaded
+**
+**      Description -
+**              COPY sends rows in the format of the table, described by
+**              cp_dbmsDescr in the copy map, so each value is converted
+**              here rather than by the server.  Types without a simple
+**              encoding are converted from their string form by
+**              IIapi_formatData().
+*/
+static void
+ii_copy_value (II_CONN *ii_conn, IIAPI_DESCRIPTOR * param_descr, VALUE param_value)
+{
+  IIAPI_FORMATPARM formatParm;
+  VALUE str = Qnil;
+  char *buffer = NULL;
+  char *columnName = (param_descr->ds_columnName ? param_descr->ds_columnName : "column");
+  long value_len;
+  long ucs2strLen;
+  long i;
+
+  if (NIL_P(param_value))
+  {
+    if (!param_descr->ds_nullable)
+      rb_raise (rb_eArgError, "%s cannot be NULL", columnName);
+    memset (ii_parm_add (ii_conn, TRUE, param_descr->ds_length), 0, param_descr->ds_length);
+    return;
+  }
+
+  switch (param_descr->ds_dataType)
+  {
+    case IIAPI_INT_TYPE:
+      {
+        LONG_LONG number = NUM2LL (rb_Integer (param_value));
+        II_INT1 int1 = (II_INT1) number;
+        II_INT2 int2 = (II_INT2) number;
+        II_INT4 int4 = (II_INT4) number;
+        II_INT8 int8 = (II_INT8) number;
+
+        /* the server would take the truncated value without complaint */
+        if ((param_descr->ds_length == 1 && int1 != number) ||
+            (param_descr->ds_length == 2 && int2 != number) ||
+            (param_descr->ds_length == 4 && int4 != number))
+          rb_raise (rb_eArgError, "Value %lld out of range for %s", number, columnName);
+
+        buffer = ii_parm_add (ii_conn, FALSE, param_descr->ds_length);
+        switch (param_descr->ds_length)
+        {
+          case 1:
+            memcpy (buffer, &int1, 1);
+            break;
+          case 2:
+            memcpy (buffer, &int2, 2);
+            break;
+          case 4:
+            memcpy (buffer, &int4, 4);
+            break;
+          default:
+            memcpy (buffer, &int8, 8);
+            break;
+        }
+      }
+      break;
+
+    case IIAPI_FLT_TYPE:
+      {
+        double number = NUM2DBL (rb_Float (param_value));
+        float number4 = (float) number;
+
+        buffer = ii_parm_add (ii_conn, FALSE, param_descr->ds_length);
+        if (param_descr->ds_length == sizeof (float))
+          memcpy (buffer, &number4, sizeof (float));
+        else
+          memcpy (buffer, &number, sizeof (double));
+      }
+      break;
+
+    case IIAPI_CHA_TYPE:
+    case IIAPI_CHR_TYPE:
+    case IIAPI_BYTE_TYPE:
+      str = rb_obj_as_string (param_value);
+      value_len = RSTRING_LEN (str);
+      if (value_len > param_descr->ds_length)
+        rb_raise (rb_eArgError, "Value too long for %s", columnName);
+      /* fixed length, padded out with blanks */
+      buffer = ii_parm_add (ii_conn, FALSE, param_descr->ds_length);
+      memcpy (buffer, RSTRING_PTR (str), value_len);
+      memset (buffer + value_len, (param_descr->ds_dataType == IIAPI_BYTE_TYPE) ? 0 : ' ', param_descr->ds_length - value_len);
+      break;
+
+    case IIAPI_VCH_TYPE:
+    case IIAPI_TXT_TYPE:
+    case IIAPI_VBYTE_TYPE:
+      str = rb_obj_as_string (param_value);
+      value_len = RSTRING_LEN (str);
+      if (value_len + 2 > param_descr->ds_length)
+        rb_raise (rb_eArgError, "Value too long for %s", columnName);
+      /* set the 1st 2 bytes as the length of the string */
+      buffer = ii_parm_add (ii_conn, FALSE, value_len + 2);
+      *((II_UINT2 *) buffer) = (II_UINT2) value_len;
+      memcpy (buffer + 2, RSTRING_PTR (str), value_len);
+      break;
+
+    case IIAPI_NCHA_TYPE:
+      str = rb_obj_as_string (param_value);
+      value_len = RSTRING_LEN (str);
+      ucs2strLen = value_len * sizeof (UCS2);
+      buffer = ii_parm_add (ii_conn, FALSE, (ucs2strLen > param_descr->ds_length ? ucs2strLen : param_descr->ds_length) + sizeof (UCS2));
+      if (utf8_to_utf16 (RSTRING_PTR (str), RSTRING_PTR (str) + value_len, (UCS2 *) buffer,
+                         (UCS2 *) (buffer + ucs2strLen), &ucs2strLen))
+        rb_raise (rb_eRuntimeError, "Error! Failed to transcode %s to utf16.\n", RSTRING_PTR (str));
+      if (ucs2strLen * sizeof (UCS2) > param_descr->ds_length)
+        rb_raise (rb_eArgError, "Value too long for %s", columnName);
+      /* fixed length, padded out with blanks */
+      for (i = ucs2strLen; i < param_descr->ds_length / sizeof (UCS2); i++)
+        ((UCS2 *) buffer)[i] = (UCS2) ' ';
+      ii_parm_trim (ii_conn, param_descr->ds_length);
+      break;
+
+    case IIAPI_NVCH_TYPE:
+      str = rb_obj_as_string (param_value);
+      value_len = RSTRING_LEN (str);
+      ucs2strLen = value_len * sizeof (UCS2);
+      /* leave 2 bytes at the start for the size of the string in chars */
+      buffer = ii_parm_add (ii_conn, FALSE, 2 + ucs2strLen + sizeof (UCS2));
+      if (utf8_to_utf16 (RSTRING_PTR (str), RSTRING_PTR (str) + value_len, (UCS2 *) (buffer + 2),
+                         (UCS2 *) (buffer + 2 + ucs2strLen), &ucs2strLen))
+        rb_raise (rb_eRuntimeError, "Error! Failed to transcode %s to utf16.\n", RSTRING_PTR (str));
+      if (ucs2strLen * sizeof (UCS2) + 2 > param_descr->ds_length)
+        rb_raise (rb_eArgError, "Value too long for %s", columnName);
+      *((II_INT2 *) buffer) = (II_INT2) ucs2strLen;
+      ii_parm_trim (ii_conn, ucs2strLen * sizeof (UCS2) + 2);
+      break;
+
+    case IIAPI_LNVCH_TYPE:
+    case IIAPI_LBYTE_TYPE:
+    case IIAPI_LVCH_TYPE:
+#if defined(IIAPI_QF_LOCATORS)
+    case IIAPI_LNLOC_TYPE:
+    case IIAPI_LBLOC_TYPE:
+    case IIAPI_LCLOC_TYPE:
+#endif
+      rb_raise (rb_eArgError, "%s is a LOB, which copy_in cannot load", columnName);
+      break;
+
+    default:
+      str = rb_obj_as_string (param_value);
+      buffer = ii_parm_add (ii_conn, FALSE, param_descr->ds_length);
+      formatParm.fd_envHandle = ii_conn->envHandle;
+      formatParm.fd_srcDesc.ds_dataType = IIAPI_CHA_TYPE;
+      formatParm.fd_srcDesc.ds_nullable = FALSE;
+      formatParm.fd_srcDesc.ds_length = RSTRING_LEN (str);
+      formatParm.fd_srcDesc.ds_precision = 0;
+      formatParm.fd_srcDesc.ds_scale = 0;
+      formatParm.fd_srcDesc.ds_columnType = IIAPI_COL_TUPLE;
+      formatParm.fd_srcDesc.ds_columnName = NULL;
+      formatParm.fd_srcValue.dv_null = FALSE;
+      formatParm.fd_srcValue.dv_length = RSTRING_LEN (str);
+      formatParm.fd_srcValue.dv_value = RSTRING_PTR (str);
+      formatParm.fd_dstDesc = *param_descr;
+      formatParm.fd_dstDesc.ds_nullable = FALSE;
+      formatParm.fd_dstValue.dv_null = FALSE;
+      formatParm.fd_dstValue.dv_length = param_descr->ds_length;
+      formatParm.fd_dstValue.dv_value = buffer;
+      IIapi_formatData (&formatParm);
+      if (formatParm.fd_status != IIAPI_ST_SUCCESS)
+        rb_raise (rb_eArgError, "Unable to convert %s for %s", RSTRING_PTR (str), columnName);
+      break;
+  }
+  RB_GC_GUARD(str);
+}
+
+/* Send the rows queued by ii_copy_value() in a single IIapi_putColumns() */
+static void
+ii_copy_flush (II_CONN *ii_conn)
+{
+  II_ROW_ARENA *arena = &ii_conn->arena;
+  IIAPI_PUTCOLPARM putColParm;
+  long parm;
+  char function_name[] = "ii_copy_flush";
+
+  if (arena->parmCount == 0)
+    return;
+
+  if (ii_globals.debug)
+    printf ("Entering %s, %li column(s).\n", function_name, arena->parmCount);
+
+  /* the buffer may have moved as it grew */
+  for (parm = 0; parm < arena->parmCount; parm++)
+    arena->parmData[parm].dv_value = arena->parmBuffer + arena->parmOffset[parm];
+
+  putColParm.pc_genParm.gp_callback = NULL;
+  putColParm.pc_genParm.gp_closure = NULL;
+  putColParm.pc_stmtHandle = ii_conn->stmtHandle;
+  putColParm.pc_columnCount = (II_INT2) arena->parmCount;
+  putColParm.pc_columnData = arena->parmData;
+  putColParm.pc_moreSegments = FALSE;
+  ii_parm_reset (ii_conn);
+
+  IIapi_putColumns (&putColParm);
+  ii_sync_query (ii_conn, &(putColParm.pc_genParm));
+
+  if (ii_checkError (&(putColParm.pc_genParm)))
+    rb_raise (rb_eRuntimeError, "Error sending rows to COPY.");
+
+  if (ii_globals.debug)
+    printf ("Exiting %s.\n", function_name);
+}
+
+/* Queue one row of copy_in(), sending the block once it is full */
+static VALUE
+ii_copy_row (RB_BLOCK_CALL_FUNC_ARGLIST(param_row, param_args))
+{
+  static ID id_chomp = 0;
+  static ID id_split = 0;
+  II_COPY_ARGS *args = (II_COPY_ARGS *) param_args;
+  II_CONN *ii_conn = args->ii_conn;
+  IIAPI_COPYMAP *copyMap = args->copyMap;
+  VALUE row;
+  VALUE value;
+  long column;
+
+  if (!id_chomp)
+  {
+    id_chomp = rb_intern ("chomp");
+    id_split = rb_intern ("split");
+  }
+
+  if (args->lines)
+  {
+    Check_Type(param_row, T_STRING);
+    row = rb_funcall (rb_funcall (param_row, id_chomp, 0), id_split, 2, args->delimiter, INT2FIX(-1));
+  }
+  else
+  {
+    row = rb_check_array_type (param_row);
+    if (NIL_P(row))
+      rb_raise (rb_eTypeError, "each row must be an Array of values");
+  }
+  if (RARRAY_LEN(row) != args->columnCount)
+    rb_raise (rb_eArgError, "wrong number of values in row %ld (%ld for %ld)", args->rowCount + 1, RARRAY_LEN(row), args->columnCount);
+
+  for (column = 0; column < copyMap->cp_dbmsCount; column++)
+  {
+    value = (args->columnMap[column] < 0) ? Qnil : rb_ary_entry (row, args->columnMap[column]);
+    if (args->lines && !NIL_P(args->nullString) && !NIL_P(value) && rb_str_equal (value, args->nullString) == Qtrue)
+      value = Qnil;
+    ii_copy_value (ii_conn, &copyMap->cp_dbmsDescr[column], value);
+  }
+  args->rowCount++;
+
+  /* only whole rows are sent */
+  if (ii_conn->arena.parmUsed >= INGRES_COPY_BLOCK_SIZE || ii_conn->arena.parmCount + copyMap->cp_dbmsCount > INGRES_COPY_MAX_COLUMNS)
+    ii_copy_flush (ii_conn);
+
+  RB_GC_GUARD(row);
+  return Qnil;
+}
+
+static VALUE
+ii_copy_body (VALUE param_args)
+{
+  II_COPY_ARGS *args = (II_COPY_ARGS *) param_args;
+
+  ii_parm_reset (args->ii_conn);
+  rb_block_call (args->source, rb_intern (args->lines ? "each_line" : "each"), 0, NULL, ii_copy_row, param_args);
+  ii_copy_flush (args->ii_conn);
+  return Qnil;
+}
+
+/* The COPY is abandoned as a whole, none of the rows are kept */
+static VALUE
+ii_copy_rescue (VALUE param_args, VALUE param_exception)
+{
+  II_COPY_ARGS *args = (II_COPY_ARGS *) param_args;
+  II_CONN *ii_conn = args->ii_conn;
+
+  ii_parm_reset (ii_conn);
+  if (ii_conn->stmtHandle)
+    ii_api_query_close (ii_conn);
+  if (ii_conn->autocommit && ii_conn->cursorCount == 0)
+    ii_api_rollback (ii_conn, NULL);
+  rb_exc_raise (param_exception);
+  return Qnil;
+}
+
+/*
+ * Document-method: copy_in
+ *
+ * call-seq:
+ *    Ingres.copy_in(table, columns, rows[, options]) -> Integer
+ *
+ * Bulk loads _rows_ into the named _columns_ of _table_ with the Ingres
+ * COPY statement, the fastest way of getting data into a table. Returns
+ * the number of rows loaded.
+ *
+ * _rows_ can be anything with an each method yielding an Array of values
+ * per row, in the order of _columns_. An IO, or anything else with an
+ * each_line method, is instead read a line at a time and each line split
+ * into values. Rows are converted and sent to the server in blocks of
+ * about 64KB, so memory use does not depend on the number of rows.
+ *
+ * Table columns not named must be nullable, they are loaded as NULL. LOB
+ * columns cannot be loaded. Unless a transaction is open the COPY is
+ * committed when all the rows have been sent, if a row fails none of them
+ * are kept.
+ *
+ * Valid hash keys for _options_ are:
+ *
+ * * <tt>:delimiter</tt> - separates the values in each line read from an
+ *   IO, a tab by default
+ * * <tt>:null</tt> - a value in a line read from an IO to be loaded as
+ *   NULL, none by default
+ *
  * Example usage:
  *
- *   conn = Ingres.new()
- *   conn.connect(:database => "demodb")
- *   results = conn.execute("select up_first, up_last, up_email from user_profile where up_id = ?", "i", 1)
+ *   conn.copy_in("airport", ["ap_iatacode", "ap_place"], [["LHR", "London"], ["CDG", "Paris"]])
+ *   File.open("airports.csv") { |f| conn.copy_in("airport", ["ap_iatacode", "ap_place"], f, :delimiter => ",") }
  *
  */
-VALUE
-ii_execute (int param_argc, VALUE * param_argv, VALUE param_self)
+static VALUE
+ii_copy_in (int param_argc, VALUE * param_argv, VALUE param_self)
 {
-  VALUE ret_val = Qnil;
-  VALUE param_queryText;
-  VALUE params;
-  VALUE savePtName;
-  int i;
-  char function_name[] = "ii_execute";
-  II_CONN *ii_conn;
+  VALUE table, columns, source, options;
+  VALUE sql_string;
+  IIAPI_GETCOPYMAPPARM getCopyMapParm;
+  II_QUERY_OPTIONS queryOptions;
+  II_COPY_ARGS args;
+  II_CONN *ii_conn = NULL;
+  char *columnName;
+  long column, i;
+  char function_name[] = "ii_copy_in";
 
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  rb_scan_args (param_argc, param_argv, "1*", &param_queryText, &params);
-
-  Check_Type(param_queryText, T_STRING);
-
+  rb_scan_args (param_argc, param_argv, "31", &table, &columns, &source, &options);
   Data_Get_Struct(param_self, II_CONN, ii_conn);
+  if (ii_conn->connHandle == NULL)
+    rb_raise (rb_eRuntimeError, "Unable to copy without a connection");
+  ii_async_check_idle (ii_conn);
+
+  ii_copy_check_name (table, TRUE);
+  Check_Type(columns, T_ARRAY);
+  if (RARRAY_LEN(columns) == 0)
+    rb_raise (rb_eArgError, "At least one column must be given");
+
+  args.ii_conn = ii_conn;
+  args.source = source;
+  args.columnCount = RARRAY_LEN(columns);
+  args.lines = (TYPE (source) != T_ARRAY && rb_respond_to (source, rb_intern ("each_line")));
+  args.delimiter = rb_str_new2 ("\t");
+  args.nullString = Qnil;
+  args.rowCount = 0;
+  if (!NIL_P(options))
+  {
+    Check_Type(options, T_HASH);
+    if (!NIL_P(rb_hash_aref (options, ID2SYM (rb_intern ("delimiter")))))
+    {
+      args.delimiter = rb_hash_aref (options, ID2SYM (rb_intern ("delimiter")));
+      StringValue (args.delimiter);
+    }
+    args.nullString = rb_hash_aref (options, ID2SYM (rb_intern ("null")));
+    if (!NIL_P(args.nullString))
+      StringValue (args.nullString);
+  }
 
-  /* determine what sort of query is being executed */
-  if (ii_globals.debug)
-    printf ("Classifying query\n");
-  ii_conn->queryType = ii_query_type(RSTRING_PTR (param_queryText));
-  if (ii_globals.debug)
-    printf ("Classified query\n");
+  /* the rows are sent in the table's format, the formats here only
+   * describe them to the server */
+  sql_string = rb_str_new2 ("copy table ");
+  rb_str_append (sql_string, table);
+  rb_str_cat2 (sql_string, " (");
+  for (i = 0; i < args.columnCount; i++)
+  {
+    ii_copy_check_name (rb_ary_entry (columns, i), FALSE);
+    if (i > 0)
+      rb_str_cat2 (sql_string, ", ");
+    rb_str_append (sql_string, rb_ary_entry (columns, i));
+    rb_str_cat2 (sql_string, " = varchar(0) with null");
+  }
+  rb_str_cat2 (sql_string, ") from 'copy_in'");
+
+  ii_query_options (ii_conn, Qnil, &queryOptions);
+  ii_conn->queryType = INGRES_SQL_COPY;
+  ii_api_query (ii_conn, RSTRING_PTR (sql_string), 0, Qnil, IIAPI_QT_QUERY, &queryOptions);
+
+  getCopyMapParm.gm_genParm.gp_callback = NULL;
+  getCopyMapParm.gm_genParm.gp_closure = NULL;
+  getCopyMapParm.gm_stmtHandle = ii_conn->stmtHandle;
+  IIapi_getCopyMap (&getCopyMapParm);
+  ii_sync_query (ii_conn, &(getCopyMapParm.gm_genParm));
+  if (ii_checkError (&(getCopyMapParm.gm_genParm)))
+  {
+    ii_api_query_close (ii_conn);
+    if (ii_conn->autocommit && ii_conn->cursorCount == 0)
+      ii_api_rollback (ii_conn, NULL);
+    rb_raise (rb_eRuntimeError, "Unable to copy into %s", RSTRING_PTR (table));
+  }
+  args.copyMap = &getCopyMapParm.gm_copyMap;
 
-  switch (ii_conn->queryType)
+  /* match each column of the table to a value in the rows, by name */
+  args.columnMap = ALLOCA_N (long, args.copyMap->cp_dbmsCount);
+  for (column = 0; column < args.copyMap->cp_dbmsCount; column++)
   {
-    case INGRES_SQL_COMMIT:
-      if (ii_conn->tranHandle != NULL)
-        ii_api_commit (ii_conn);
-      else if (ii_globals.debug || ii_globals.debug_transactions)
-        rb_warn ("Attempting to ii_api_commit a non-existent transaction");
-      break;
-    case INGRES_SQL_ROLLBACK:
-      if (ii_conn->tranHandle != NULL)
-        ii_api_rollback (ii_conn, NULL);
-      else if (ii_globals.debug || ii_globals.debug_transactions)
-        rb_warn ("Attempting to ii_api_rollback a non-existent transaction");
-      break;
-    case INGRES_SQL_ROLLBACK_TO:
-    case INGRES_SQL_ROLLBACK_WORK_TO:
-      /* ROLLBACK [WORK] TO SAVEPOINT */
-      if (ii_conn->tranHandle == NULL)
-      {
-        rb_raise (rb_eRuntimeError, "Unable to rollback a non-existent transaction");
-      }
-      else
-      {
-        /* Extract Savepoint name */
-        savePtName = ii_savepoint_name(ii_conn, StringValuePtr(param_queryText));
-        ii_rollback (1, &savePtName, param_self);
-      }
-      break;
-    case INGRES_START_TRANSACTION:
-      startTransaction (param_self);
-      break;
-    case INGRES_SQL_CONNECT:
-      rb_warn ("Use connect() to connect to a database");
-      break;
-    case INGRES_SQL_DISCONNECT:
-      rb_warn ("Use disconnect() to disconnect from a database");
-      break;
-    case INGRES_SQL_GETDBEVENT:
-      rb_warn ("Ingres 'GET DBEVENT' is not supported at the current time");
-      break;
-    case INGRES_SQL_SAVEPOINT:
-      /* We cannot generate a save point if there is no transaction or if auto commit is in effect */
-      if (ii_conn->tranHandle == NULL)
-      {
-        rb_raise (rb_eRuntimeError, "Unable to generate a save point if there is no active transaction");
-      }
-      else
-      {
-        /* Extract Savepoint name */
-        savePtName = ii_savepoint_name(ii_conn, StringValuePtr(param_queryText));
-        ii_api_savepoint (ii_conn, savePtName);
-      }
-      break;
-    case INGRES_SQL_AUTOCOMMIT:
-      rb_warn ("Use autocommit() to set the auto-commit state");
-      break;
-    case INGRES_SQL_COPY:
-      rb_warn ("Ingres 'COPY TABLE() INTO/FROM' is not supported at the current time");
-      break;
-    case INGRES_SQL_SELECT:
-    case INGRES_SQL_INSERT:
-    case INGRES_SQL_UPDATE:
-    case INGRES_SQL_DELETE:
-    case INGRES_SQL_CREATE:
-    case INGRES_SQL_ALTER:
-    case INGRES_SQL_EXECUTE_PROCEDURE:
-    case INGRES_SQL_CALL:
-    default:
-      if (ii_globals.debug || ii_globals.debug_transactions)
-        printf ("Executing %s\n", StringValuePtr (param_queryText));
-      ret_val = ii_execute_query (ii_conn, StringValuePtr (param_queryText), param_argc - 1, params);
-      break;
+    columnName = args.copyMap->cp_dbmsDescr[column].ds_columnName;
+    args.columnMap[column] = -1;
+    for (i = 0; i < args.columnCount; i++)
+    {
+      if (columnName ? (strcasecmp (columnName, RSTRING_PTR (rb_ary_entry (columns, i))) == 0) : (column == i))
+        args.columnMap[column] = i;
+    }
   }
 
+  rb_rescue2 (ii_copy_body, (VALUE) &args, ii_copy_rescue, (VALUE) &args, rb_eException, (VALUE) 0);
+
+  /* all the rows have been sent, ending the COPY */
+  getRowsAffected (ii_conn);
+  ii_api_query_close (ii_conn);
+  ii_conn->rowsAffected = args.rowCount;
+  if (ii_conn->autocommit && ii_conn->cursorCount == 0)
+    ii_api_commit (ii_conn);
+
+  RB_GC_GUARD(sql_string);
+  RB_GC_GUARD(args.delimiter);
+  RB_GC_GUARD(args.nullString);
+
   if (ii_globals.debug)
-    printf ("Exiting %s.\n", function_name);
-  return ret_val;
+    printf ("Exiting %s, %li row(s) copied.\n", function_name, args.rowCount);
+  return LONG2NUM (args.rowCount);
 }
 
 /* 
@@ -3452,11 +8204,13 @@ VALUE
 ii_rows_affected (VALUE param_self)
 {
   VALUE return_value;
+  II_CONN *ii_conn = NULL;
   char function_name[] = "ii_rows_affected";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
 
-  return_value = INT2NUM (global_rows_affected);
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+  return_value = INT2NUM (ii_conn->rowsAffected);
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -3552,6 +8306,129 @@ ii_data_sizes (VALUE param_self)
 }
 
 
+/* 
+ * Document-method: fetch_rows
+ *
+ * call-seq:
+ *    Ingres.fetch_rows() -> Fixnum
+ *
+ * Returns the number of rows fetched from the server per call. 0 means the
+ * driver sizes each fetch from the width of the result set columns.
+ *
+ */
+VALUE
+ii_get_fetch_rows (VALUE param_self)
+{
+  char function_name[] = "ii_get_fetch_rows";
+  II_CONN *ii_conn = NULL;
+
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  return INT2FIX (ii_conn->fetchRows);
+}
+
+
+/* 
+ * Document-method: fetch_rows=
+ *
+ * call-seq:
+ *    Ingres.fetch_rows = rows
+ *
+ * Sets the number of rows fetched from the server per call for this
+ * connection. Use 0 (the default) to have the driver size each fetch from
+ * the width of the result set columns. Result sets containing LOB columns
+ * are always fetched a row at a time.
+ *
+ * Example usage:
+ *
+ *    conn = Ingres.new()
+ *    conn.connect(:database => "demodb")
+ *    conn.fetch_rows = 200
+ *
+ */
+VALUE
+ii_set_fetch_rows (VALUE param_self, VALUE param_fetchRows)
+{
+  char function_name[] = "ii_set_fetch_rows";
+  II_CONN *ii_conn = NULL;
+
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  ii_conn->fetchRows = ii_fetch_rows_value (param_fetchRows);
+
+  return param_fetchRows;
+}
+
+
+/* 
+ * Document-method: timeout
+ *
+ * call-seq:
+ *    Ingres.timeout() -> Float or nil
+ *
+ * Returns the default statement timeout in seconds, or nil if statements
+ * may run for as long as they need.
+ *
+ */
+VALUE
+ii_get_timeout (VALUE param_self)
+{
+  char function_name[] = "ii_get_timeout";
+  II_CONN *ii_conn = NULL;
+
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  return (ii_conn->timeout > 0) ? rb_float_new (ii_conn->timeout / 1000.0) : Qnil;
+}
+
+
+/* 
+ * Document-method: timeout=
+ *
+ * call-seq:
+ *    Ingres.timeout = seconds
+ *
+ * Sets the default number of seconds a statement may run for on this
+ * connection, including fetching its rows. Once it has run for longer the
+ * statement is cancelled on the server and Ingres::TimeoutError raised. In
+ * auto-commit mode the transaction is rolled back, otherwise it is left for
+ * the application to commit or roll back. Use nil or 0 (the default) for no
+ * timeout. Can be overridden for a single statement with the
+ * <tt>:timeout</tt> option to execute.
+ *
+ * Example usage:
+ *
+ *    conn = Ingres.new()
+ *    conn.connect(:database => "demodb")
+ *    conn.timeout = 2.5
+ *
+ */
+VALUE
+ii_set_timeout (VALUE param_self, VALUE param_timeout)
+{
+  char function_name[] = "ii_set_timeout";
+  II_CONN *ii_conn = NULL;
+
+  Data_Get_Struct(param_self, II_CONN, ii_conn);
+
+  if (ii_globals.debug)
+    printf ("Entering %s.\n", function_name);
+
+  ii_conn->timeout = ii_timeout_value (param_timeout);
+
+  return param_timeout;
+}
+
+
 /* 
  * Document-method: set_debug_flag
  *
@@ -3679,10 +8556,16 @@ Init_Ingres ()
   /* Source code revision level */
   rb_define_const(cIngres, "REVISION", rb_str_new2 ("$Rev$"));
 
+  rb_define_singleton_method (cIngres, "parallel_execute", ii_parallel_execute, 1);
   rb_define_method (cIngres, "initialize", ii_init, 0);
   rb_define_method (cIngres, "connect", ii_connect, -1);
   rb_define_method (cIngres, "disconnect", ii_disconnect, 0);
   rb_define_method (cIngres, "execute", ii_execute, -1);
+  rb_define_method (cIngres, "prepare", ii_prepare, -1);
+  rb_define_method (cIngres, "execute_many", ii_execute_many, -1);
+  rb_define_method (cIngres, "copy_in", ii_copy_in, -1);
+  rb_define_method (cIngres, "execute_async", ii_execute_async, -1);
+  rb_define_method (cIngres, "each_row", ii_each_row, -1);
   rb_define_method (cIngres, "tables", ii_tables, 0);
   rb_define_method (cIngres, "current_database", ii_current_database, 0);
   rb_define_method (cIngres, "data_types", ii_return_data_types, 0);
@@ -3690,6 +8573,11 @@ Init_Ingres ()
   rb_define_method (cIngres, "column_list_of_names", ii_column_names, 0);
   rb_define_method (cIngres, "data_sizes", ii_data_sizes, 0);
   rb_define_method (cIngres, "set_environment", ii_set_environment, -1);
+  rb_define_method (cIngres, "fetch_rows", ii_get_fetch_rows, 0);
+  rb_define_method (cIngres, "fetch_rows=", ii_set_fetch_rows, 1);
+  rb_define_method (cIngres, "timeout", ii_get_timeout, 0);
+  rb_define_method (cIngres, "timeout=", ii_set_timeout, 1);
+  rb_define_method (cIngres, "cursor", ii_cursor_open, -1);
 
   /* Transaction Methods */
   rb_define_method (cIngres, "commit", ii_commit, 0);
@@ -3729,6 +8617,53 @@ Init_Ingres ()
   /* YMD Date format */
   rb_define_const(cIngres,"DATE_FORMAT_YMD", INT2FIX(IIAPI_CPV_DFRMT_YMD));
 
+  /* Statements sent by execute_async */
+  cIngresAsyncResult = rb_define_class_under (cIngres, "AsyncResult", rb_cObject);
+  rb_undef_alloc_func (cIngresAsyncResult);
+  rb_define_method (cIngresAsyncResult, "ready?", ii_async_ready, 0);
+  rb_define_method (cIngresAsyncResult, "value", ii_async_value, 0);
+  rb_define_method (cIngresAsyncResult, "cancel", ii_async_cancel, 0);
+
+  /* Define Ingres::Statement, returned by prepare() */
+  cIngresStatement = rb_define_class_under (cIngres, "Statement", rb_cObject);
+  rb_undef_alloc_func (cIngresStatement);
+  rb_define_method (cIngresStatement, "execute", ii_statement_execute, -1);
+  rb_define_method (cIngresStatement, "execute_batch", ii_statement_execute_batch, 1);
+  rb_define_method (cIngresStatement, "sql", ii_statement_sql, 0);
+  rb_define_method (cIngresStatement, "close", ii_statement_close, 0);
+
+  /* Raised when a statement runs for longer than its timeout */
+  cIngresTimeoutError = rb_define_class_under (cIngres, "TimeoutError", rb_eRuntimeError);
+
+  /* Server side cursors, created with Ingres#cursor */
+  cIngresCursor = rb_define_class_under (cIngres, "Cursor", rb_cObject);
+  rb_undef_alloc_func (cIngresCursor);
+  rb_define_method (cIngresCursor, "fetch", ii_cursor_fetch, -1);
+  rb_define_method (cIngresCursor, "columns", ii_cursor_columns, 0);
+  rb_define_method (cIngresCursor, "close", ii_cursor_close, 0);
+  rb_define_method (cIngresCursor, "closed?", ii_cursor_closed, 0);
+
+  /* Lazily converted result sets, returned by execute with :lazy => true */
+  cIngresResult = rb_define_class_under (cIngres, "Result", rb_cObject);
+  rb_undef_alloc_func (cIngresResult);
+  rb_include_module (cIngresResult, rb_mEnumerable);
+  rb_define_method (cIngresResult, "size", ii_result_size, 0);
+  rb_define_method (cIngresResult, "columns", ii_result_columns, 0);
+  rb_define_method (cIngresResult, "[]", ii_result_aref, -1);
+  rb_define_method (cIngresResult, "column", ii_result_column, 1);
+  rb_define_method (cIngresResult, "each", ii_result_each, 0);
+  rb_define_method (cIngresResult, "to_a", ii_result_to_a, 0);
+  rb_define_alias (cIngresResult, "length", "size");
+
+  /* LOB locators, returned by execute with :lob_locators => true */
+  cIngresLob = rb_define_class_under (cIngres, "Lob", rb_cObject);
+  rb_undef_alloc_func (cIngresLob);
+  rb_define_method (cIngresLob, "length", ii_lob_length, 0);
+  rb_define_method (cIngresLob, "read", ii_lob_read, -1);
+  rb_define_method (cIngresLob, "each_segment", ii_lob_each_segment, 0);
+  rb_define_method (cIngresLob, "locator", ii_lob_locator, 0);
+  rb_define_alias (cIngresLob, "size", "length");
+
 
   if (ii_globals.debug)
     printf ("Exiting %s.\n", function_name);
@@ -3739,6 +8674,7 @@ Init_Ingres ()
 static VALUE rb_ingres_alloc(VALUE klass)
 {
   II_CONN *ii_conn = NULL;
+  VALUE conn_obj;
 
   char function_name[] = "rb_ingres_alloc";
   if (ii_globals.debug)
@@ -3747,10 +8683,20 @@ static VALUE rb_ingres_alloc(VALUE klass)
   ii_conn = (II_CONN *)ALLOC(II_CONN);
   ii_conn_init(ii_conn);
 
-  return Data_Wrap_Struct(klass, NULL, free_ii_conn, ii_conn);
+  conn_obj = Data_Wrap_Struct(klass, ii_conn_mark, free_ii_conn, ii_conn);
+  ii_conn->connection = conn_obj;
+  return conn_obj;
+}
+/* A statement started by execute_async() stays reachable from its
+ * connection until it has finished or been cancelled */
+static void ii_conn_mark (II_CONN *ii_conn)
+{
+  rb_gc_mark (ii_conn->keep_me);
 }
+
 static void free_ii_conn (II_CONN *ii_conn)
 {
+  II_ASYNC *async;
   char function_name[] = "free_ii_conn";
   if (ii_globals.debug)
     printf ("Entering %s.\n", function_name);
@@ -3758,8 +8704,19 @@ static void free_ii_conn (II_CONN *ii_conn)
   if (ii_conn)
   {
     /* Clean up the connection */
+    if (ii_conn->async)
+    {
+      async = ii_conn->async;
+      ii_async_abandon (async);
+      /* left for the connection to free, see ii_async_free() */
+      if (async->freed)
+        xfree (async);
+    }
     ii_api_rollback (ii_conn, NULL);
     ii_api_disconnect (ii_conn);
+    ii_api_term (ii_conn);
+    ii_arena_free (ii_conn);
+    ii_free ((void **) &ii_conn->orphanHandles);
   }
 }
 
@@ -3775,8 +8732,29 @@ static void ii_conn_init(II_CONN *ii_conn)
   ii_conn->tranHandle = NULL;
   ii_conn->stmtHandle = NULL;
   ii_conn->envHandle = NULL;
+  ii_conn->initialized = FALSE;
+  ii_conn->rowsAffected = 0;
+  ii_conn->tranCount = 0;
+  ii_conn->cursorGeneration = 0;
+  ii_conn->orphanHandles = NULL;
+  ii_conn->orphanCount = 0;
+  ii_conn->orphanMax = 0;
+  ii_conn->waiting = FALSE;
+  ii_conn->busy = &ii_conn->waiting;
+  ii_conn->sessionCount = 0;
+  ii_conn->statementCount = 0;
+  ii_conn->queryInfoFlags = 0;
+  ii_conn->repeatQueryHandle = NULL;
   ii_conn->fieldCount = 0;
   ii_conn->lobSegmentSize = 0;
+  ii_conn->fetchRows = 0;
+  ii_conn->nullAsNil = FALSE;
+  ii_conn->nativeDates = FALSE;
+  ii_conn->nativeDecimals = FALSE;
+  ii_conn->moneyMode = INGRES_MONEY_FLOAT;
+  ii_conn->timeout = 0;
+  ii_conn->deadline = 0;
+  ii_conn->moreSegments = FALSE;
   ii_conn->descriptor = NULL;
   ii_conn->errorText = NULL;
   ii_conn->sqlstate[0] = '\0';
@@ -3785,12 +8763,16 @@ static void ii_conn_init(II_CONN *ii_conn)
   ii_conn->paramCount = 0;
   ii_conn->cursor_id = NULL;
   ii_conn->cursor_mode = INGRES_CURSOR_READONLY;
+  ii_conn->cursorCount = 0;
+  ii_conn->async = NULL;
   ii_conn->currentDatabase = NULL;
   ii_conn->keep_me = (VALUE) FALSE;
+  ii_conn->connection = (VALUE) FALSE;
   ii_conn->resultset = (VALUE) FALSE;
   ii_conn->r_column_names = (VALUE) FALSE;
   ii_conn->r_data_sizes = (VALUE) FALSE;
   ii_conn->r_data_types = (VALUE) FALSE;
+  memset (&ii_conn->arena, 0, sizeof (II_ROW_ARENA));
   ii_conn->savePtList = NULL; /* Linked list of Save point names and their handles */
   ii_conn->lastSavePtEntry = NULL; 
 
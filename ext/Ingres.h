@@ -45,6 +45,7 @@
 #define RUBY_VARCHAR   			"VARCHAR"
 #define RUBY_DATE      			"DATE"
 #define RUBY_DOUBLE    			"DOUBLE"
+#define RUBY_DECIMAL   			"DECIMAL"
 #define RUBY_TINYINT   			"TINYINT"
 #define RUBY_LOB       			"LOB"
 #define RUBY_UNMAPPED  			"UNMAPPED_DATATYPE"
@@ -73,6 +74,8 @@
 #define DOUBLE_SCALE			15
 #define MAX_CHAR_SIZE		        32000  /* max #bytes Ingres (var)char */
 #define LOB_SEGMENT_SIZE 8192
+#define FETCH_BUFFER_SIZE		65536  /* target #bytes fetched per IIapi_getColumns() */
+#define MAX_FETCH_ROWS			1000   /* upper limit on rows per IIapi_getColumns() */
 
 /* Ingres 2.6 is missing a define for IIAPI_CPV_DFRMT_ISO4 */
 #if !defined(IIAPI_CPV_DFRMT_ISO4)
@@ -169,9 +172,29 @@ static struct
 #define INGRES_CURSOR_READONLY 0
 #define INGRES_CURSOR_UPDATE 1
 
+/* Milliseconds each IIapi_wait() runs for before checking for interrupts */
+#define INGRES_SYNC_WAIT_SLICE 100
+
+/* Length of the names given to statements PREPAREd by Ingres#prepare() */
+#define INGRES_STATEMENT_NAME_LEN 32
+
+/* Service parameters sent ahead of a repeated query's own parameters */
+#define INGRES_REPEAT_DEFINE_PARMS 3  /* two ids and a name */
+#define INGRES_REPEAT_EXEC_PARMS 1    /* the query handle */
+
+/* Rows sent by copy_in() are buffered until this many bytes are waiting,
+ * or as many columns as one IIapi_putColumns() can take */
+#define INGRES_COPY_BLOCK_SIZE 65536
+#define INGRES_COPY_MAX_COLUMNS 32767
+
+/* How MONEY values are returned */
+#define INGRES_MONEY_FLOAT   0
+#define INGRES_MONEY_DECIMAL 1
+#define INGRES_MONEY_CENTS   2
+
+/* Process wide debug flags, everything else is held per connection in II_CONN */
 typedef struct _II_GLOBALS
 {
-  II_PTR envHandle;
   int debug;
   int debug_connection;
   int debug_sql;
@@ -186,15 +209,64 @@ typedef struct _II_SAVEPOINT_ENTRY
   II_PTR nextSavePtEntry;
 } II_SAVEPOINT_ENTRY;
 
+/* Completion callback for an OpenAPI call, gp_callback */
+typedef II_VOID (II_FAR II_CALLBACK *II_API_CALLBACK) (II_PTR closure, II_PTR parmBlock);
+
+/* State of an ii_sync() wait, shared with its unblocking function */
+typedef struct _II_SYNC
+{
+  IIAPI_GENPARM *genParm;
+  IIAPI_WAITPARM waitParm;
+  II_PTR stmtHandle;            /* statement cancelled on an interrupt, NULL if none */
+  double deadline;              /* ii_clock_ms() the statement is cancelled at, 0 = never */
+  IIAPI_CANCELPARM cancelParm;
+  volatile int interrupted;     /* set when Ruby wants the waiting thread back */
+  volatile int timedOut;        /* the deadline passed */
+  volatile int cancelling;      /* IIapi_cancel() has been called */
+  int raised;                   /* rb_protect() state of an interrupt that raised, 0 if none */
+  int *busy;                    /* connection's busy flag, set while the GVL is released */
+} II_SYNC;
+
+/* Per statement fetch buffers, sized from the result descriptors once and
+ * reused for every row until the statement is closed.  The parameter values
+ * of the statement are gathered here too, to be sent in one IIapi_putParms()
+ */
+typedef struct _II_ROW_ARENA
+{
+  IIAPI_DATAVALUE *columnData;  /* rowCount * columnCount data values */
+  char *buffer;                 /* storage behind columnData */
+  II_INT2 rowCount;
+  II_INT2 columnCount;
+  char *scratch;                /* work area for converting a single value */
+  long scratchLen;
+  IIAPI_DATAVALUE *parmData;    /* parameter values waiting to be sent */
+  long *parmOffset;             /* where each value is in parmBuffer */
+  long parmCount;
+  long parmMax;
+  char *parmBuffer;             /* storage behind parmData */
+  long parmUsed;
+  long parmLen;
+} II_ROW_ARENA;
+
 typedef struct _II_CONN
 {
   int autocommit;
   II_PTR connHandle;
   II_PTR tranHandle;
   II_PTR stmtHandle;
-  II_PTR envHandle;
+  II_PTR envHandle;     /* from ii_api_init(), one per Ingres object */
+  int initialized;      /* IIapi_initialize() succeeded, ii_api_term() has to terminate */
+  II_LONG rowsAffected; /* rows affected by the last statement, for rows_affected() */
   II_LONG fieldCount;
   II_LONG lobSegmentSize;
+  II_INT2 fetchRows;    /* rows per IIapi_getColumns(), 0 = size from the descriptors */
+  int nullAsNil;        /* return nil for NULL values rather than the string "NULL" */
+  int nativeDates;      /* decode date/time values into Time and Date objects */
+  int nativeDecimals;   /* decode DECIMAL values into Integer and BigDecimal objects */
+  int moneyMode;        /* INGRES_MONEY_* */
+  long timeout;         /* default statement timeout in milliseconds, 0 = none */
+  double deadline;      /* ii_clock_ms() the running statement is cancelled at, 0 = never */
+  int moreSegments;     /* a LOB parameter has been sent in part, the rest to follow */
   IIAPI_DESCRIPTOR *descriptor;
   II_CHAR *errorText;
   II_CHAR sqlstate[6];
@@ -205,22 +277,216 @@ typedef struct _II_CONN
   int num_persistent;
   char *cursor_id;
   long cursor_mode;
+  int cursorCount;      /* number of Ingres::Cursor objects open on the connection */
+  long cursorGeneration;  /* bumped as each transaction ends, open cursors go with it */
+  II_PTR *orphanHandles;  /* statements of cursors freed while open, closed with the transaction */
+  long orphanCount;
+  long orphanMax;
+  long tranCount;       /* bumped as each transaction ends, PREPAREd statements and LOB locators go with it */
+  long sessionCount;    /* bumped at each disconnect, repeated queries go with it */
+  II_ULONG queryInfoFlags;    /* gq_flags from the last IIapi_getQueryInfo() */
+  II_PTR repeatQueryHandle;   /* handle from the last repeated query defined */
+  long statementCount;  /* used to name the statements PREPAREd on the connection */
+  struct _II_ASYNC *async;  /* statement started by execute_async() still running, NULL if none */
+  int waiting;          /* a thread is waiting on the connection without the GVL */
+  int *busy;            /* waiting flag of the connection this statement state belongs to */
   char *currentDatabase;
   int queryType;
-  VALUE keep_me;
+  VALUE keep_me;        /* Ingres::AsyncResult of the statement in async, kept alive with the connection */
+  VALUE connection;     /* Ingres object the statement was run on, for Ingres::Lob */
   VALUE resultset;
   VALUE r_column_names;
   VALUE r_data_sizes;
   VALUE r_data_types;
   II_LONG columnCount;
+  II_ROW_ARENA arena;
   II_PTR savePtList;
   II_SAVEPOINT_ENTRY *lastSavePtEntry;/* Pointer to the last savePtEntry on savePtList */
 } II_CONN;
 
+/* A cell of an Ingres::Result, held as fetched in the result's data buffer */
+typedef struct _II_RESULT_CELL
+{
+  long offset;
+  long length;
+  int isNull;
+} II_RESULT_CELL;
+
+/* An Ingres::Result, the raw fetched data converted to Ruby values on access */
+typedef struct _II_RESULT
+{
+  II_CONN conv;         /* scratch space and data sizes used by processField() */
+  IIAPI_DESCRIPTOR *descriptor;   /* copy of the column descriptors */
+  II_INT2 columnCount;
+  long rowCount;
+  II_RESULT_CELL *cells;          /* rowCount * columnCount cells, row by row */
+  long cellCount;
+  long cellCapacity;
+  char *data;
+  long dataLen;
+  long dataCapacity;
+  VALUE columnNames;
+} II_RESULT;
+
+/* Options that can be overridden for a single call to execute() */
+typedef struct _II_QUERY_OPTIONS
+{
+  II_INT2 fetchRows;
+  int yieldRows;        /* yield each row to the block instead of building a result set */
+  long maxRows;         /* stop after this many rows, 0 = fetch all of them */
+  int lazy;             /* return an Ingres::Result instead of an Array */
+  II_RESULT *result;    /* raw cells are appended here when set */
+  int columnar;         /* return a Hash of column name => Array of values */
+  VALUE columns;        /* one Array per column when columnar is set */
+  VALUE lobSink;        /* stream LOB values here rather than returning them, 0 if none */
+  II_ULONG queryFlags;  /* qy_flags passed to IIapi_query() */
+  long timeout;         /* statement timeout in milliseconds, 0 = none */
+} II_QUERY_OPTIONS;
+
+/* An Ingres::Cursor, a SELECT opened with IIAPI_QT_OPEN and fetched on demand */
+typedef struct _II_CURSOR
+{
+  II_CONN stmt;         /* statement state, sharing the connection and transaction handles */
+  II_CONN *ii_conn;     /* connection the cursor was opened on */
+  VALUE connection;     /* Ruby object for ii_conn, kept alive by the cursor */
+  IIAPI_GETDESCRPARM descrParm;
+  long generation;      /* ii_conn->cursorGeneration when the cursor was opened */
+  int done;             /* all the rows have been fetched, the statement is closed */
+  int closed;           /* closed by close(), an error or the end of its transaction */
+} II_CURSOR;
+
+/* An Ingres::Lob, a LOB locator whose value is read from the server on demand */
+typedef struct _II_LOB
+{
+  VALUE connection;     /* Ingres object the locator was returned on */
+  long tranCount;       /* ii_conn->tranCount when returned, locators go with the transaction */
+  II_UINT4 locator;
+  IIAPI_DT_ID dataType; /* IIAPI_LBLOC_TYPE, IIAPI_LCLOC_TYPE or IIAPI_LNLOC_TYPE */
+} II_LOB;
+
+/* A statement run by Ingres::Lob alongside any open on the connection */
+typedef struct _II_LOB_QUERY
+{
+  II_CONN stmt;
+  IIAPI_GETDESCRPARM descrParm;
+  II_QUERY_OPTIONS options;
+} II_LOB_QUERY;
+
+/* An Ingres::AsyncResult, a statement sent by execute_async() whose
+ * results are fetched once the server has run it */
+typedef struct _II_ASYNC
+{
+  VALUE connection;             /* Ruby object for ii_conn, kept alive until the statement ends */
+  II_CONN *ii_conn;             /* NULL once the statement has been abandoned */
+  IIAPI_GETDESCRPARM descrParm; /* the call completed when the server has run the statement */
+  II_QUERY_OPTIONS options;
+  volatile int completed;       /* set by ii_async_callback() */
+  int polling;                  /* waiting through the fiber scheduler */
+  int finished;                 /* value, or error, holds the result */
+  int freed;                    /* collected with the connection while still running */
+  VALUE value;
+  VALUE error;
+} II_ASYNC;
+
+/* SQL text ready to be sent by ii_api_query_send(), see ii_query_text_parse() */
+typedef struct _II_QUERY_TEXT
+{
+  char *queryText;      /* ? markers converted to ~V, NULL when calling a procedure */
+  char *procedureName;  /* NULL unless calling a procedure */
+  long paramCount;
+  int converted;        /* queryText was allocated by convertParamMarkers() */
+} II_QUERY_TEXT;
+
+/* An Ingres::Statement returned by Ingres#prepare() */
+typedef struct _II_STATEMENT
+{
+  II_CONN *ii_conn;
+  VALUE connection;     /* keeps ii_conn from being freed */
+  VALUE sqlText;        /* frozen copy of the SQL given to prepare() */
+  II_QUERY_TEXT text;
+  int queryType;        /* INGRES_SQL_* */
+  VALUE params;         /* [type, value, ...], the values replaced by each execute() */
+  IIAPI_SETDESCRPARM setDescrParm;  /* parameter descriptors, allocated once */
+  int described;        /* setDescrParm is filled in, each run only updates it for the new values */
+  char name[INGRES_STATEMENT_NAME_LEN];  /* the name it is PREPAREd as on the server */
+  long preparedTran;    /* ii_conn->tranCount when it was last PREPAREd, -1 if never */
+  long sentTran;        /* ii_conn->tranCount when it was last sent as SQL text, -1 if never */
+  int repeated;         /* run as an Ingres repeated query */
+  II_INT4 repeatId[2];  /* identifies the repeated query, the same in every session */
+  II_PTR repeatHandle;  /* from defining the repeated query, NULL until then */
+  long repeatSession;   /* ii_conn->sessionCount the repeated query was defined in */
+  int closed;
+} II_STATEMENT;
+
+/* State shared by the body and cleanup of Ingres::Statement#execute_batch() */
+typedef struct _II_BATCH_ARGS
+{
+  II_STATEMENT *statement;
+  VALUE rows;
+  II_QUERY_OPTIONS *options;
+  long rowsAffected;    /* summed over every row run */
+  int ownTransaction;   /* the batch started the transaction, and ends it */
+  int committed;        /* every row was run and the transaction committed */
+} II_BATCH_ARGS;
+
+/* State shared by the body and cleanup of Ingres#copy_in() */
+typedef struct _II_COPY_ARGS
+{
+  II_CONN *ii_conn;
+  VALUE source;         /* Enumerable of rows, or an IO read a line at a time */
+  long columnCount;     /* values expected in each row */
+  IIAPI_COPYMAP *copyMap;
+  long *columnMap;      /* for each table column the value in a row, -1 for none */
+  int lines;            /* source is read with each_line */
+  VALUE delimiter;      /* splits each line into values */
+  VALUE nullString;     /* a value read as NULL, Qnil for none */
+  long rowCount;
+} II_COPY_ARGS;
+
+/* The statements Ingres.parallel_execute() waits on together */
+typedef struct _II_ASYNC_WAIT
+{
+  II_ASYNC **asyncs;
+  double *deadlines;            /* copied from each connection while holding the GVL */
+  long count;
+  volatile int interrupted;     /* set when Ruby asks the waiting thread to stop */
+} II_ASYNC_WAIT;
+
+/* State shared by the body and cleanup of each_row(), and of opening and
+ * fetching from an Ingres::Cursor */
+typedef struct _II_EACH_ROW_ARGS
+{
+  II_CONN *ii_conn;
+  IIAPI_GETDESCRPARM *descrParm;
+  II_QUERY_OPTIONS *options;
+  VALUE queryText;      /* statement sent by ii_each_row_fetch() */
+  VALUE params;
+  int failed;
+} II_EACH_ROW_ARGS;
+
+/* Arguments of the parameter binding protected by ii_api_query_send() and
+ * ii_repeat_query_send(), a failure is cleaned up by ii_api_query_abort() */
+typedef struct _II_BIND_ARGS
+{
+  II_CONN *ii_conn;
+  int argc;
+  VALUE params;
+  char *procname;
+  long paramCount;
+  IIAPI_SETDESCRPARM *setDescrParm;
+  int *described;       /* set once setDescrParm has been filled in, NULL to fill it in every time */
+  II_STATEMENT *statement;  /* repeated query being defined or run, NULL if none */
+  II_LONG apiQueryType;
+} II_BIND_ARGS;
+
 typedef struct _RUBY_IIAPI_DATAVALUE
 {
   IIAPI_DATAVALUE dataValue[1];
   long dv_length;
+  VALUE lobValue;       /* String holding an assembled LOB value, 0 if none */
+  VALUE lobSink;        /* IO or callable LOB segments are streamed to, 0 if none */
+  char lobCarry[4];     /* end of a long nvarchar segment held for the next one */
+  int lobCarryLen;
 } RUBY_IIAPI_DATAVALUE;
 
 typedef struct _RUBY_PARAMETER
@@ -244,6 +510,7 @@ static void ii_conn_init(II_CONN *ii_conn);
 VALUE ing_init (int argc, VALUE *argv, VALUE self);
 void ing_api_init ();
 static VALUE rb_ingres_alloc(VALUE klass);
+static void ii_conn_mark (II_CONN *ing_conn);
 static void free_ii_conn (II_CONN *ing_conn);
 static void ing_starttransaction();
 static void ing_commit();
@@ -258,12 +525,15 @@ void ii_api_connect (II_CONN *ii_conn, char *param_targetDB, char *param_usernam
 void ii_api_commit (II_CONN *ii_conn);
 static int ii_query_type(char *queryText);
 void ii_api_rollback (II_CONN *ii_conn, II_SAVEPOINT_ENTRY *savePtEntry);
+void ii_api_init (II_CONN *ii_conn);
+void ii_api_term (II_CONN *ii_conn);
 void ii_api_disconnect( II_CONN *ii_conn);
 void ii_api_savepoint (II_CONN *ii_conn, VALUE savePtName);
 void ii_free_savePtEntries (II_SAVEPOINT_ENTRY *savePtEntry);
 
 void ii_api_set_connect_param (II_CONN *ii_conn, II_LONG paramID, VALUE paramValue);
-void ii_api_set_env_param (II_LONG paramID, VALUE paramValue);
+void ii_api_set_env_param (II_CONN *ii_conn, II_LONG paramID, VALUE paramValue);
+long ii_timeout_value (VALUE value);
 
 /* Transaction control */
 VALUE ii_commit (VALUE param_self);
@@ -275,6 +545,33 @@ VALUE ii_savepoint_name(II_CONN *ii_conn, char *statement);
 void *ii_allocate (size_t nitems, size_t size);
 void *ii_reallocate (void *oldPtr, size_t nitems, size_t size);
 void ii_free (void **ptr);
+void ii_arena_init (II_CONN *ii_conn, IIAPI_GETDESCRPARM *descrParm, II_INT2 rowCount);
+char *ii_arena_scratch (II_CONN *ii_conn, long size);
+void ii_arena_free (II_CONN *ii_conn);
+char *ii_parm_add (II_CONN *ii_conn, II_BOOL dv_null, long dv_length);
+void ii_parm_trim (II_CONN *ii_conn, long dv_length);
+void ii_parm_flush (II_CONN *ii_conn);
+void ii_parm_reset (II_CONN *ii_conn);
+
+/* Lazily converted result sets */
+void ii_result_add_cell (II_RESULT *result, IIAPI_DATAVALUE *dataValue, long length, IIAPI_DESCRIPTOR *descrParm);
+void ii_result_end_row (II_RESULT *result);
+void ii_result_discard_row (II_RESULT *result);
+VALUE ii_result_new (II_CONN *ii_conn, IIAPI_GETDESCRPARM *descrParm, II_RESULT **result);
+
+/* Statements sent without waiting for the server */
+void ii_api_getDescriptors_send (II_CONN *ii_conn, IIAPI_GETDESCRPARM *descrParm, II_API_CALLBACK callback, II_PTR closure);
+void ii_api_getDescriptors_check (II_CONN *ii_conn, IIAPI_GETDESCRPARM *descrParm);
+void ii_execute_query_send (II_CONN *ii_conn, char *sqlText, int argc, VALUE params, II_QUERY_OPTIONS *options, IIAPI_GETDESCRPARM *descrParm, II_API_CALLBACK callback, II_PTR closure);
+VALUE ii_execute_query_finish (II_CONN *ii_conn, IIAPI_GETDESCRPARM *descrParm, II_QUERY_OPTIONS *options);
+
+/* SQL text and prepared statements */
+void ii_query_text_parse (II_QUERY_TEXT *text, char *sqlText);
+void ii_query_text_free (II_QUERY_TEXT *text);
+II_PTR ii_api_query_send (II_CONN *ii_conn, II_QUERY_TEXT *text, int argc, VALUE params, II_LONG apiQueryType, II_QUERY_OPTIONS *options, IIAPI_SETDESCRPARM *setDescrParm, int *described);
+
+/* LOB locators */
+VALUE ii_lob_new (II_CONN *ii_conn, IIAPI_DATAVALUE *dataValue, IIAPI_DT_ID dataType);
 
 /* TODO - The following has been taken from the Ingres CL and should be removed/replaced at some point */
 # define        NULLCHAR        ('\0')	/* string terminator */
@@ -214,6 +214,73 @@ int utf16_to_utf8 (UCS2 * sourceStart, const UCS2 * sourceEnd, UTF8 * targetStar
 }
 
 
+/*
+** The number of UTF-16 code units utf8_to_utf16() would produce for the
+** same input, without anything being written
+*/
+int utf8_utf16_length (UTF8 * sourceStart, const UTF8 * sourceEnd, long *reslen)
+{
+    register UTF8 *source = sourceStart;
+    register UCS4 ch;
+    register u_i2 extraBytesToWrite;
+    long length = 0;
+
+    const UCS4 kMaximumUCS2 = 0x0000FFFFUL, kMaximumUCS4 = 0x7FFFFFFFUL;
+
+    UCS4 offsetsFromUTF8[6] = { 0x00000000UL, 0x00003080UL, 0x000E2080UL, 0x03C82080UL, 0xFA082080UL, 0x82082080UL
+                              };
+
+    while (source < sourceEnd)
+    {
+        if (*source < 0xC0)
+            extraBytesToWrite = 0;
+        else if (*source < 0xE0)
+            extraBytesToWrite = 1;
+        else if (*source < 0xF0)
+            extraBytesToWrite = 2;
+        else if (*source < 0xF8)
+            extraBytesToWrite = 3;
+        else if (*source < 0xFC)
+            extraBytesToWrite = 4;
+        else
+            extraBytesToWrite = 5;
+
+        if (source + extraBytesToWrite > sourceEnd)
+        {
+            *reslen = length;
+            return TRUE;
+        }
+
+        ch = 0;
+        switch (extraBytesToWrite)  /* note: code falls through cases! */
+        {
+        case 5:
+            ch += *source++;
+            ch <<= 6;
+        case 4:
+            ch += *source++;
+            ch <<= 6;
+        case 3:
+            ch += *source++;
+            ch <<= 6;
+        case 2:
+            ch += *source++;
+            ch <<= 6;
+        case 1:
+            ch += *source++;
+            ch <<= 6;
+        case 0:
+            ch += *source++;
+        }
+        ch -= offsetsFromUTF8[extraBytesToWrite];
+
+        /* a surrogate pair above the BMP, one code unit otherwise */
+        length += (ch > kMaximumUCS2 && ch <= kMaximumUCS4) ? 2 : 1;
+    }
+    *reslen = length;
+    return FALSE;
+}
+
 /*
 vim:  ts=2 sw=2 expandtab
 */
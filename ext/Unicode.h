@@ -51,6 +51,7 @@ typedef long long __int64;
 
 int utf8_to_utf16 (UTF8 * sourceStart, const UTF8 * sourceEnd, UCS2 * targetStart, const UCS2 * targetEnd, long *reslen);
 int utf16_to_utf8 (UCS2 * sourceStart, const UCS2 * sourceEnd, UTF8 * targetStart, const UTF8 * targetEnd, long *reslen);
+int utf8_utf16_length (UTF8 * sourceStart, const UTF8 * sourceEnd, long *reslen);
 /*
 vim:  ts=2 sw=2 expandtab
 */
@@ -77,6 +77,11 @@ if have_header('iiapi.h')
       $CFLAGS << ' -DRUBY_19_COMPATIBILITY'
     end
 
+    # Release the GVL while waiting on the server
+    have_header('ruby/thread.h') && have_func('rb_thread_call_without_gvl2', 'ruby/thread.h')
+    # Wait for execute_async results through a Fiber scheduler
+    have_header('ruby/fiber/scheduler.h') && have_func('rb_fiber_scheduler_current', 'ruby/fiber/scheduler.h')
+
     create_makefile('Ingres')
 else
     puts "Unable to find iiapi.h, please verify your setup"
@@ -11,4 +11,37 @@ class TestIngresDualConnections < Test::Unit::TestCase
     assert_kind_of(Ingres, ing2.connect(@@database), "conn is not an Ingres object")
   end
 
+  # Queries on separate connections can be waited on from separate threads
+  def test_dual_connections_threaded
+    sql = "select count(*) from iitables"
+    connections = [Ingres.new(), Ingres.new()]
+    connections.each { |conn| conn.connect(@@database) }
+    expected = connections[0].execute(sql)
+    threads = connections.map { |conn| Thread.new { conn.execute(sql) } }
+    threads.each { |thread| assert_equal expected, thread.value }
+    connections.each { |conn| conn.disconnect }
+  end
+
+  # Each connection keeps its own rows affected count
+  def test_dual_connections_rows_affected
+    connections = [Ingres.new(), Ingres.new()]
+    connections.each { |conn| conn.connect(@@database) }
+    connections[0].execute("select * from iidbconstants")
+    connections[1].execute("select * from iidbconstants where 1 = 0")
+    assert_equal 1, connections[0].rows_affected
+    assert_equal 0, connections[1].rows_affected
+    connections.each { |conn| conn.disconnect }
+  end
+
+  # Disconnecting one connection leaves the other usable
+  def test_dual_connections_disconnect_one
+    ing = Ingres.new()
+    ing.connect(@@database)
+    ing2 = Ingres.new()
+    ing2.connect(@@database)
+    ing.disconnect
+    assert_equal [[1]], ing2.execute("select 1")
+    ing2.disconnect
+  end
+
 end
@@ -0,0 +1,102 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+
+class TestIngresQueryAsync < Test::Unit::TestCase
+
+  SQL = "select count(*) from iitables"
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(@@database, @@username, @@password), "conn is not an Ingres object")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_execute_async_value
+    expected = @@ing.execute(SQL)
+    result = @@ing.execute_async(SQL)
+    assert_kind_of(Ingres::AsyncResult, result)
+    assert_equal expected, result.value
+    assert result.ready?
+    # the same result is returned again
+    assert_equal expected, result.value
+  end
+
+  def test_execute_async_parameters_and_options
+    result = @@ing.execute_async("select ? from iidbconstants", "i", 42, :format => :columns)
+    assert_equal [42], result.value.values.first
+  end
+
+  def test_execute_async_busy
+    result = @@ing.execute_async(SQL)
+    assert_raise(RuntimeError) { @@ing.execute(SQL) }
+    result.value
+    assert_equal [[1]], @@ing.execute("select 1")
+  end
+
+  def test_execute_async_error
+    result = @@ing.execute_async("select * from no_such_table")
+    assert_raise(RuntimeError) { result.value }
+    assert_raise(RuntimeError) { result.value }
+    assert_equal [[1]], @@ing.execute("select 1")
+  end
+
+  def test_execute_async_cancel
+    result = @@ing.execute_async("select count(*) from iicolumns a, iicolumns b, iicolumns c")
+    result.cancel
+    assert_raise(RuntimeError) { result.value }
+    assert_equal [[1]], @@ing.execute("select 1")
+  end
+
+  # The connection keeps a running statement's result alive
+  def test_execute_async_result_dropped
+    @@ing.execute_async(SQL)
+    GC.start
+    assert_raise(RuntimeError) { @@ing.execute(SQL) }
+  end
+
+  def test_execute_async_not_a_query
+    assert_raise(ArgumentError) { @@ing.execute_async("commit") }
+  end
+
+  def test_execute_async_two_connections
+    ing2 = Ingres.new()
+    ing2.connect(@@database, @@username, @@password)
+    pending = [@@ing, ing2].map { |conn| conn.execute_async(SQL) }
+    values = pending.map { |result| result.value }
+    assert_equal values[0], values[1]
+    ing2.disconnect
+  end
+
+  def test_parallel_execute
+    ing2 = Ingres.new()
+    ing2.connect(@@database, @@username, @@password)
+    results = Ingres.parallel_execute([[@@ing, SQL], [ing2, "select ? from iidbconstants", "i", 42]])
+    assert_equal [@@ing.execute(SQL), [[42]]], results
+    ing2.disconnect
+  end
+
+  def test_parallel_execute_error
+    ing2 = Ingres.new()
+    ing2.connect(@@database, @@username, @@password)
+    assert_raise(RuntimeError) { Ingres.parallel_execute([[@@ing, "select * from no_such_table"], [ing2, SQL]]) }
+    # neither connection is left busy
+    assert_equal [[1]], @@ing.execute("select 1")
+    assert_equal [[1]], ing2.execute("select 1")
+    ing2.disconnect
+  end
+
+  def test_parallel_execute_same_connection
+    assert_raise(RuntimeError) { Ingres.parallel_execute([[@@ing, SQL], [@@ing, SQL]]) }
+    assert_equal [[1]], @@ing.execute("select 1")
+  end
+
+  def test_parallel_execute_bad_arguments
+    assert_raise(ArgumentError) { Ingres.parallel_execute([[SQL]]) }
+    assert_raise(TypeError) { Ingres.parallel_execute(SQL) }
+  end
+
+end
@@ -0,0 +1,79 @@
+require 'Ingres'
+require 'test/unit'
+require 'timeout'
+require 'ext/tests/config.rb'
+
+class TestIngresQueryCancel < Test::Unit::TestCase
+
+  # Takes far longer than the timeouts used below
+  SLOW_SQL = "select count(*) from iicolumns a, iicolumns b, iicolumns c"
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(@@database, @@username, @@password), "conn is not an Ingres object")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_timeout_cancels_query
+    started = Time.now
+    assert_raise(Timeout::Error) { Timeout.timeout(1) { @@ing.execute(SLOW_SQL) } }
+    assert Time.now - started < 30, "the query was not cancelled"
+    # the connection is usable again straight away
+    assert_equal [[1]], @@ing.execute("select 1")
+  end
+
+  def test_thread_raise_cancels_query
+    thread = Thread.new { @@ing.execute(SLOW_SQL) }
+    sleep 1
+    thread.raise(RuntimeError, "stop")
+    assert_raise(RuntimeError) { thread.join }
+    assert_equal [[1]], @@ing.execute("select 1")
+  end
+
+  # Waking the thread, or a signal handler that does not raise, lets the
+  # statement carry on until its timeout
+  def test_wakeup_does_not_cancel_query
+    thread = Thread.new { @@ing.execute(SLOW_SQL, :timeout => 3) }
+    sleep 1
+    thread.wakeup
+    assert_raise(Ingres::TimeoutError) { thread.join }
+    assert_equal [[1]], @@ing.execute("select 1")
+  end
+
+  # A second thread cannot use the connection while the first is waiting
+  def test_busy_connection
+    thread = Thread.new { @@ing.execute(SLOW_SQL, :timeout => 3) }
+    sleep 1
+    assert_raise(RuntimeError) { @@ing.execute("select 1") }
+    assert_raise(RuntimeError) { @@ing.commit }
+    assert_raise(Ingres::TimeoutError) { thread.join }
+    assert_equal [[1]], @@ing.execute("select 1")
+  end
+
+  def test_statement_timeout
+    assert_raise(Ingres::TimeoutError) { @@ing.execute(SLOW_SQL, :timeout => 1) }
+    assert_equal [[1]], @@ing.execute("select 1", :timeout => 1)
+  end
+
+  def test_connection_timeout
+    assert_nil @@ing.timeout
+    @@ing.timeout = 0.5
+    assert_equal 0.5, @@ing.timeout
+    assert_raise(Ingres::TimeoutError) { @@ing.execute(SLOW_SQL) }
+    assert_equal [[1]], @@ing.execute("select 1")
+    assert_raise(ArgumentError) { @@ing.timeout = -1 }
+    assert_raise(ArgumentError) { @@ing.timeout = Float::INFINITY }
+    assert_raise(ArgumentError) { @@ing.timeout = Float::NAN }
+  end
+
+  def test_cancel_in_transaction_keeps_transaction
+    @@ing.execute("start transaction")
+    assert_raise(Timeout::Error) { Timeout.timeout(1) { @@ing.execute(SLOW_SQL) } }
+    assert_equal [[1]], @@ing.execute("select 1")
+    @@ing.rollback
+  end
+
+end
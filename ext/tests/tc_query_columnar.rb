@@ -0,0 +1,40 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+
+class TestIngresQueryColumnar < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(@@database, @@username, @@password), "conn is not an Ingres object")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_columns_match_transposed_rows
+    sql = "select ap_iatacode, ap_place, ap_name from airport order by ap_iatacode"
+    rows = @@ing.execute(sql)
+    columns = @@ing.execute(sql, :format => :columns)
+    assert_equal ["ap_iatacode", "ap_place", "ap_name"], columns.keys
+    assert_equal rows.transpose, columns.values
+  end
+
+  def test_columns_numeric
+    columns = @@ing.execute("select 1 as one, 2.5 as two from airport where ap_iatacode = ?", "c", "VLL", :format => :columns)
+    assert_equal({"one" => [1], "two" => [2.5]}, columns)
+  end
+
+  def test_columns_empty_result
+    columns = @@ing.execute("select ap_iatacode from airport where 1 = 0", :format => :columns)
+    assert_equal({"ap_iatacode" => []}, columns)
+  end
+
+  def test_invalid_format
+    assert_raise ArgumentError do
+      @@ing.execute("select 1", :format => :cells)
+    end
+  end
+ 
+end
@@ -0,0 +1,58 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+require 'stringio'
+
+class TestIngresQueryCopyIn < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(:database => @@database, :username => @@username, :password => @@password, :null_as_nil => true), "conn is not an Ingres object")
+    @@ing.execute("declare global temporary table session.copy_in (id integer not null, txt varchar(20), amount decimal(10,2)) on commit preserve rows with norecovery")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_copy_in_rows
+    rows = [[1, "one", "1.50"], [2, "two", nil], [3, nil, "3.25"]]
+    assert_equal 3, @@ing.copy_in("session.copy_in", ["id", "txt", "amount"], rows)
+    assert_equal 3, @@ing.rows_affected
+    assert_equal [[1, "one"], [2, "two"], [3, nil]], @@ing.execute("select id, txt from session.copy_in order by id")
+    assert_equal [[150], [nil], [325]], @@ing.execute("select int4(amount * 100) from session.copy_in order by id")
+  end
+
+  # Integers that do not fit the column are refused rather than truncated
+  def test_copy_in_out_of_range
+    @@ing.execute("declare global temporary table session.copy_small (n integer1) on commit preserve rows with norecovery")
+    assert_raise(ArgumentError) { @@ing.copy_in("session.copy_small", ["n"], [[1], [300]]) }
+    assert_raise(ArgumentError) { @@ing.copy_in("session.copy_in", ["id"], [[2 ** 31]]) }
+    assert_equal [[0]], @@ing.execute("select count(*) from session.copy_small")
+    assert_equal 2, @@ing.copy_in("session.copy_small", ["n"], [[-128], [127]])
+  end
+
+  # Rows are sent in blocks, however many there are
+  def test_copy_in_enumerator
+    assert_equal 10000, @@ing.copy_in("session.copy_in", ["id", "txt"], (1..10000).lazy.map { |i| [i, "row #{i}"] })
+    assert_equal [[10000]], @@ing.execute("select count(*) from session.copy_in")
+  end
+
+  def test_copy_in_io
+    data = StringIO.new("1,one\n2,\\N\n3,three\n")
+    assert_equal 3, @@ing.copy_in("session.copy_in", ["id", "txt"], data, :delimiter => ",", :null => "\\N")
+    assert_equal [[1, "one"], [2, nil], [3, "three"]], @@ing.execute("select id, txt from session.copy_in order by id")
+  end
+
+  def test_copy_in_failure
+    assert_raise(ArgumentError) { @@ing.copy_in("session.copy_in", ["id", "txt"], [[1, "one"], [nil, "two"]]) }
+    assert_equal [[0]], @@ing.execute("select count(*) from session.copy_in")
+  end
+
+  def test_copy_in_errors
+    assert_raise(ArgumentError) { @@ing.copy_in("session.copy_in; drop table x", ["id"], []) }
+    assert_raise(ArgumentError) { @@ing.copy_in("session.copy_in", [], []) }
+    assert_raise(ArgumentError) { @@ing.copy_in("session.copy_in", ["id", "txt"], [[1]]) }
+  end
+
+end
@@ -0,0 +1,85 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+
+class TestIngresQueryCursor < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(@@database, @@username, @@password), "conn is not an Ingres object")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_cursor_fetch_matches_execute
+    sql = "select ap_iatacode, ap_place from airport order by ap_iatacode"
+    rows = []
+    @@ing.cursor(sql) do |cursor|
+      while (batch = cursor.fetch(7)).size > 0
+        assert batch.size <= 7
+        rows.concat(batch)
+      end
+    end
+    assert_equal @@ing.execute(sql), rows
+  end
+
+  def test_cursor_with_parameters
+    cursor = @@ing.cursor("select ap_iatacode from airport where ap_iatacode = ?", "c", "VLL")
+    assert_equal ["ap_iatacode"], cursor.columns
+    assert_equal [["VLL"]], cursor.fetch(10)
+    assert_equal [], cursor.fetch(10)
+    cursor.close
+    assert cursor.closed?
+  end
+
+  # Two cursors interleaved on the same connection
+  def test_multiple_cursors
+    first = @@ing.cursor("select ap_iatacode from airport order by ap_iatacode")
+    second = @@ing.cursor("select ap_iatacode from airport order by ap_iatacode desc")
+    assert_equal 1, first.fetch(1).size
+    assert_equal 1, second.fetch(1).size
+    assert_equal [[1]], @@ing.execute("select 1")
+    assert_equal 2, first.fetch(2).size
+    first.close
+    second.close
+  end
+
+  def test_cursor_closed
+    cursor = @@ing.cursor("select ap_iatacode from airport")
+    cursor.close
+    assert_raise RuntimeError do
+      cursor.fetch(1)
+    end
+  end
+
+  # Reading a cursor to the end closes its statement, the cursor itself
+  # stays usable until it is closed
+  def test_cursor_fetched_to_end
+    cursor = @@ing.cursor("select ap_iatacode from airport where ap_iatacode = 'VLL'")
+    assert_equal [["VLL"]], cursor.fetch(10)
+    assert_equal [], cursor.fetch(10)
+    assert !cursor.closed?
+    assert_equal [], cursor.fetch(10)
+    cursor.close
+    assert cursor.closed?
+  end
+
+  def test_cursor_sql_endings
+    ["select ap_iatacode from airport where ap_iatacode = 'VLL';",
+     "select ap_iatacode from airport where ap_iatacode = 'VLL' for readonly",
+     "select ap_iatacode from airport where ap_iatacode = 'VLL' FOR READONLY ; "].each do |sql|
+      @@ing.cursor(sql) do |cursor|
+        assert_equal [["VLL"]], cursor.fetch(10)
+      end
+    end
+  end
+
+  def test_cursor_select_only
+    assert_raise ArgumentError do
+      @@ing.cursor("delete from airport")
+    end
+  end
+ 
+end
@@ -0,0 +1,53 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+
+class TestIngresQueryEachRow < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(@@database, @@username, @@password), "conn is not an Ingres object")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_each_row_matches_execute
+    sql = "select ap_iatacode, ap_place from airport order by ap_iatacode"
+    rows = []
+    @@ing.each_row(sql) { |row| rows << row }
+    assert_equal @@ing.execute(sql), rows
+  end
+
+  def test_each_row_with_parameters
+    rows = []
+    @@ing.each_row("select ap_iatacode from airport where ap_iatacode = ?", "c", "VLL") { |row| rows << row }
+    assert_equal [["VLL"]], rows
+  end
+
+  # Breaking out early must leave the connection usable
+  def test_each_row_break
+    count = 0
+    @@ing.each_row("select ap_iatacode from airport") do |row|
+      count += 1
+      break if count == 2
+    end
+    assert_equal 2, count
+    assert_equal [[1]], @@ing.execute("select 1")
+  end
+
+  def test_each_row_exception
+    assert_raise RuntimeError do
+      @@ing.each_row("select ap_iatacode from airport") { |row| raise "stop" }
+    end
+    assert_equal [[1]], @@ing.execute("select 1")
+  end
+
+  def test_each_row_requires_block
+    assert_raise LocalJumpError do
+      @@ing.each_row("select ap_iatacode from airport")
+    end
+  end
+ 
+end
@@ -0,0 +1,41 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+
+class TestIngresQueryFetchRows < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(@@database, @@username, @@password), "conn is not an Ingres object")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_fetch_rows_default
+    assert_equal 0, @@ing.fetch_rows
+  end
+
+  # The result set must not depend on how many rows are fetched per call
+  def test_fetch_rows_same_results
+    sql = "select ap_iatacode, ap_place from airport order by ap_iatacode"
+    expected = @@ing.execute(sql)
+    [1, 7, 1000].each do |rows|
+      @@ing.fetch_rows = rows
+      assert_equal expected, @@ing.execute(sql)
+    end
+  end
+
+  def test_fetch_rows_per_execute
+    sql = "select ap_iatacode from airport where ap_iatacode = ?"
+    assert_equal [["VLL"]], @@ing.execute(sql, "c", "VLL", :fetch_rows => 3)
+  end
+
+  def test_fetch_rows_invalid
+    assert_raise ArgumentError do
+      @@ing.fetch_rows = -1
+    end
+  end
+ 
+end
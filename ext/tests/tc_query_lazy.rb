@@ -0,0 +1,55 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+
+class TestIngresQueryLazy < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(@@database, @@username, @@password), "conn is not an Ingres object")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_lazy_to_a_matches_execute
+    sql = "select ap_iatacode, ap_place, ap_name from airport order by ap_iatacode"
+    result = @@ing.execute(sql, :lazy => true)
+    assert_kind_of Ingres::Result, result
+    assert_equal @@ing.execute(sql), result.to_a
+  end
+
+  def test_lazy_indexing
+    sql = "select ap_iatacode, ap_place from airport order by ap_iatacode"
+    rows = @@ing.execute(sql)
+    result = @@ing.execute(sql, :lazy => true)
+    assert_equal rows.size, result.size
+    assert_equal ["ap_iatacode", "ap_place"], result.columns
+    assert_equal rows[0], result[0]
+    assert_equal rows[-1], result[-1]
+    assert_nil result[rows.size]
+    assert_equal rows[1][1], result[1, "ap_place"]
+    assert_equal rows[1][1], result[1, 1]
+    assert_equal rows.map { |row| row[0] }, result.column("ap_iatacode")
+    assert_raise IndexError do
+      result.column("no_such_column")
+    end
+  end
+
+  def test_lazy_each
+    sql = "select ap_iatacode from airport order by ap_iatacode"
+    rows = []
+    @@ing.execute(sql, :lazy => true).each { |row| rows << row }
+    assert_equal @@ing.execute(sql), rows
+  end
+
+  # The result outlives the statement and the connection it was fetched on
+  def test_lazy_after_disconnect
+    result = @@ing.execute("select ap_iatacode from airport where ap_iatacode = ?", "c", "VLL", :lazy => true)
+    @@ing.disconnect
+    assert_equal [["VLL"]], result.to_a
+    @@ing.connect(@@database, @@username, @@password)
+  end
+ 
+end
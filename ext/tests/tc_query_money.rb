@@ -0,0 +1,44 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+require 'bigdecimal'
+
+class TestIngresQueryMoney < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def connect(money)
+    @@ing.connect(:database => @@database, :username => @@username, :password => @@password, :money => money)
+  end
+
+  def test_money_float
+    connect(:float)
+    assert_equal [[123.45]], @@ing.execute("select money(123.45)")
+    assert_equal ["DOUBLE"], @@ing.data_types
+  end
+
+  def test_money_decimal
+    connect(:decimal)
+    assert_equal [[BigDecimal("123.45"), BigDecimal("-0.07")]], @@ing.execute("select money(123.45), money(-0.07)")
+    assert_equal ["DECIMAL", "DECIMAL"], @@ing.data_types
+  end
+
+  def test_money_cents
+    connect(:cents)
+    assert_equal [[12345, -7]], @@ing.execute("select money(123.45), money(-0.07)")
+    assert_equal ["INTEGER", "INTEGER"], @@ing.data_types
+  end
+
+  def test_money_invalid
+    assert_raise ArgumentError do
+      connect(:pennies)
+    end
+  end
+ 
+end
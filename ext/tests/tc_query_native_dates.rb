@@ -0,0 +1,43 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+require 'date'
+
+class TestIngresQueryNativeDates < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+    @@ing.connect(:database => @@database, :username => @@username, :password => @@password, :native_dates => true)
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_ansidate
+    assert_equal [[Date.new(2010, 1, 2)]], @@ing.execute("select ansidate('2010-01-02')")
+  end
+
+  def test_timestamp_without_time_zone
+    value = @@ing.execute("select timestamp_wo_tz('2010-01-02 10:11:12')")[0][0]
+    assert_kind_of Time, value
+    assert_equal [2010, 1, 2, 10, 11, 12], [value.year, value.month, value.day, value.hour, value.min, value.sec]
+  end
+
+  # Fractional seconds keep their full precision
+  def test_timestamp_nanoseconds
+    value = @@ing.execute("select cast('2010-01-02 10:11:12.123456789' as timestamp(9))")[0][0]
+    assert_equal 123456789, value.nsec
+  end
+
+  def test_ingresdate
+    assert_equal [[Date.new(2010, 1, 2)]], @@ing.execute("select ingresdate('2010-01-02')")
+    assert_kind_of Time, @@ing.execute("select ingresdate('2010-01-02 10:11:12')")[0][0]
+  end
+
+  # Intervals stored in an ingresdate are still returned as strings
+  def test_ingresdate_interval
+    assert_kind_of String, @@ing.execute("select ingresdate('3 days')")[0][0]
+  end
+ 
+end
@@ -0,0 +1,30 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+require 'bigdecimal'
+
+class TestIngresQueryNativeDecimals < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+    @@ing.connect(:database => @@database, :username => @@username, :password => @@password, :native_decimals => true)
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_decimal_with_scale
+    assert_equal [[BigDecimal("123.45"), BigDecimal("-0.05")]],
+                 @@ing.execute("select decimal(123.45, 5, 2), decimal(-0.05, 3, 2)")
+  end
+
+  def test_decimal_without_scale
+    assert_equal [[42, -7]], @@ing.execute("select decimal(42, 4, 0), decimal(-7, 5, 0)")
+  end
+
+  def test_wide_decimal
+    assert_equal [[12345678901234567890123]], @@ing.execute("select decimal(12345678901234567890123, 31, 0)")
+  end
+ 
+end
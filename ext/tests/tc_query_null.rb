@@ -0,0 +1,32 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+
+class TestIngresQueryNull < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(:database => @@database, :username => @@username, :password => @@password, :null_as_nil => true), "conn is not an Ingres object")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_null_is_nil
+    assert_equal [[nil, nil, 1]], @@ing.execute("select varchar(null), int4(null), 1")
+  end
+
+  def test_null_is_nil_lazy_and_columnar
+    assert_equal [[nil]], @@ing.execute("select int4(null)", :lazy => true).to_a
+    assert_equal [nil], @@ing.execute("select int4(null) as n", :format => :columns)["n"]
+  end
+
+  def test_null_as_string_by_default
+    ing = Ingres.new()
+    ing.connect(@@database, @@username, @@password)
+    assert_equal [["NULL", 1]], ing.execute("select int4(null), 1")
+    ing.disconnect
+  end
+ 
+end
@@ -0,0 +1,149 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+
+class TestIngresQueryPrepared < Test::Unit::TestCase
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(:database => @@database, :username => @@username, :password => @@password, :null_as_nil => true), "conn is not an Ingres object")
+    @@ing.execute("declare global temporary table session.prepared (id integer, txt varchar(20)) on commit preserve rows with norecovery")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_prepare_select
+    statement = @@ing.prepare("select ? from iidbconstants", "i")
+    assert_kind_of(Ingres::Statement, statement)
+    assert_equal [[1]], statement.execute(1)
+    assert_equal [[2]], statement.execute(2)
+    assert_equal "select ? from iidbconstants", statement.sql
+  end
+
+  def test_prepare_options
+    statement = @@ing.prepare("select ? from iidbconstants", "i")
+    assert_equal [42], statement.execute(42, :format => :columns).values.first
+  end
+
+  def test_prepare_insert_autocommit
+    insert = @@ing.prepare("insert into session.prepared values (?, ?)", "i", "v")
+    insert.execute(1, "one")
+    insert.execute(2, "two")
+    assert_equal 1, @@ing.rows_affected
+    assert_equal [[1, "one"], [2, "two"]], @@ing.execute("select id, txt from session.prepared order by id")
+  end
+
+  # Within a transaction the statement is PREPAREd on the server when it is
+  # run a second time, and again after each commit or rollback
+  def test_prepare_insert_transactions
+    insert = @@ing.prepare("insert into session.prepared values (?, ?)", "i", "v")
+    @@ing.execute "start transaction"
+    insert.execute(1, "one")
+    insert.execute(2, "two")
+    insert.execute(5, "five")
+    @@ing.commit
+    @@ing.execute "start transaction"
+    insert.execute(3, "three")
+    @@ing.rollback
+    @@ing.execute "start transaction"
+    insert.execute(4, "four")
+    @@ing.commit
+    assert_equal [[1], [2], [4], [5]], @@ing.execute("select id from session.prepared order by id")
+  end
+
+  # All of the values are sent to the server together
+  def test_prepare_wide_insert
+    columns = (1..30).map { |i| "c#{i} varchar(10)" }.join(", ")
+    @@ing.execute("declare global temporary table session.wide (#{columns}) on commit preserve rows with norecovery")
+    insert = @@ing.prepare("insert into session.wide values (#{(['?'] * 30).join(', ')})", *(['v'] * 30))
+    values = (1..30).map { |i| "value #{i}" }
+    insert.execute(*values)
+    assert_equal [values], @@ing.execute("select * from session.wide")
+  end
+
+  def test_prepare_mixed_types
+    statement = @@ing.prepare("select ?, ?, ?, ?, ? from iidbconstants", "i", "f", "v", "N", "v")
+    assert_equal [[1, 2.5, "three", "four", nil]], statement.execute(1, 2.5, "three", "four", nil)
+  end
+
+  def test_execute_batch
+    insert = @@ing.prepare("insert into session.prepared values (?, ?)", "i", "v")
+    assert_equal 3, insert.execute_batch([[1, "one"], [2, "two"], [3, "three"]])
+    assert_equal 3, @@ing.rows_affected
+    assert_equal [[1], [2], [3]], @@ing.execute("select id from session.prepared order by id")
+  end
+
+  def test_execute_batch_enumerator
+    insert = @@ing.prepare("insert into session.prepared values (?, ?)", "i", "v")
+    assert_equal 100, insert.execute_batch((1..100).lazy.map { |i| [i, "row #{i}"] })
+    assert_equal [[100]], @@ing.execute("select count(*) from session.prepared")
+  end
+
+  # The batch is rolled back as a whole when a row fails
+  def test_execute_batch_failure
+    insert = @@ing.prepare("insert into session.prepared values (?, ?)", "i", "v")
+    assert_raise(ArgumentError) { insert.execute_batch([[1, "one"], [2]]) }
+    assert_equal [[0]], @@ing.execute("select count(*) from session.prepared")
+    insert.execute(3, "three")
+    assert_equal [[1]], @@ing.execute("select count(*) from session.prepared")
+  end
+
+  # Leaving the batch early with throw rolls it back and restores auto-commit
+  def test_execute_batch_throw
+    insert = @@ing.prepare("insert into session.prepared values (?, ?)", "i", "v")
+    rows = Enumerator.new { |y| y << [1, "one"]; throw :stop }
+    catch(:stop) { insert.execute_batch(rows) }
+    assert_equal [[0]], @@ing.execute("select count(*) from session.prepared")
+    insert.execute(2, "two")
+    @@ing.rollback
+    assert_equal [[1]], @@ing.execute("select count(*) from session.prepared")
+  end
+
+  # Within a transaction the batch leaves committing to the caller
+  def test_execute_batch_transaction
+    insert = @@ing.prepare("insert into session.prepared values (?, ?)", "i", "v")
+    @@ing.execute "start transaction"
+    insert.execute_batch([[1, "one"], [2, "two"]])
+    @@ing.rollback
+    assert_equal [[0]], @@ing.execute("select count(*) from session.prepared")
+  end
+
+  def test_execute_many
+    assert_equal 2, @@ing.execute_many("insert into session.prepared values (?, ?)", ["i", "v"], [[1, "one"], [2, "two"]])
+    assert_equal [[1, "one"], [2, "two"]], @@ing.execute("select id, txt from session.prepared order by id")
+  end
+
+  def test_prepare_errors
+    assert_raise(ArgumentError) { @@ing.prepare("select ? from iidbconstants") }
+    assert_raise(ArgumentError) { @@ing.prepare("commit") }
+    statement = @@ing.prepare("select ? from iidbconstants", "i")
+    assert_raise(ArgumentError) { statement.execute }
+    statement.close
+    assert_raise(RuntimeError) { statement.execute(1) }
+  end
+
+  def test_prepare_repeated
+    statement = @@ing.prepare("select ? from iidbconstants", "i", :repeated => true)
+    assert_equal [[1]], statement.execute(1)
+    assert_equal [[2]], statement.execute(2)
+    assert_equal [[3]], statement.execute(3)
+  end
+
+  # The repeated query is defined again on the new session after a reconnect
+  def test_prepare_repeated_reconnect
+    statement = @@ing.prepare("select ? from iidbconstants", "i", :repeated => true)
+    assert_equal [[1]], statement.execute(1)
+    @@ing.disconnect
+    @@ing.connect(@@database, @@username, @@password)
+    assert_equal [[2]], statement.execute(2)
+  end
+
+  # CREATE TABLE can be prepared, but not run as a repeated query
+  def test_prepare_repeated_errors
+    @@ing.prepare("create table prepared_ddl (id integer)").close
+    assert_raise(ArgumentError) { @@ing.prepare("create table prepared_ddl (id integer)", :repeated => true) }
+  end
+
+end
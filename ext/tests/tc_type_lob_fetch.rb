@@ -16,5 +16,41 @@ class TestIngresTypeLOB < Test::Unit::TestCase
       sql = "select up_image from user_profile where up_id = 1"
       data = @@ing.execute(sql)
   end
+
+  # Values spanning many segments must be assembled in full
+  def test_blob_fetch_length
+      data = @@ing.execute("select up_image, length(up_image) from user_profile where up_id = 1")
+      assert_equal data[0][1], data[0][0].length
+  end
+
+  def test_blob_stream_to_io
+      require 'stringio'
+      sql = "select up_image from user_profile where up_id = 1"
+      io = StringIO.new
+      data = @@ing.execute(sql, :lob_sink => io)
+      assert_equal @@ing.execute(sql)[0][0], io.string
+      assert_equal [[io.string.length]], data
+  end
+
+  def test_blob_stream_to_block
+      sql = "select up_image from user_profile where up_id = 1"
+      segments = []
+      @@ing.execute(sql, :lob_sink => lambda { |segment| segments << segment })
+      assert_equal @@ing.execute(sql)[0][0], segments.join
+  end
+
+  # Code points split across segments are written whole, and the row gets
+  # the number of UTF-8 bytes written
+  def test_long_nvarchar_stream_to_io
+      require 'stringio'
+      @@ing.execute("declare global temporary table session.nlob (v long nvarchar) on commit preserve rows with norecovery")
+      value = "a" + "\u{1F600}" * 4000
+      @@ing.execute("insert into session.nlob values (?)", "N", value)
+      @@ing.execute("update session.nlob set v = v + v")
+      io = StringIO.new
+      data = @@ing.execute("select v from session.nlob", :lob_sink => io)
+      assert_equal value * 2, io.string.force_encoding("UTF-8")
+      assert_equal [[(value * 2).bytesize]], data
+  end
  
 end
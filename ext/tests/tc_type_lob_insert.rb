@@ -0,0 +1,50 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+require 'stringio'
+
+class TestIngresTypeLOBInsert < Test::Unit::TestCase
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(@@database, @@username, @@password), "conn is not an Ingres object")
+    @@ing.execute("declare global temporary table session.lob_insert (id integer, data long byte) on commit preserve rows with norecovery")
+  end
+
+  def teardown
+    @@ing.disconnect
+  end
+
+  def test_blob_insert_from_string
+    data = "\000\001\002" * 50000
+    @@ing.execute("insert into session.lob_insert values (?, ?)", "i", 1, "B", data)
+    assert_equal data, @@ing.execute("select data from session.lob_insert where id = 1")[0][0]
+  end
+
+  # The value is read from the IO a segment at a time
+  def test_blob_insert_from_io
+    data = "\000\001\002" * 50000
+    @@ing.execute("insert into session.lob_insert values (?, ?)", "i", 2, "B", StringIO.new(data))
+    assert_equal data, @@ing.execute("select data from session.lob_insert where id = 2")[0][0]
+  end
+
+  def test_blob_insert_from_empty_io
+    @@ing.execute("insert into session.lob_insert values (?, ?)", "i", 3, "B", StringIO.new(""))
+    assert_equal "", @@ing.execute("select data from session.lob_insert where id = 3")[0][0]
+  end
+
+  # An IO that fails part way through leaves the connection usable and
+  # nothing inserted
+  def test_blob_insert_from_failing_io
+    io = StringIO.new("\000\001\002" * 50000)
+    def io.read(*args)
+      @reads = (@reads || 0) + 1
+      raise IOError, "disk went away" if @reads > 2
+      super
+    end
+    assert_raise IOError do
+      @@ing.execute("insert into session.lob_insert values (?, ?)", "i", 4, "B", io)
+    end
+    assert_equal [], @@ing.execute("select id from session.lob_insert where id = 4")
+  end
+ 
+end
@@ -0,0 +1,51 @@
+require 'Ingres'
+require 'test/unit'
+require 'ext/tests/config.rb'
+
+class TestIngresTypeLOBLocator < Test::Unit::TestCase
+  SQL = "select up_image from user_profile where up_id = 1"
+
+  def setup
+    @@ing = Ingres.new()
+    assert_kind_of(Ingres, @@ing.connect(@@database), "conn is not an Ingres object")
+    @@ing.execute("start transaction")
+    @@image = @@ing.execute(SQL)[0][0]
+  end
+
+  def teardown
+    @@ing.rollback
+    @@ing.disconnect
+  end
+
+  def test_locator_returned
+    lob = @@ing.execute(SQL, :lob_locators => true)[0][0]
+    assert_kind_of(Ingres::Lob, lob)
+    assert_equal @@image.length, lob.length
+  end
+
+  def test_locator_read
+    lob = @@ing.execute(SQL, :lob_locators => true)[0][0]
+    assert_equal @@image, lob.read
+    assert_equal @@image[0, 8], lob.read(0, 8)
+    assert_equal @@image[10..-1], lob.read(10)
+  end
+
+  def test_locator_each_segment
+    lob = @@ing.execute(SQL, :lob_locators => true)[0][0]
+    segments = []
+    assert_equal lob, lob.each_segment { |segment| segments << segment }
+    assert_equal @@image, segments.join
+  end
+
+  def test_locator_invalid_after_transaction
+    lob = @@ing.execute(SQL, :lob_locators => true)[0][0]
+    @@ing.rollback
+    assert_raise(RuntimeError) { lob.length }
+  end
+
+  def test_locator_needs_transaction
+    @@ing.rollback
+    assert_raise(RuntimeError) { @@ing.execute(SQL, :lob_locators => true) }
+  end
+
+end
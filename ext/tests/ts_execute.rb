@@ -1 +1,14 @@
 require 'ext/tests/tc_query_simple.rb'
+require 'ext/tests/tc_query_fetch_rows.rb'
+require 'ext/tests/tc_query_each_row.rb'
+require 'ext/tests/tc_query_cursor.rb'
+require 'ext/tests/tc_query_lazy.rb'
+require 'ext/tests/tc_query_columnar.rb'
+require 'ext/tests/tc_query_null.rb'
+require 'ext/tests/tc_query_native_dates.rb'
+require 'ext/tests/tc_query_native_decimals.rb'
+require 'ext/tests/tc_query_money.rb'
+require 'ext/tests/tc_query_cancel.rb'
+require 'ext/tests/tc_query_async.rb'
+require 'ext/tests/tc_query_prepared.rb'
+require 'ext/tests/tc_query_copy_in.rb'
@@ -1,2 +1,4 @@
 require 'ext/tests/tc_type_lob_fetch.rb'
 require 'ext/tests/tc_type_date_fetch.rb'
+require 'ext/tests/tc_type_lob_insert.rb'
+require 'ext/tests/tc_type_lob_locator.rb'
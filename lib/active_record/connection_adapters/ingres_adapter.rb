@@ -84,6 +84,11 @@ module ActiveRecord
     # * <tt>:username</tt> - Optional-Defaults to nothing
     # * <tt>:password</tt> - Optional-Defaults to nothing
     # * <tt>:database</tt> - The name of the database. No default, must be provided.
+    # * <tt>:fetch_rows</tt> - Optional-Rows fetched per server call, defaults to sizing from the result columns
+    # * <tt>:native_dates</tt> - Optional-Decode date/time columns directly into Time and Date objects
+    # * <tt>:native_decimals</tt> - Optional-Decode decimal columns directly into Integer and BigDecimal objects
+    # * <tt>:statement_timeout</tt> - Optional-Seconds (a Float for fractions) a statement may run for before it is cancelled, kept apart from the pool's millisecond <tt>:timeout</tt>
+    # * <tt>:repeated_queries</tt> - Optional-Run SELECT, INSERT, UPDATE and DELETE statements with binds as Ingres repeated queries, keeping their query plans on the server
     #
     # Author: jared@jaredrichardson.net
     # Maintainer: bruce.lunsford@ingres.com
@@ -284,11 +289,8 @@ module ActiveRecord
 
       def exec_query(sql, name = 'SQL', binds = [])
         log(sql, name, binds) do
-          #TODO Aiming to do prepared statements but we'll have to do changes to the C API
-          #result = binds.empty? ? exec_no_cache(sql, binds) :
-          #                        exec_cache(sql, binds)
-          result = binds.empty? ? @connection.execute(sql) :
-                                  @connection.execute(sql, *binds.map { |bind| [PARAMETERS_TYPES[bind[0].sql_type.downcase], bind[1]] }.flatten)
+          result = binds.empty? ? exec_no_cache(sql, binds) :
+                                  exec_cache(sql, binds)
 
           if @connection.rows_affected
             # Dirty hack for ASCII-8BIT strings
@@ -365,7 +367,7 @@ module ActiveRecord
           else
             last_identity = last_identity_for_table(ary[0]) 
           end
-          if last_identity == "NULL"
+          if last_identity.nil?
             next_value = 1
           else
             next_value = last_identity + 1
@@ -403,11 +405,8 @@ module ActiveRecord
           row.each do |item |
 
             col_name = col_names[index].rstrip
-            col_val = item.to_s.rstrip
+            col_val = item.nil? ? nil : item.to_s.rstrip
 
-            if (col_val=="NULL") then
-              col_val = nil
-            end
             this_column[ col_name] = col_val
             index += 1
           end
@@ -655,15 +654,21 @@ module ActiveRecord
 
       private
 
-      #def exec_no_cache(sql, binds)
-      #  @connection.execute(sql)
-      #end
+      def exec_no_cache(sql, binds)
+        @connection.execute(sql)
+      end
 
-      #def exec_cache(sql, binds)
-      #  begin
-      #    stmt_key = prepare_statement sql
-      #  end
-      #end
+      # Statements with binds are prepared once and kept in @statements,
+      # keyed on the SQL and the parameter types
+      def exec_cache(sql, binds)
+        types = binds.map { |column, _| PARAMETERS_TYPES[column.sql_type.downcase] }
+        key = "#{types.join}:#{sql}"
+        unless @statements.key?(key)
+          repeated = @config[:repeated_queries] && sql =~ /\A\s*(select|insert|update|delete)\b/i
+          @statements[key] = { :stmt => @connection.prepare(sql, *types, :repeated => !!repeated) }
+        end
+        @statements[key][:stmt].execute(*binds.map { |_, value| value })
+      end
 
       def connect
         @connection = Ingres.new
@@ -674,7 +679,13 @@ module ActiveRecord
           :database    => @connection_parameters[4],
           :username    => @connection_parameters[5],
           :password    => @connection_parameters[6],
-          :date_format => Ingres::DATE_FORMAT_FINLAND
+          :date_format => Ingres::DATE_FORMAT_FINLAND,
+          :fetch_rows  => @config[:fetch_rows],
+          :null_as_nil => true,
+          :native_dates => @config[:native_dates],
+          :native_decimals => @config[:native_decimals],
+          :timeout => @config[:statement_timeout],
+          :money => :decimal
         })
 
         configure_connection
@@ -726,7 +737,7 @@ module ActiveRecord
               # to avoid possible duplicate key values
               sql = "SELECT max(#{identity_col}) from #{table}"
               max_id = @connection.execute(sql)[0][0]
-              max_id = 0 if max_id == "NULL"
+              max_id = 0 if max_id.nil?
               until next_identity > max_id
                 sql = "SELECT #{sequence_name}.nextval"
                 next_identity = @connection.execute(sql)[0][0]